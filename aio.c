@@ -0,0 +1,705 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "aio.h"
+
+/* Older toolchains (eg. for the Pi) may lack the header or syscall numbers, they only get the thread pool.
+ *  IORING_SETUP_ATTACH_WQ marks 5.6 headers, with IORING_OP_WRITE and probing */
+#if defined(IORING_SETUP_ATTACH_WQ) && defined(__NR_io_uring_setup)
+#define AIO_URING
+#endif
+
+#define AIO_TAG_WRITE   0x1 /* In a write's user_data, the sync that may follow it has the bare pointer */
+
+typedef struct aio_request_s {
+    int fd;
+    const void *buffer;
+    uint32_t length;
+    uint64_t offset;
+    bool sync;
+    aio_callback_t callback;
+    void *context;
+
+    uint64_t submitted_us;
+    int result;
+    uint32_t written;
+    uint32_t pending; /* io_uring completions to come */
+    bool resubmit; /* After a short write */
+    struct aio_request_s *next;
+} aio_request_t;
+
+struct aio_s {
+    int event_fd;
+    bool uring;
+
+    aio_request_t requests[AIO_DEPTH];
+    aio_request_t *free; /* Only used from the caller's thread */
+    uint32_t in_flight;
+
+#ifdef AIO_URING
+    int ring_fd;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+#endif
+
+    /* Thread pool */
+    pthread_t threads[AIO_THREADS];
+    uint32_t threads_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    aio_request_t *queue_head, *queue_tail;
+    aio_request_t *done;
+    bool stop;
+
+    /* Statistics, submission to reaped */
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t latency_us_total;
+    uint64_t latency_us_max;
+    uint64_t histogram[AIO_LATENCY_BUCKETS];
+};
+
+static uint64_t aio_monotonic_us(void)
+{
+    struct timespec tp;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t) tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+#ifdef AIO_URING
+
+static int aio_uring_init(aio_t *aio)
+{
+    struct io_uring_params params;
+    struct io_uring_probe *probe;
+    bool supported;
+
+    memset(&params, 0, sizeof(params));
+    aio->ring_fd = syscall(__NR_io_uring_setup, 2 * AIO_DEPTH, &params);
+    if(aio->ring_fd < 0)
+    {
+        return -1;
+    }
+
+    /* IORING_OP_WRITE needs 5.6, which is also when probing arrived */
+    probe = calloc(1, sizeof(struct io_uring_probe) + (256 * sizeof(struct io_uring_probe_op)));
+    if(probe == NULL)
+    {
+        goto fail;
+    }
+    supported = syscall(__NR_io_uring_register, aio->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0
+        && probe->last_op >= IORING_OP_WRITE
+        && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+        && (probe->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if(!supported)
+    {
+        goto fail;
+    }
+
+    aio->sq_map_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    aio->cq_map_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(aio->cq_map_size > aio->sq_map_size)
+        {
+            aio->sq_map_size = aio->cq_map_size;
+        }
+        aio->cq_map_size = aio->sq_map_size;
+    }
+
+    aio->sq_map = mmap(NULL, aio->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQ_RING);
+    if(aio->sq_map == MAP_FAILED)
+    {
+        aio->sq_map = NULL;
+        goto fail;
+    }
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        aio->cq_map = aio->sq_map;
+    }
+    else
+    {
+        aio->cq_map = mmap(NULL, aio->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_CQ_RING);
+        if(aio->cq_map == MAP_FAILED)
+        {
+            aio->cq_map = NULL;
+            goto fail;
+        }
+    }
+
+    aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQES);
+    if(aio->sqes == MAP_FAILED)
+    {
+        aio->sqes = NULL;
+        goto fail;
+    }
+
+    aio->sq_head = (unsigned *)((uint8_t *)aio->sq_map + params.sq_off.head);
+    aio->sq_tail = (unsigned *)((uint8_t *)aio->sq_map + params.sq_off.tail);
+    aio->sq_mask = (unsigned *)((uint8_t *)aio->sq_map + params.sq_off.ring_mask);
+    aio->sq_array = (unsigned *)((uint8_t *)aio->sq_map + params.sq_off.array);
+    aio->cq_head = (unsigned *)((uint8_t *)aio->cq_map + params.cq_off.head);
+    aio->cq_tail = (unsigned *)((uint8_t *)aio->cq_map + params.cq_off.tail);
+    aio->cq_mask = (unsigned *)((uint8_t *)aio->cq_map + params.cq_off.ring_mask);
+    aio->cqes = (struct io_uring_cqe *)((uint8_t *)aio->cq_map + params.cq_off.cqes);
+
+    if(syscall(__NR_io_uring_register, aio->ring_fd, IORING_REGISTER_EVENTFD, &aio->event_fd, 1) != 0)
+    {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if(aio->sqes != NULL)
+    {
+        munmap(aio->sqes, aio->sqes_size);
+        aio->sqes = NULL;
+    }
+    if(aio->cq_map != NULL && aio->cq_map != aio->sq_map)
+    {
+        munmap(aio->cq_map, aio->cq_map_size);
+    }
+    aio->cq_map = NULL;
+    if(aio->sq_map != NULL)
+    {
+        munmap(aio->sq_map, aio->sq_map_size);
+        aio->sq_map = NULL;
+    }
+    close(aio->ring_fd);
+    aio->ring_fd = -1;
+    return -1;
+}
+
+static void aio_uring_close(aio_t *aio)
+{
+    munmap(aio->sqes, aio->sqes_size);
+    if(aio->cq_map != aio->sq_map)
+    {
+        munmap(aio->cq_map, aio->cq_map_size);
+    }
+    munmap(aio->sq_map, aio->sq_map_size);
+    close(aio->ring_fd);
+}
+
+static struct io_uring_sqe *aio_uring_sqe(aio_t *aio, unsigned *tail)
+{
+    unsigned index = *tail & *aio->sq_mask;
+    struct io_uring_sqe *sqe = &aio->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    aio->sq_array[index] = index;
+    (*tail)++;
+
+    return sqe;
+}
+
+/* A write linked to its sync, so the sync only runs once the write has succeeded. Everything the kernel hasn't yet
+ *  consumed is submitted, so any entries left by a short submission go with it. A failed enter consumes nothing, the
+ *  request's entries are then taken back out of the ring and the caller fails the request, as nothing would otherwise
+ *  submit them and aio_wait() would never see them complete. */
+static int aio_uring_submit(aio_t *aio, aio_request_t *request)
+{
+    struct io_uring_sqe *sqe;
+    unsigned start = *aio->sq_tail;
+    unsigned tail = start;
+    uint32_t count = 0;
+    int result;
+
+    if(request->written < request->length)
+    {
+        sqe = aio_uring_sqe(aio, &tail);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = request->fd;
+        sqe->addr = (uintptr_t)request->buffer + request->written;
+        sqe->len = request->length - request->written;
+        sqe->off = request->offset + request->written;
+        sqe->flags = request->sync ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (uintptr_t)request | AIO_TAG_WRITE;
+        count++;
+    }
+
+    if(request->sync)
+    {
+        sqe = aio_uring_sqe(aio, &tail);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = request->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = (uintptr_t)request;
+        count++;
+    }
+
+    request->pending = count;
+    __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+
+    do
+    {
+        result = syscall(__NR_io_uring_enter, aio->ring_fd, tail - __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE), 0, 0, NULL, 0);
+    } while(result < 0 && errno == EINTR);
+
+    if(result < 0)
+    {
+        __atomic_store_n(aio->sq_tail, start, __ATOMIC_RELEASE);
+        request->pending = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* A short write (the kernel may stop part way when it can't allocate without blocking) cancels the linked sync, the
+ *  rest is then submitted again with its sync. The sync can also come back cancelled after a complete write (seen
+ *  with O_APPEND on 6.x), it's then submitted again on its own */
+static aio_request_t *aio_uring_next(aio_t *aio)
+{
+    struct io_uring_cqe *cqe;
+    aio_request_t *request;
+    unsigned head = *aio->cq_head;
+
+    while(head != __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        cqe = &aio->cqes[head & *aio->cq_mask];
+        request = (aio_request_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)AIO_TAG_WRITE);
+
+        if(cqe->user_data & AIO_TAG_WRITE)
+        {
+            if(cqe->res > 0)
+            {
+                request->written += cqe->res;
+                if(request->written < request->length)
+                {
+                    request->resubmit = true;
+                }
+            }
+            else if(request->result >= 0)
+            {
+                request->result = (cqe->res < 0) ? cqe->res : -EIO;
+            }
+        }
+        else if(cqe->res == -ECANCELED)
+        {
+            request->resubmit = true;
+        }
+        else if(cqe->res < 0 && request->result >= 0)
+        {
+            request->result = cqe->res;
+        }
+
+        head++;
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+
+        if(--request->pending > 0)
+        {
+            continue;
+        }
+
+        if(request->resubmit && request->result >= 0)
+        {
+            request->resubmit = false;
+            if(aio_uring_submit(aio, request) == 0)
+            {
+                continue;
+            }
+            request->result = -errno;
+            fprintf(stderr, "Error: io_uring_enter: %s\n", strerror(-request->result));
+        }
+        else if(request->result >= 0)
+        {
+            request->result = request->written;
+        }
+        return request;
+    }
+
+    return NULL;
+}
+
+#endif /* AIO_URING */
+
+static void *aio_worker(void *arg)
+{
+    aio_t *aio = (aio_t *)arg;
+    aio_request_t *request;
+    uint32_t written;
+    ssize_t result;
+
+    while(true)
+    {
+        pthread_mutex_lock(&aio->mutex);
+        while(aio->queue_head == NULL && !aio->stop)
+        {
+            pthread_cond_wait(&aio->cond, &aio->mutex);
+        }
+        request = aio->queue_head;
+        if(request == NULL)
+        {
+            pthread_mutex_unlock(&aio->mutex);
+            break;
+        }
+        aio->queue_head = request->next;
+        if(aio->queue_head == NULL)
+        {
+            aio->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&aio->mutex);
+
+        for(written = 0; written < request->length; written += result)
+        {
+            result = pwrite(request->fd, (const uint8_t *)request->buffer + written, request->length - written, request->offset + written);
+            if(result < 0 && errno == EINTR)
+            {
+                result = 0;
+                continue;
+            }
+            if(result <= 0)
+            {
+                request->result = (result < 0) ? -errno : -EIO;
+                break;
+            }
+        }
+        if(request->result >= 0)
+        {
+            request->result = request->length;
+            if(request->sync && fdatasync(request->fd) != 0)
+            {
+                request->result = -errno;
+            }
+        }
+
+        pthread_mutex_lock(&aio->mutex);
+        request->next = aio->done;
+        aio->done = request;
+        pthread_mutex_unlock(&aio->mutex);
+
+        eventfd_write(aio->event_fd, 1);
+    }
+
+    return NULL;
+}
+
+static int aio_threads_start(aio_t *aio)
+{
+    pthread_mutex_init(&aio->mutex, NULL);
+    pthread_cond_init(&aio->cond, NULL);
+
+    for(uint32_t i = 0; i < AIO_THREADS; i++)
+    {
+        if(pthread_create(&aio->threads[i], NULL, aio_worker, aio) != 0)
+        {
+            return -1;
+        }
+        aio->threads_count++;
+    }
+
+    return 0;
+}
+
+static void aio_threads_stop(aio_t *aio)
+{
+    pthread_mutex_lock(&aio->mutex);
+    aio->stop = true;
+    pthread_cond_broadcast(&aio->cond);
+    pthread_mutex_unlock(&aio->mutex);
+
+    for(uint32_t i = 0; i < aio->threads_count; i++)
+    {
+        pthread_join(aio->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&aio->cond);
+    pthread_mutex_destroy(&aio->mutex);
+}
+
+/* With threads_only, or where io_uring is unavailable (old kernel, or disabled), writes go through a thread pool */
+aio_t *aio_create(bool threads_only)
+{
+    aio_t *aio;
+
+    aio = calloc(1, sizeof(aio_t));
+    if(aio == NULL)
+    {
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < AIO_DEPTH; i++)
+    {
+        aio->requests[i].next = aio->free;
+        aio->free = &aio->requests[i];
+    }
+
+    aio->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(aio->event_fd < 0)
+    {
+        free(aio);
+        return NULL;
+    }
+
+#ifdef AIO_URING
+    aio->ring_fd = -1;
+    if(!threads_only && aio_uring_init(aio) == 0)
+    {
+        aio->uring = true;
+        return aio;
+    }
+#else
+    (void)threads_only;
+#endif
+
+    if(aio_threads_start(aio) != 0)
+    {
+        aio_threads_stop(aio);
+        close(aio->event_fd);
+        free(aio);
+        return NULL;
+    }
+
+    return aio;
+}
+
+const char *aio_backend(const aio_t *aio)
+{
+    return aio->uring ? "io_uring" : "thread pool";
+}
+
+int aio_event_fd(const aio_t *aio)
+{
+    return aio->event_fd;
+}
+
+/* Writes length bytes at offset (length may be 0), then fdatasync()s if sync is set. Returns -1 if the queue is full or
+ *  the submission failed, the callback is then never called */
+int aio_write(aio_t *aio, int fd, const void *buffer, uint32_t length, uint64_t offset, bool sync, aio_callback_t callback, void *context)
+{
+    aio_request_t *request = aio->free;
+
+    if(request == NULL)
+    {
+        return -1;
+    }
+    aio->free = request->next;
+
+    request->fd = fd;
+    request->buffer = buffer;
+    request->length = length;
+    request->offset = offset;
+    request->sync = sync;
+    request->callback = callback;
+    request->context = context;
+    request->result = 0;
+    request->written = 0;
+    request->resubmit = false;
+    request->next = NULL;
+    request->submitted_us = aio_monotonic_us();
+
+    aio->in_flight++;
+    aio->submitted++;
+
+#ifdef AIO_URING
+    if(aio->uring)
+    {
+        if(aio_uring_submit(aio, request) != 0)
+        {
+            /* Not in flight, the caller fails it */
+            fprintf(stderr, "Error: io_uring_enter: %s\n", strerror(errno));
+            request->next = aio->free;
+            aio->free = request;
+            aio->in_flight--;
+            aio->submitted--;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+    pthread_mutex_lock(&aio->mutex);
+    if(aio->queue_tail != NULL)
+    {
+        aio->queue_tail->next = request;
+    }
+    else
+    {
+        aio->queue_head = request;
+    }
+    aio->queue_tail = request;
+    pthread_cond_signal(&aio->cond);
+    pthread_mutex_unlock(&aio->mutex);
+
+    return 0;
+}
+
+static void aio_complete(aio_t *aio, aio_request_t *request)
+{
+    aio_callback_t callback = request->callback;
+    void *context = request->context;
+    int result = request->result;
+    uint64_t latency_us = aio_monotonic_us() - request->submitted_us;
+    uint32_t bucket = 0;
+
+    while(bucket < AIO_LATENCY_BUCKETS - 1 && (latency_us >> (bucket + 1)) > 0)
+    {
+        bucket++;
+    }
+    aio->histogram[bucket]++;
+    aio->latency_us_total += latency_us;
+    if(latency_us > aio->latency_us_max)
+    {
+        aio->latency_us_max = latency_us;
+    }
+    aio->completed++;
+    if(result < 0)
+    {
+        aio->failed++;
+    }
+
+    /* Freed first, so the callback can submit the next request */
+    request->next = aio->free;
+    aio->free = request;
+    aio->in_flight--;
+
+    callback(context, result);
+}
+
+/* Runs the callbacks of completed requests, never blocks. Returns how many completed */
+uint32_t aio_reap(aio_t *aio)
+{
+    aio_request_t *request, *done;
+    eventfd_t value;
+    uint32_t count = 0;
+
+    eventfd_read(aio->event_fd, &value);
+
+#ifdef AIO_URING
+    if(aio->uring)
+    {
+        while((request = aio_uring_next(aio)) != NULL)
+        {
+            aio_complete(aio, request);
+            count++;
+        }
+        return count;
+    }
+#endif
+
+    pthread_mutex_lock(&aio->mutex);
+    done = aio->done;
+    aio->done = NULL;
+    pthread_mutex_unlock(&aio->mutex);
+
+    while(done != NULL)
+    {
+        request = done;
+        done = done->next;
+        aio_complete(aio, request);
+        count++;
+    }
+
+    return count;
+}
+
+/* Blocks until at least one request completes, if any are in flight */
+uint32_t aio_wait(aio_t *aio)
+{
+    struct pollfd pfd = { .fd = aio->event_fd, .events = POLLIN };
+    uint32_t count = 0;
+
+    while(aio->in_flight > 0 && (count = aio_reap(aio)) == 0)
+    {
+        if(poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            break;
+        }
+    }
+
+    return count;
+}
+
+void aio_print_stats(const aio_t *aio, const char *label)
+{
+    char distribution[512];
+    int length = 0;
+
+    for(uint32_t i = 0; i < AIO_LATENCY_BUCKETS && length >= 0 && (size_t)length < sizeof(distribution); i++)
+    {
+        if(aio->histogram[i] == 0)
+        {
+            continue;
+        }
+        if(i == AIO_LATENCY_BUCKETS - 1)
+        {
+            length += snprintf(&distribution[length], sizeof(distribution) - length, " >=%"PRIu64"us:%"PRIu64, (uint64_t)1 << i, aio->histogram[i]);
+        }
+        else
+        {
+            length += snprintf(&distribution[length], sizeof(distribution) - length, " <%"PRIu64"us:%"PRIu64, (uint64_t)2 << i, aio->histogram[i]);
+        }
+    }
+    if(length == 0)
+    {
+        snprintf(distribution, sizeof(distribution), " none");
+    }
+
+    printf("[%s] AIO (%s): %"PRIu64" requests, %"PRIu64" failed, latency mean %"PRIu64" us, max %"PRIu64" us, distribution%s\n",
+        label, aio_backend(aio), aio->completed, aio->failed,
+        aio->completed > 0 ? aio->latency_us_total / aio->completed : 0, aio->latency_us_max, distribution);
+}
+
+/* Waits for anything still in flight */
+void aio_destroy(aio_t *aio)
+{
+    if(aio == NULL)
+    {
+        return;
+    }
+
+    while(aio->in_flight > 0)
+    {
+        aio_wait(aio);
+    }
+
+#ifdef AIO_URING
+    if(aio->uring)
+    {
+        aio_uring_close(aio);
+    }
+    else
+#endif
+    {
+        aio_threads_stop(aio);
+    }
+
+    close(aio->event_fd);
+    free(aio);
+}
@@ -0,0 +1,27 @@
+#ifndef __AIO_H__
+#define __AIO_H__
+
+/* Asynchronous appends and syncs, through io_uring (raw syscalls) where the kernel supports it, else a small thread pool.
+ *  Completion is signalled on aio_event_fd(), and callbacks are run by aio_reap() on the caller's thread, so the
+ *  caller's event loop never blocks on the device. Requests on the same fd must not overlap, the caller waits for
+ *  one to complete before submitting the next. */
+
+#define AIO_DEPTH               16 /* Requests in flight */
+#define AIO_THREADS             2
+#define AIO_LATENCY_BUCKETS     24 /* Powers of two of microseconds, the last up to ~8 s and beyond */
+
+/* result is the number of bytes written, or -errno */
+typedef void (*aio_callback_t)(void *context, int result);
+
+typedef struct aio_s aio_t;
+
+aio_t *aio_create(bool threads_only);
+const char *aio_backend(const aio_t *aio);
+int aio_event_fd(const aio_t *aio);
+int aio_write(aio_t *aio, int fd, const void *buffer, uint32_t length, uint64_t offset, bool sync, aio_callback_t callback, void *context);
+uint32_t aio_reap(aio_t *aio);
+uint32_t aio_wait(aio_t *aio);
+void aio_print_stats(const aio_t *aio, const char *label);
+void aio_destroy(aio_t *aio);
+
+#endif /* __AIO_H__ */
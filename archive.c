@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spectrum.h"
+#include "archive.h"
+
+#define ARCHIVE_RICE_ESCAPE     16 /* Quotient that introduces a raw value */
+#define ARCHIVE_RAW_BITS        9 /* Zigzag of -255..255 */
+#define ARCHIVE_BLOCK_META      13 /* span, res, center, pga */
+
+typedef struct {
+    uint8_t *data;
+    uint32_t length;
+    uint64_t bits;
+    uint32_t count;
+} bit_writer_t;
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t length;
+    uint32_t offset;
+    uint64_t bits;
+    uint32_t count;
+} bit_reader_t;
+
+static void bit_write(bit_writer_t *writer, uint32_t value, uint32_t bits)
+{
+    writer->bits |= (uint64_t)value << writer->count;
+    writer->count += bits;
+    while(writer->count >= 8)
+    {
+        writer->data[writer->length++] = writer->bits & 0xff;
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+static void bit_write_flush(bit_writer_t *writer)
+{
+    if(writer->count > 0)
+    {
+        writer->data[writer->length++] = writer->bits & 0xff;
+    }
+    writer->bits = 0;
+    writer->count = 0;
+}
+
+/* Returns false past the end of the data */
+static bool bit_read(bit_reader_t *reader, uint32_t bits, uint32_t *value)
+{
+    while(reader->count < bits)
+    {
+        if(reader->offset >= reader->length)
+        {
+            return false;
+        }
+        reader->bits |= (uint64_t)reader->data[reader->offset++] << reader->count;
+        reader->count += 8;
+    }
+
+    *value = reader->bits & ((1u << bits) - 1);
+    reader->bits >>= bits;
+    reader->count -= bits;
+    return true;
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/* Rice parameter for the block's mean zigzag value */
+static uint32_t rice_parameter(const uint32_t *values)
+{
+    uint32_t total = 0, mean, k = 0;
+
+    for(int i = 0; i < SPECTRUM_BINS; i++)
+    {
+        total += values[i];
+    }
+
+    mean = total / SPECTRUM_BINS;
+    while(k < 8 && (1u << (k + 1)) <= mean + 1)
+    {
+        k++;
+    }
+
+    return k;
+}
+
+static uint32_t block_meta_write(uint8_t *buffer, const spectrum_block_t *block)
+{
+    memcpy(&buffer[0], &block->span, 4);
+    memcpy(&buffer[4], &block->res, 4);
+    memcpy(&buffer[8], &block->center, 4);
+    buffer[12] = block->pga;
+    return ARCHIVE_BLOCK_META;
+}
+
+static void block_meta_read(const uint8_t *buffer, spectrum_block_t *block)
+{
+    memcpy(&block->span, &buffer[0], 4);
+    memcpy(&block->res, &buffer[4], 4);
+    memcpy(&block->center, &buffer[8], 4);
+    block->pga = buffer[12];
+    memset(block->reserved, 0, sizeof(block->reserved));
+}
+
+static bool block_meta_equal(const spectrum_block_t *a, const spectrum_block_t *b)
+{
+    return a->span == b->span && a->res == b->res && a->center == b->center && a->pga == b->pga;
+}
+
+/* Returns the encoded length */
+static uint32_t archive_encode(archive_writer_t *writer, const spectrum_record_t *record, bool keyframe)
+{
+    uint8_t *buffer = writer->buffer;
+    uint32_t length = 2;
+    uint32_t values[SPECTRUM_BINS];
+    uint64_t timestamp_delta;
+    const spectrum_block_t *block, *previous;
+    bit_writer_t bits;
+    uint32_t k;
+    uint8_t *flags;
+
+    buffer[length++] = keyframe ? ARCHIVE_RECORD_KEY : ARCHIVE_RECORD_DELTA;
+
+    if(keyframe)
+    {
+        memcpy(&buffer[length], &record->timestamp_ms, 8);
+        length += 8;
+
+        for(uint32_t b = 0; b < writer->blocks; b++)
+        {
+            length += block_meta_write(&buffer[length], &record->block[b]);
+            memcpy(&buffer[length], record->block[b].spectrum, SPECTRUM_BINS);
+            length += SPECTRUM_BINS;
+        }
+    }
+    else
+    {
+        /* Varint */
+        timestamp_delta = record->timestamp_ms - writer->previous.timestamp_ms;
+        do
+        {
+            buffer[length++] = (timestamp_delta & 0x7f) | (timestamp_delta >= 0x80 ? 0x80 : 0x00);
+            timestamp_delta >>= 7;
+        } while(timestamp_delta > 0);
+
+        for(uint32_t b = 0; b < writer->blocks; b++)
+        {
+            block = &record->block[b];
+            previous = &writer->previous.block[b];
+
+            for(int i = 0; i < SPECTRUM_BINS; i++)
+            {
+                values[i] = zigzag((int32_t)block->spectrum[i] - (int32_t)previous->spectrum[i]);
+            }
+            k = rice_parameter(values);
+
+            flags = &buffer[length++];
+            *flags = k << 4;
+            if(!block_meta_equal(block, previous))
+            {
+                *flags |= 0x01;
+                length += block_meta_write(&buffer[length], block);
+            }
+
+            bits.data = &buffer[length];
+            bits.length = 0;
+            bits.bits = 0;
+            bits.count = 0;
+            for(int i = 0; i < SPECTRUM_BINS; i++)
+            {
+                if((values[i] >> k) >= ARCHIVE_RICE_ESCAPE)
+                {
+                    bit_write(&bits, (1u << ARCHIVE_RICE_ESCAPE) - 1, ARCHIVE_RICE_ESCAPE);
+                    bit_write(&bits, values[i], ARCHIVE_RAW_BITS);
+                    continue;
+                }
+
+                /* Unary quotient, ones terminated by a zero, then the k-bit remainder */
+                bit_write(&bits, (1u << (values[i] >> k)) - 1, (values[i] >> k) + 1);
+                if(k > 0)
+                {
+                    bit_write(&bits, values[i] & ((1u << k) - 1), k);
+                }
+            }
+            bit_write_flush(&bits);
+            length += bits.length;
+        }
+    }
+
+    buffer[0] = (length - 2) & 0xff;
+    buffer[1] = (length - 2) >> 8;
+
+    return length;
+}
+
+/* Decodes a record's payload against the previous one, returns false if it's malformed */
+static bool archive_decode(const uint8_t *payload, uint32_t payload_length, uint8_t blocks,
+    const spectrum_record_t *previous, bool have_previous, spectrum_record_t *record)
+{
+    uint32_t offset = 1;
+    uint64_t timestamp_delta = 0;
+    uint32_t shift = 0, k, flags, value, quotient, bit;
+    spectrum_block_t *block;
+    bit_reader_t bits;
+
+    if(payload_length < 1)
+    {
+        return false;
+    }
+
+    if(payload[0] == ARCHIVE_RECORD_KEY)
+    {
+        if(payload_length != 1 + 8 + ((uint32_t)blocks * (ARCHIVE_BLOCK_META + SPECTRUM_BINS)))
+        {
+            return false;
+        }
+
+        memcpy(&record->timestamp_ms, &payload[offset], 8);
+        offset += 8;
+
+        for(uint32_t b = 0; b < blocks; b++)
+        {
+            block_meta_read(&payload[offset], &record->block[b]);
+            offset += ARCHIVE_BLOCK_META;
+            memcpy(record->block[b].spectrum, &payload[offset], SPECTRUM_BINS);
+            offset += SPECTRUM_BINS;
+        }
+        return true;
+    }
+
+    if(payload[0] != ARCHIVE_RECORD_DELTA || !have_previous)
+    {
+        return false;
+    }
+
+    do
+    {
+        if(offset >= payload_length || shift > 63)
+        {
+            return false;
+        }
+        timestamp_delta |= (uint64_t)(payload[offset] & 0x7f) << shift;
+        shift += 7;
+    } while(payload[offset++] & 0x80);
+    record->timestamp_ms = previous->timestamp_ms + timestamp_delta;
+
+    for(uint32_t b = 0; b < blocks; b++)
+    {
+        block = &record->block[b];
+
+        if(offset >= payload_length)
+        {
+            return false;
+        }
+        flags = payload[offset++];
+        k = flags >> 4;
+
+        if(flags & 0x01)
+        {
+            if(offset + ARCHIVE_BLOCK_META > payload_length)
+            {
+                return false;
+            }
+            block_meta_read(&payload[offset], block);
+            offset += ARCHIVE_BLOCK_META;
+        }
+        else
+        {
+            memcpy(block, &previous->block[b], offsetof(spectrum_block_t, spectrum));
+        }
+
+        bits.data = &payload[offset];
+        bits.length = payload_length - offset;
+        bits.offset = 0;
+        bits.bits = 0;
+        bits.count = 0;
+        for(int i = 0; i < SPECTRUM_BINS; i++)
+        {
+            quotient = 0;
+            while(true)
+            {
+                if(!bit_read(&bits, 1, &bit))
+                {
+                    return false;
+                }
+                if(bit == 0)
+                {
+                    break;
+                }
+                if(++quotient == ARCHIVE_RICE_ESCAPE)
+                {
+                    break;
+                }
+            }
+
+            if(quotient == ARCHIVE_RICE_ESCAPE)
+            {
+                if(!bit_read(&bits, ARCHIVE_RAW_BITS, &value))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                value = quotient << k;
+                if(k > 0)
+                {
+                    if(!bit_read(&bits, k, &bit))
+                    {
+                        return false;
+                    }
+                    value |= bit;
+                }
+            }
+
+            block->spectrum[i] = (uint8_t)(previous->block[b].spectrum[i] + unzigzag(value));
+        }
+        offset += bits.offset;
+    }
+
+    return offset == payload_length;
+}
+
+static char *archive_index_filename(const char *filename)
+{
+    char *index_filename;
+
+    if(asprintf(&index_filename, "%s.idx", filename) < 0)
+    {
+        return NULL;
+    }
+    return index_filename;
+}
+
+/* Drops a torn final record and any index entries past it. The next record is always a keyframe */
+static int archive_writer_recover(archive_writer_t *writer, int fd, int index_fd, const char *filename)
+{
+    struct stat st, index_st;
+    archive_index_entry_t entry;
+    uint8_t length_bytes[2];
+    off_t offset = sizeof(archive_file_header_t);
+    off_t index_size = 0;
+    uint32_t length;
+
+    if(fstat(fd, &st) != 0 || fstat(index_fd, &index_st) != 0)
+    {
+        return -1;
+    }
+
+    /* Start from the last indexed keyframe that's within the file */
+    index_size = index_st.st_size - (index_st.st_size % sizeof(entry));
+    while(index_size > 0)
+    {
+        if(pread(index_fd, &entry, sizeof(entry), index_size - sizeof(entry)) != sizeof(entry))
+        {
+            return -1;
+        }
+        if(entry.offset < (uint64_t)st.st_size)
+        {
+            offset = entry.offset;
+            break;
+        }
+        index_size -= sizeof(entry);
+    }
+
+    while(offset + 2 <= st.st_size)
+    {
+        if(pread(fd, length_bytes, 2, offset) != 2)
+        {
+            return -1;
+        }
+        length = length_bytes[0] | (length_bytes[1] << 8);
+        if(offset + 2 + length > st.st_size)
+        {
+            break;
+        }
+        offset += 2 + length;
+    }
+
+    if(offset != st.st_size)
+    {
+        fprintf(stderr, "Warning: Dropping partial record at the end of '%s'\n", filename);
+        if(ftruncate(fd, offset) != 0)
+        {
+            return -1;
+        }
+    }
+    if(index_size != index_st.st_size && ftruncate(index_fd, index_size) != 0)
+    {
+        return -1;
+    }
+
+    writer->offset = offset;
+    return 0;
+}
+
+/* Appends to an existing archive of the same layout, or starts a new one */
+int archive_writer_open(archive_writer_t *writer, const char *filename, uint8_t blocks, uint8_t flags, uint16_t keyframe_interval)
+{
+    archive_file_header_t header;
+    char *index_filename;
+    struct stat st;
+    int fd, index_fd;
+
+    memset(writer, 0, sizeof(archive_writer_t));
+
+    if(blocks < 1 || blocks > SPECTRUM_BLOCKS_MAX || keyframe_interval == 0)
+    {
+        return -1;
+    }
+    writer->blocks = blocks;
+    writer->keyframe_interval = keyframe_interval;
+
+    index_filename = archive_index_filename(filename);
+    if(index_filename == NULL)
+    {
+        return -1;
+    }
+
+    fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    index_fd = open(index_filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    free(index_filename);
+    if(fd < 0 || index_fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open archive '%s': %s\n", filename, strerror(errno));
+        goto fail;
+    }
+
+    if(fstat(fd, &st) != 0)
+    {
+        goto fail;
+    }
+
+    if(st.st_size == 0)
+    {
+        memcpy(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+        header.blocks = blocks;
+        header.flags = flags;
+        header.keyframe_interval = keyframe_interval;
+        if(write(fd, &header, sizeof(header)) != sizeof(header) || ftruncate(index_fd, 0) != 0)
+        {
+            fprintf(stderr, "Error: Unable to write archive header '%s'\n", filename);
+            goto fail;
+        }
+        writer->offset = sizeof(header);
+    }
+    else
+    {
+        if(pread(fd, &header, sizeof(header), 0) != sizeof(header)
+            || memcmp(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0 || header.blocks != blocks)
+        {
+            fprintf(stderr, "Error: '%s' exists but is not an archive of %"PRIu8" block(s)\n", filename, blocks);
+            goto fail;
+        }
+
+        if(archive_writer_recover(writer, fd, index_fd, filename) != 0)
+        {
+            goto fail;
+        }
+    }
+
+    writer->fptr = fdopen(fd, "a");
+    if(writer->fptr == NULL)
+    {
+        goto fail;
+    }
+    fd = -1;
+    writer->index_fptr = fdopen(index_fd, "a");
+    if(writer->index_fptr == NULL)
+    {
+        goto fail;
+    }
+    setvbuf(writer->fptr, NULL, _IOFBF, 64 * 1024);
+
+    return 0;
+
+fail:
+    if(writer->fptr != NULL)
+    {
+        fclose(writer->fptr);
+        writer->fptr = NULL;
+    }
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+    if(index_fd >= 0)
+    {
+        close(index_fd);
+    }
+    return -1;
+}
+
+int archive_writer_append(archive_writer_t *writer, const spectrum_record_t *record)
+{
+    archive_index_entry_t entry;
+    uint32_t length;
+    bool keyframe;
+
+    /* Time going backwards can't be delta coded */
+    keyframe = !writer->have_previous || writer->since_keyframe >= writer->keyframe_interval
+        || record->timestamp_ms < writer->previous.timestamp_ms;
+
+    length = archive_encode(writer, record, keyframe);
+
+    if(fwrite(writer->buffer, length, 1, writer->fptr) != 1)
+    {
+        writer->errors++;
+        /* The file now ends mid-record, restart from a keyframe at the next open */
+        return -1;
+    }
+
+    if(keyframe)
+    {
+        entry.timestamp_ms = record->timestamp_ms;
+        entry.offset = writer->offset;
+        if(fwrite(&entry, sizeof(entry), 1, writer->index_fptr) != 1)
+        {
+            writer->errors++;
+        }
+        writer->since_keyframe = 0;
+        writer->keyframes++;
+    }
+
+    writer->offset += length;
+    writer->since_keyframe++;
+    memcpy(&writer->previous, record, sizeof(spectrum_record_t));
+    writer->have_previous = true;
+
+    writer->records++;
+    writer->bytes_in += spectrum_record_size(writer->blocks);
+    writer->bytes_out += length;
+
+    return 0;
+}
+
+/* The archive is written before its index, so an index entry never points past the data */
+int archive_writer_flush(archive_writer_t *writer, bool sync)
+{
+    int result = 0;
+
+    if(writer->fptr == NULL)
+    {
+        return 0;
+    }
+
+    if(fflush(writer->fptr) != 0 || (sync && fsync(fileno(writer->fptr)) != 0))
+    {
+        result = -1;
+    }
+    if(fflush(writer->index_fptr) != 0 || (sync && fsync(fileno(writer->index_fptr)) != 0))
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+void archive_writer_close(archive_writer_t *writer)
+{
+    if(writer->fptr != NULL)
+    {
+        archive_writer_flush(writer, true);
+        fclose(writer->fptr);
+        fclose(writer->index_fptr);
+        writer->fptr = NULL;
+        writer->index_fptr = NULL;
+    }
+}
+
+static const uint8_t *archive_map(const char *filename, size_t *size)
+{
+    struct stat st;
+    const uint8_t *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    *size = st.st_size;
+    return map;
+}
+
+/* The index is optional, without it reading always starts from the beginning */
+int archive_reader_open(archive_reader_t *reader, const char *filename)
+{
+    char *index_filename;
+
+    memset(reader, 0, sizeof(archive_reader_t));
+
+    reader->map = archive_map(filename, &reader->map_size);
+    if(reader->map == NULL)
+    {
+        fprintf(stderr, "Error: Unable to open archive '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    reader->header = (const archive_file_header_t *)reader->map;
+    if(reader->map_size < sizeof(archive_file_header_t) || memcmp(reader->header->magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0
+        || reader->header->blocks < 1 || reader->header->blocks > SPECTRUM_BLOCKS_MAX)
+    {
+        fprintf(stderr, "Error: '%s' is not a jammon spectrum archive\n", filename);
+        archive_reader_close(reader);
+        return -1;
+    }
+
+    index_filename = archive_index_filename(filename);
+    if(index_filename != NULL)
+    {
+        reader->index = (const archive_index_entry_t *)archive_map(index_filename, &reader->index_map_size);
+        if(reader->index != NULL)
+        {
+            reader->index_count = reader->index_map_size / sizeof(archive_index_entry_t);
+        }
+        free(index_filename);
+    }
+
+    reader->offset = sizeof(archive_file_header_t);
+
+    return 0;
+}
+
+/* Positions at the last keyframe at or before timestamp_ms, records before timestamp_ms are then for the caller to skip */
+void archive_reader_seek(archive_reader_t *reader, uint64_t timestamp_ms)
+{
+    size_t low = 0, high = reader->index_count, mid;
+
+    reader->offset = sizeof(archive_file_header_t);
+    reader->have_previous = false;
+
+    /* First entry after timestamp_ms */
+    while(low < high)
+    {
+        mid = low + ((high - low) / 2);
+        if(reader->index[mid].timestamp_ms <= timestamp_ms)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if(low > 0 && reader->index[low - 1].offset < reader->map_size)
+    {
+        reader->offset = reader->index[low - 1].offset;
+    }
+}
+
+/* Returns false at the end, or at the first malformed record */
+bool archive_reader_next(archive_reader_t *reader, spectrum_record_t *record)
+{
+    uint32_t length;
+
+    while(reader->offset + 2 <= reader->map_size)
+    {
+        length = reader->map[reader->offset] | (reader->map[reader->offset + 1] << 8);
+        if(reader->offset + 2 + length > reader->map_size)
+        {
+            return false;
+        }
+
+        if(!archive_decode(&reader->map[reader->offset + 2], length, reader->header->blocks, &reader->previous, reader->have_previous, record))
+        {
+            if(!reader->have_previous && length > 0 && reader->map[reader->offset + 2] == ARCHIVE_RECORD_DELTA)
+            {
+                /* Started mid-chain, skip to the next keyframe */
+                reader->offset += 2 + length;
+                continue;
+            }
+            return false;
+        }
+
+        reader->offset += 2 + length;
+        memcpy(&reader->previous, record, sizeof(spectrum_record_t));
+        reader->have_previous = true;
+        return true;
+    }
+
+    return false;
+}
+
+void archive_reader_close(archive_reader_t *reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->map_size);
+        reader->map = NULL;
+    }
+    if(reader->index != NULL)
+    {
+        munmap((void *)reader->index, reader->index_map_size);
+        reader->index = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+/* Compressed spectrum archive, little-endian:
+ *  archive_file_header_t, then variable-length records, each a u16 length (of what follows) and a type byte.
+ *  Keyframes store the record as-is (timestamp_ms, then per block: span, res, center, pga, 256 bins).
+ *  Delta records store the timestamp as a varint delta, then per block: a byte of flags (bit 0: metadata follows,
+ *  bits 4-7: Rice parameter k), the metadata if changed, then each bin's difference to the previous record,
+ *  zigzag mapped and Rice coded, padded to a byte. Quotients of 16 or more are escaped to a raw 9-bit zigzag value.
+ *  The .idx sidecar lists every keyframe's timestamp and offset, so reading can start at any keyframe. */
+
+#define ARCHIVE_MAGIC           "JMARCv1\n"
+#define ARCHIVE_MAGIC_SIZE      8
+#define ARCHIVE_KEYFRAME_DEFAULT    60
+
+#define ARCHIVE_RECORD_DELTA    0x00
+#define ARCHIVE_RECORD_KEY      0x01
+
+typedef struct
+{
+    char magic[ARCHIVE_MAGIC_SIZE];
+    uint8_t blocks;
+    uint8_t flags; /* As spectrum_file_header_t */
+    uint16_t keyframe_interval;
+} __attribute__((packed)) archive_file_header_t;
+
+typedef struct
+{
+    uint64_t timestamp_ms;
+    uint64_t offset;
+} __attribute__((packed)) archive_index_entry_t;
+
+typedef struct {
+    FILE *fptr;
+    FILE *index_fptr;
+    uint8_t blocks;
+    uint16_t keyframe_interval;
+    uint32_t since_keyframe;
+    uint64_t offset; /* Of the next record */
+    bool have_previous;
+    spectrum_record_t previous;
+    uint8_t buffer[2 + 1 + 8 + (SPECTRUM_BLOCKS_MAX * (1 + 13 + 800))];
+
+    /* Statistics */
+    uint64_t records;
+    uint64_t keyframes;
+    uint64_t bytes_in; /* As spectrum log records */
+    uint64_t bytes_out;
+    uint64_t errors;
+} archive_writer_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    const archive_index_entry_t *index;
+    size_t index_count;
+    size_t index_map_size;
+    const archive_file_header_t *header;
+    size_t offset; /* Of the next record */
+    bool have_previous;
+    spectrum_record_t previous;
+} archive_reader_t;
+
+int archive_writer_open(archive_writer_t *writer, const char *filename, uint8_t blocks, uint8_t flags, uint16_t keyframe_interval);
+int archive_writer_append(archive_writer_t *writer, const spectrum_record_t *record);
+int archive_writer_flush(archive_writer_t *writer, bool sync);
+void archive_writer_close(archive_writer_t *writer);
+
+int archive_reader_open(archive_reader_t *reader, const char *filename);
+void archive_reader_seek(archive_reader_t *reader, uint64_t timestamp_ms);
+bool archive_reader_next(archive_reader_t *reader, spectrum_record_t *record);
+void archive_reader_close(archive_reader_t *reader);
+
+#endif /* __ARCHIVE_H__ */
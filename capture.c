@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "capture.h"
+#include "ubx.h"
+
+static uint64_t realtime_ms(void)
+{
+    struct timespec tp;
+
+    if(clock_gettime(CLOCK_REALTIME, &tp) != 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t) tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+/* Whether a whole record, with a valid UBX frame, starts at offset. Returns its size, or 0 */
+static size_t capture_record_check(const uint8_t *map, size_t map_size, size_t offset)
+{
+    const capture_record_header_t *record;
+    const uint8_t *frame;
+
+    if(offset + sizeof(capture_record_header_t) > map_size)
+    {
+        return 0;
+    }
+
+    record = (const capture_record_header_t *)&map[offset];
+    if(record->length < 8 || record->length > UBX_FRAME_MAX_LENGTH
+        || offset + sizeof(capture_record_header_t) + record->length > map_size)
+    {
+        return 0;
+    }
+
+    frame = &map[offset + sizeof(capture_record_header_t)];
+    if(frame[0] != 0xb5 || frame[1] != 0x62 || (uint32_t)(6+2+(frame[5] << 8 | frame[4])) != record->length
+        || !ubx_verify_checksum(frame, record->length))
+    {
+        return 0;
+    }
+
+    return sizeof(capture_record_header_t) + record->length;
+}
+
+/* The length of the capture up to the end of its last whole record, so that a record torn by a crash can be cut off
+ *  before appending, rather than hiding everything appended after it from the reader */
+static int capture_recover(int fd, const char *filename, off_t file_size, off_t *size)
+{
+    const uint8_t *map;
+    size_t offset = sizeof(capture_file_header_t);
+    size_t length;
+
+    map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    if(memcmp(map, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: '%s' exists but is not a jammon capture file\n", filename);
+        munmap((void *)map, file_size);
+        return -1;
+    }
+
+    while((length = capture_record_check(map, file_size, offset)) > 0)
+    {
+        offset += length;
+    }
+    munmap((void *)map, file_size);
+
+    *size = offset;
+    return 0;
+}
+
+/* Appends to an existing capture, or starts a new one */
+int capture_open(capture_t *capture, const char *filename)
+{
+    struct stat st;
+    capture_file_header_t file_header;
+    off_t size;
+
+    memset(capture, 0, sizeof(capture_t));
+
+    capture->fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(capture->fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open capture file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(capture->fd, &st) != 0)
+    {
+        goto fail;
+    }
+
+    if(st.st_size > 0 && st.st_size < (off_t)sizeof(capture_file_header_t))
+    {
+        fprintf(stderr, "Error: '%s' exists but is not a jammon capture file\n", filename);
+        goto fail;
+    }
+
+    if(st.st_size > 0)
+    {
+        if(capture_recover(capture->fd, filename, st.st_size, &size) != 0)
+        {
+            goto fail;
+        }
+
+        if(size != st.st_size)
+        {
+            fprintf(stderr, "Warning: Dropping %jd bytes of torn records at the end of '%s'\n", (intmax_t)(st.st_size - size), filename);
+            if(ftruncate(capture->fd, size) != 0)
+            {
+                fprintf(stderr, "Error: Unable to truncate capture file '%s': %s\n", filename, strerror(errno));
+                goto fail;
+            }
+        }
+    }
+    else
+    {
+        memcpy(file_header.magic, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+        if(write(capture->fd, &file_header, sizeof(file_header)) != sizeof(file_header))
+        {
+            fprintf(stderr, "Error: Unable to write capture file header '%s'\n", filename);
+            goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    close(capture->fd);
+    capture->fd = -1;
+    return -1;
+}
+
+void capture_write(capture_t *capture, const uint8_t *frame, uint32_t length, uint64_t monotonic_ms)
+{
+    capture_record_header_t record;
+    struct iovec iov[2];
+    ssize_t r;
+
+    record.realtime_ms = realtime_ms();
+    record.monotonic_ms = monotonic_ms;
+    record.length = length;
+
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+    iov[1].iov_base = (void *)frame;
+    iov[1].iov_len = length;
+
+    /* Single append so that the record is never interleaved */
+    r = writev(capture->fd, iov, 2);
+    if(r != (ssize_t)(sizeof(record) + length))
+    {
+        capture->errors++;
+        return;
+    }
+
+    capture->frames++;
+    capture->bytes += r;
+}
+
+void capture_close(capture_t *capture)
+{
+    if(capture->fd >= 0)
+    {
+        close(capture->fd);
+        capture->fd = -1;
+    }
+}
+
+int capture_reader_open(capture_reader_t *reader, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(reader, 0, sizeof(capture_reader_t));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open capture file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(capture_file_header_t))
+    {
+        fprintf(stderr, "Error: Capture file '%s' is too short\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(reader->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Unable to map capture file '%s': %s\n", filename, strerror(errno));
+        reader->map = NULL;
+        return -1;
+    }
+    reader->map_size = st.st_size;
+
+    if(memcmp(reader->map, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a jammon capture file\n", filename);
+        capture_reader_close(reader);
+        return -1;
+    }
+
+    /* Sequential single pass */
+    madvise((void *)reader->map, reader->map_size, MADV_SEQUENTIAL);
+
+    reader->offset = sizeof(capture_file_header_t);
+
+    return 0;
+}
+
+/* Returns the next frame in-place in the mapping, or NULL at the end (or a truncated final record) */
+const uint8_t *capture_reader_next(capture_reader_t *reader, const capture_record_header_t **record_ptr)
+{
+    const capture_record_header_t *record;
+    const uint8_t *frame;
+
+    if(reader->offset + sizeof(capture_record_header_t) > reader->map_size)
+    {
+        return NULL;
+    }
+
+    record = (const capture_record_header_t *)&reader->map[reader->offset];
+    if(record->length < 8 || record->length > UBX_FRAME_MAX_LENGTH
+        || reader->offset + sizeof(capture_record_header_t) + record->length > reader->map_size)
+    {
+        return NULL;
+    }
+
+    frame = &reader->map[reader->offset + sizeof(capture_record_header_t)];
+    reader->offset += sizeof(capture_record_header_t) + record->length;
+
+    *record_ptr = record;
+    return frame;
+}
+
+void capture_reader_close(capture_reader_t *reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->map_size);
+        reader->map = NULL;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+/* Capture file layout:
+ *  capture_file_header_t, then per frame: capture_record_header_t followed by the complete UBX frame (sync to checksum) */
+
+#define CAPTURE_MAGIC       "JMCAPv1\n"
+#define CAPTURE_MAGIC_SIZE  8
+
+typedef struct
+{
+    char magic[CAPTURE_MAGIC_SIZE];
+} __attribute__((packed)) capture_file_header_t;
+
+typedef struct
+{
+    uint64_t realtime_ms; /* Host wall-clock at receipt */
+    uint64_t monotonic_ms; /* Host monotonic clock at receipt, drives replay timing */
+    uint32_t length; /* UBX frame length */
+} __attribute__((packed)) capture_record_header_t;
+
+typedef struct {
+    int fd;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t errors;
+} capture_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    size_t offset;
+} capture_reader_t;
+
+int capture_open(capture_t *capture, const char *filename);
+void capture_write(capture_t *capture, const uint8_t *frame, uint32_t length, uint64_t monotonic_ms);
+void capture_close(capture_t *capture);
+
+int capture_reader_open(capture_reader_t *reader, const char *filename);
+const uint8_t *capture_reader_next(capture_reader_t *reader, const capture_record_header_t **record_ptr);
+void capture_reader_close(capture_reader_t *reader);
+
+#endif /* __CAPTURE_H__ */
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+
+#include "main.h"
+#include "ubx.h"
+#include "event.h"
+#include "configure.h"
+
+#define CONFIGURE_TICK_MS           50
+#define CONFIGURE_QUERY_TIMEOUT_MS  500
+#define CONFIGURE_ACK_TIMEOUT_MS    1000
+#define CONFIGURE_ATTEMPTS          3
+
+/* configure_t phase */
+#define PHASE_IDLE      0
+#define PHASE_QUERY     1 /* CFG-VALGET outstanding */
+#define PHASE_SEND      2 /* Items written, collecting ACKs */
+
+/* configure_item_state_t status */
+#define ITEM_PENDING    0
+#define ITEM_SENT       1
+#define ITEM_ACKED      2
+#define ITEM_SKIPPED    3
+
+static void configure_finish(configure_t *configure, bool success)
+{
+    if(configure->timer_fd >= 0)
+    {
+        event_remove_timer(configure->loop, configure->timer_fd);
+        configure->timer_fd = -1;
+    }
+
+    configure->phase = PHASE_IDLE;
+    configure->duration_ms = monotonic_ms() - configure->start_monotonic_ms;
+
+    configure->done(configure->done_arg, success);
+}
+
+static void configure_write_item(configure_t *configure, uint32_t index)
+{
+    const configure_item_t *item = &configure->items[index];
+    configure_item_state_t *state = &configure->item_states[index];
+
+    /* A failed write is left for the ACK timeout to retry */
+    if(write(configure->fd, item->frame, item->frame_length) != (int)item->frame_length)
+    {
+        fprintf(stderr, "[%s] Error: Writing %s: %s\n", configure->label, item->name, strerror(errno));
+    }
+
+    state->status = ITEM_SENT;
+    state->attempts++;
+    state->in_flight++;
+    state->sent_monotonic_ms = monotonic_ms();
+}
+
+/* Write every item not already applied, without waiting between them */
+static void configure_send_items(configure_t *configure)
+{
+    configure->phase = PHASE_SEND;
+    configure->outstanding = 0;
+
+    for(uint32_t i = 0; i < configure->items_count; i++)
+    {
+        if(configure->item_states[i].status == ITEM_SKIPPED)
+        {
+            if(configure->verbose) printf(" - %s: already set\n", configure->items[i].name);
+            configure->skipped++;
+            continue;
+        }
+
+        configure_write_item(configure, i);
+        configure->sent++;
+        configure->outstanding++;
+    }
+
+    if(configure->outstanding == 0)
+    {
+        configure_finish(configure, true);
+    }
+}
+
+static void configure_timer_handler(void *arg, uint32_t events)
+{
+    configure_t *configure = (configure_t *)arg;
+    configure_item_state_t *state;
+    uint64_t now_ms = monotonic_ms();
+    (void)events;
+
+    if(configure->phase == PHASE_QUERY)
+    {
+        if(configure->start_monotonic_ms + CONFIGURE_QUERY_TIMEOUT_MS < now_ms)
+        {
+            /* Probably pre-dates CFG-VALGET */
+            if(configure->verbose) printf(" - No response to CFG-VALGET, sending all\n");
+            configure_send_items(configure);
+        }
+        return;
+    }
+
+    if(configure->phase != PHASE_SEND)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < configure->items_count; i++)
+    {
+        state = &configure->item_states[i];
+        if(state->status != ITEM_SENT || state->sent_monotonic_ms + CONFIGURE_ACK_TIMEOUT_MS > now_ms)
+        {
+            continue;
+        }
+
+        if(state->attempts >= CONFIGURE_ATTEMPTS)
+        {
+            fprintf(stderr, "[%s] Error: No ACK for %s after %"PRIu8" attempts\n", configure->label, configure->items[i].name, state->attempts);
+            configure_finish(configure, false);
+            return;
+        }
+
+        if(configure->verbose) printf(" - %s: timed out, retrying\n", configure->items[i].name);
+        configure_write_item(configure, i);
+        configure->retries++;
+    }
+}
+
+/* ACKs only carry the class and id, so are matched to the oldest outstanding item of that type. After a timeout retry
+ *  the receiver may answer both the original and the resent frame, so an ACK is first taken as the duplicate answer to
+ *  an item already ACKed with copies still in flight. Otherwise it could be credited to the next item of a repeated
+ *  type (eg. CFG-MSG) that never arrived. At worst a misattributed duplicate leaves that item to be retried. */
+static void configure_ack(configure_t *configure, const uint8_t *payload, bool ack)
+{
+    const configure_item_t *item;
+    configure_item_state_t *state;
+
+    if(configure->phase == PHASE_QUERY)
+    {
+        if(!ack && payload[0] == 0x06 && payload[1] == 0x8b)
+        {
+            /* Receiver without the configuration interface, or a key it doesn't know */
+            if(configure->verbose) printf(" - CFG-VALGET NAKed, sending all\n");
+            configure_send_items(configure);
+        }
+        return;
+    }
+
+    if(configure->phase != PHASE_SEND)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < configure->items_count && ack; i++)
+    {
+        item = &configure->items[i];
+        state = &configure->item_states[i];
+        if(state->status == ITEM_ACKED && state->in_flight > 0 && item->frame[2] == payload[0] && item->frame[3] == payload[1])
+        {
+            if(configure->verbose) printf(" - %s: duplicate ACK\n", item->name);
+            state->in_flight--;
+            return;
+        }
+    }
+
+    for(uint32_t i = 0; i < configure->items_count; i++)
+    {
+        item = &configure->items[i];
+        state = &configure->item_states[i];
+        if(state->status != ITEM_SENT || item->frame[2] != payload[0] || item->frame[3] != payload[1])
+        {
+            continue;
+        }
+
+        if(!ack)
+        {
+            fprintf(stderr, "[%s] Error: %s NAKed\n", configure->label, item->name);
+            configure_finish(configure, false);
+            return;
+        }
+
+        if(configure->verbose) printf(" - %s: ACK after %"PRIu64" ms\n", item->name, monotonic_ms() - state->sent_monotonic_ms);
+
+        state->status = ITEM_ACKED;
+        state->in_flight--;
+        configure->outstanding--;
+        if(configure->outstanding == 0)
+        {
+            configure_finish(configure, true);
+        }
+        return;
+    }
+}
+
+static void handle_ack_ack(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    (void)payload_length;
+    (void)received_monotonic_ms;
+    configure_ack((configure_t *)arg, payload, true);
+}
+
+static void handle_ack_nak(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    (void)payload_length;
+    (void)received_monotonic_ms;
+    configure_ack((configure_t *)arg, payload, false);
+}
+
+/* Value size is encoded in bits 28-30 of the key id */
+static uint32_t configure_key_size(uint32_t key)
+{
+    switch((key >> 28) & 0x07)
+    {
+        case 0x01: return 1; /* Single bit, stored in a byte */
+        case 0x02: return 1;
+        case 0x03: return 2;
+        case 0x04: return 4;
+        case 0x05: return 8;
+        default: return 0;
+    }
+}
+
+static bool configure_item_applied(const configure_item_t *item, const uint8_t *values, uint16_t values_length)
+{
+    uint32_t key, size, offset;
+    uint64_t value;
+    bool found;
+
+    if(item->keys == NULL || item->keys_count == 0)
+    {
+        return false;
+    }
+
+    for(uint32_t k = 0; k < item->keys_count; k++)
+    {
+        found = false;
+
+        for(offset = 0; offset + 4 <= values_length; offset += 4 + size)
+        {
+            memcpy(&key, &values[offset], sizeof(key));
+            size = configure_key_size(key);
+            if(size == 0 || offset + 4 + size > values_length)
+            {
+                return false;
+            }
+
+            if(key == item->keys[k].key)
+            {
+                value = 0;
+                memcpy(&value, &values[offset+4], size);
+                found = (value == item->keys[k].value);
+                break;
+            }
+        }
+
+        if(!found)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* UBX-CFG-VALGET response: version, layer, position, then key/value pairs */
+static void handle_cfg_valget(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    configure_t *configure = (configure_t *)arg;
+    (void)received_monotonic_ms;
+
+    if(configure->phase != PHASE_QUERY)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < configure->items_count; i++)
+    {
+        if(configure_item_applied(&configure->items[i], &payload[4], payload_length - 4))
+        {
+            configure->item_states[i].status = ITEM_SKIPPED;
+        }
+    }
+
+    configure_send_items(configure);
+}
+
+void configure_init(configure_t *configure, const char *label, ubx_dispatcher_t *dispatcher)
+{
+    memset(configure, 0, sizeof(configure_t));
+    configure->label = label;
+    configure->fd = -1;
+    configure->timer_fd = -1;
+
+    ubx_dispatch_register(dispatcher, 0x05, 0x01, "ACK-ACK", 2, UBX_NO_VERSION, 0, handle_ack_ack, configure);
+    ubx_dispatch_register(dispatcher, 0x05, 0x00, "ACK-NAK", 2, UBX_NO_VERSION, 0, handle_ack_nak, configure);
+    ubx_dispatch_register(dispatcher, 0x06, 0x8b, "CFG-VALGET", 4, 0, 0x01, handle_cfg_valget, configure);
+}
+
+/* Queries current values, then applies the items. The serial fd must already be serviced by the event loop,
+ *  with its frames fed to the dispatcher given to configure_init(). done() is called on completion or failure. */
+int configure_start(configure_t *configure, event_loop_t *loop, int fd,
+    const configure_item_t *items, uint32_t items_count, configure_done_t done, void *done_arg)
+{
+    uint8_t valget_payload[4 + (4 * CONFIGURE_MAX_KEYS)];
+    uint8_t valget_frame[6 + sizeof(valget_payload) + 2];
+    uint32_t valget_keys = 0;
+    uint32_t valget_length;
+
+    if(items_count > CONFIGURE_MAX_ITEMS)
+    {
+        fprintf(stderr, "[%s] Error: Too many configuration items (%"PRIu32"/%d)\n", configure->label, items_count, CONFIGURE_MAX_ITEMS);
+        return -1;
+    }
+
+    configure_cancel(configure);
+
+    configure->loop = loop;
+    configure->fd = fd;
+    configure->items = items;
+    configure->items_count = items_count;
+    configure->done = done;
+    configure->done_arg = done_arg;
+    memset(configure->item_states, 0, sizeof(configure->item_states));
+    configure->sent = 0;
+    configure->skipped = 0;
+    configure->retries = 0;
+    configure->start_monotonic_ms = monotonic_ms();
+
+    configure->timer_fd = event_add_timer(loop, CONFIGURE_TICK_MS, CONFIGURE_TICK_MS, configure_timer_handler, configure);
+    if(configure->timer_fd < 0)
+    {
+        return -1;
+    }
+
+    /* Version 0, RAM layer, position 0, then every key the items can be checked against */
+    memset(valget_payload, 0, 4);
+    for(uint32_t i = 0; i < items_count; i++)
+    {
+        for(uint32_t k = 0; k < items[i].keys_count && valget_keys < CONFIGURE_MAX_KEYS; k++)
+        {
+            memcpy(&valget_payload[4 + (4 * valget_keys)], &items[i].keys[k].key, 4);
+            valget_keys++;
+        }
+    }
+
+    if(valget_keys == 0)
+    {
+        configure_send_items(configure);
+        return 0;
+    }
+
+    valget_length = ubx_frame_build(valget_frame, sizeof(valget_frame), 0x06, 0x8b, valget_payload, 4 + (4 * valget_keys));
+
+    configure->phase = PHASE_QUERY;
+    if(write(fd, valget_frame, valget_length) != (int)valget_length)
+    {
+        configure_send_items(configure);
+    }
+
+    return 0;
+}
+
+/* Abandon any run in progress without calling done(), eg. on disconnection */
+void configure_cancel(configure_t *configure)
+{
+    if(configure->timer_fd >= 0)
+    {
+        event_remove_timer(configure->loop, configure->timer_fd);
+        configure->timer_fd = -1;
+    }
+
+    configure->phase = PHASE_IDLE;
+}
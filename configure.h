@@ -0,0 +1,63 @@
+#ifndef __CONFIGURE_H__
+#define __CONFIGURE_H__
+
+/* Receiver configuration, run from the receiver's event loop.
+ *  The current values are first queried with UBX-CFG-VALGET so that items already applied can be skipped,
+ *  then every remaining message is written back to back and the ACK/NAKs are matched as they arrive. */
+
+#define CONFIGURE_MAX_ITEMS     16
+#define CONFIGURE_MAX_KEYS      32
+
+typedef struct {
+    uint32_t key; /* CFG-VALGET key id */
+    uint64_t value;
+} configure_key_t;
+
+typedef struct {
+    const char *name;
+    const uint8_t *frame; /* Complete UBX frame */
+    uint32_t frame_length;
+    const configure_key_t *keys; /* Values that together show the item is already applied, NULL to always send */
+    uint32_t keys_count;
+} configure_item_t;
+
+typedef struct {
+    uint8_t status;
+    uint8_t attempts;
+    uint8_t in_flight; /* Copies written but not yet answered */
+    uint64_t sent_monotonic_ms;
+} configure_item_state_t;
+
+/* Called once per configure_start(), from the event loop */
+typedef void (*configure_done_t)(void *arg, bool success);
+
+typedef struct {
+    const char *label; /* Prefix for log messages */
+    bool verbose; /* Set by the owner before configure_start() */
+
+    event_loop_t *loop;
+    int fd;
+    int timer_fd;
+    configure_done_t done;
+    void *done_arg;
+
+    const configure_item_t *items;
+    uint32_t items_count;
+    configure_item_state_t item_states[CONFIGURE_MAX_ITEMS];
+    uint8_t phase;
+    uint32_t outstanding;
+    uint64_t start_monotonic_ms;
+
+    /* Statistics, for the most recent run */
+    uint32_t sent;
+    uint32_t skipped;
+    uint32_t retries;
+    uint64_t duration_ms;
+} configure_t;
+
+void configure_init(configure_t *configure, const char *label, ubx_dispatcher_t *dispatcher);
+int configure_start(configure_t *configure, event_loop_t *loop, int fd,
+    const configure_item_t *items, uint32_t items_count, configure_done_t done, void *done_arg);
+void configure_cancel(configure_t *configure);
+
+#endif /* __CONFIGURE_H__ */
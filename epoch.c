@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "event.h"
+#include "epoch.h"
+
+void epoch_init(epoch_t *epoch, uint32_t deadline_ms, epoch_emit_t emit, void *arg)
+{
+    memset(epoch, 0, sizeof(epoch_t));
+    epoch->deadline_ms = deadline_ms;
+    epoch->timer_fd = -1;
+    epoch->emit = emit;
+    epoch->arg = arg;
+}
+
+static void epoch_close(epoch_t *epoch, uint64_t now_monotonic_ms)
+{
+    uint64_t latency_ms;
+
+    epoch->open = false;
+    if(epoch->timer_fd >= 0)
+    {
+        event_set_timer(epoch->timer_fd, 0, 0);
+    }
+
+    if(epoch->members == EPOCH_ALL)
+    {
+        epoch->complete++;
+    }
+    else if((epoch->members & EPOCH_MINIMUM) == EPOCH_MINIMUM)
+    {
+        epoch->partial++;
+    }
+    else
+    {
+        epoch->dropped++;
+        return;
+    }
+
+    latency_ms = now_monotonic_ms - epoch->opened_monotonic_ms;
+    epoch->latency_total_ms += latency_ms;
+    if(latency_ms > epoch->latency_max_ms)
+    {
+        epoch->latency_max_ms = latency_ms;
+    }
+
+    epoch->emit(epoch->arg, epoch->itow, epoch->members);
+}
+
+/* Call on a NAV message, before its fields are applied to the datapoint, so that a superseded epoch is emitted intact */
+void epoch_nav(epoch_t *epoch, uint32_t itow, uint64_t received_monotonic_ms)
+{
+    if(epoch->open && epoch->itow == itow)
+    {
+        return;
+    }
+
+    if(epoch->open)
+    {
+        /* Next epoch started before this one completed */
+        epoch_close(epoch, received_monotonic_ms);
+    }
+
+    epoch->open = true;
+    epoch->itow = itow;
+    epoch->members = epoch->staged;
+    epoch->staged = 0;
+    epoch->opened_monotonic_ms = received_monotonic_ms;
+
+    if(epoch->timer_fd >= 0)
+    {
+        event_set_timer(epoch->timer_fd, epoch->deadline_ms, 0);
+    }
+}
+
+/* Call on a MON message, before its fields are applied to the datapoint. MON messages carry no time, so one that the
+ *  open epoch already has belongs to the next epoch, and the open one is emitted intact first */
+void epoch_mon(epoch_t *epoch, uint8_t member, uint64_t received_monotonic_ms)
+{
+    if(epoch->open && (epoch->members & member))
+    {
+        epoch_close(epoch, received_monotonic_ms);
+    }
+}
+
+/* Call once a message's fields have been applied to the datapoint */
+void epoch_add(epoch_t *epoch, uint8_t member, uint64_t received_monotonic_ms)
+{
+    if(!epoch->open)
+    {
+        epoch->staged |= member;
+        return;
+    }
+
+    epoch->members |= member;
+    if(epoch->members == EPOCH_ALL)
+    {
+        epoch_close(epoch, received_monotonic_ms);
+    }
+}
+
+void epoch_check_deadline(epoch_t *epoch, uint64_t now_monotonic_ms)
+{
+    if(epoch->open && epoch->opened_monotonic_ms + epoch->deadline_ms <= now_monotonic_ms)
+    {
+        /* Without a timer this is only noticed on the next frame, account it at the deadline itself */
+        epoch_close(epoch, epoch->opened_monotonic_ms + epoch->deadline_ms);
+    }
+}
+
+/* Discard any partial epoch, eg. on disconnection */
+void epoch_reset(epoch_t *epoch)
+{
+    epoch->open = false;
+    epoch->members = 0;
+    epoch->staged = 0;
+    if(epoch->timer_fd >= 0)
+    {
+        event_set_timer(epoch->timer_fd, 0, 0);
+    }
+}
+
+void epoch_print_stats(epoch_t *epoch, FILE *stream)
+{
+    uint64_t emitted = epoch->complete + epoch->partial;
+
+    fprintf(stream, "Epochs: %"PRIu64" complete, %"PRIu64" partial, %"PRIu64" dropped, assembly latency mean %.1f ms, max %"PRIu64" ms\n",
+        epoch->complete,
+        epoch->partial,
+        epoch->dropped,
+        emitted > 0 ? (double)epoch->latency_total_ms / emitted : 0.0,
+        epoch->latency_max_ms
+    );
+}
@@ -0,0 +1,51 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+/* Datapoint assembly per navigation epoch.
+ *  NAV messages carry the epoch's iTOW and open (or supersede) an epoch, MON messages carry no time so are attached
+ *  to the open epoch, or staged for the next one if none is open. A MON message the open epoch already has closes it
+ *  first, so that it's emitted before the fields are overwritten. An epoch is emitted as soon as all members are in,
+ *  or with what it has once the deadline passes or the next epoch starts, provided the minimum members are present. */
+
+#define EPOCH_NAV_PVT   0x01
+#define EPOCH_NAV_SAT   0x02
+#define EPOCH_NAV_SIG   0x04
+#define EPOCH_MON_RF    0x08
+#define EPOCH_MON_SPAN  0x10
+
+#define EPOCH_ALL       (EPOCH_NAV_PVT | EPOCH_NAV_SAT | EPOCH_NAV_SIG | EPOCH_MON_RF | EPOCH_MON_SPAN)
+#define EPOCH_MINIMUM   (EPOCH_NAV_PVT | EPOCH_MON_RF) /* Position, time and jamming indicators */
+
+#define EPOCH_DEADLINE_DEFAULT_MS   500
+
+typedef void (*epoch_emit_t)(void *arg, uint32_t itow, uint8_t members);
+
+typedef struct {
+    uint32_t deadline_ms;
+    int timer_fd; /* Armed for the open epoch's deadline if >= 0, otherwise only checked as frames arrive (eg. replay) */
+    epoch_emit_t emit;
+    void *arg;
+
+    bool open;
+    uint32_t itow;
+    uint8_t members;
+    uint8_t staged; /* MON members received while no epoch was open */
+    uint64_t opened_monotonic_ms;
+
+    /* Statistics */
+    uint64_t complete;
+    uint64_t partial; /* Emitted without all members */
+    uint64_t dropped; /* Missing minimum members */
+    uint64_t latency_total_ms; /* First member to emission */
+    uint64_t latency_max_ms;
+} epoch_t;
+
+void epoch_init(epoch_t *epoch, uint32_t deadline_ms, epoch_emit_t emit, void *arg);
+void epoch_nav(epoch_t *epoch, uint32_t itow, uint64_t received_monotonic_ms);
+void epoch_mon(epoch_t *epoch, uint8_t member, uint64_t received_monotonic_ms);
+void epoch_add(epoch_t *epoch, uint8_t member, uint64_t received_monotonic_ms);
+void epoch_check_deadline(epoch_t *epoch, uint64_t now_monotonic_ms);
+void epoch_reset(epoch_t *epoch);
+void epoch_print_stats(epoch_t *epoch, FILE *stream);
+
+#endif /* __EPOCH_H__ */
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "event.h"
+
+#define EVENT_BATCH     16
+
+static event_source_t *event_source_find(event_loop_t *loop, int fd)
+{
+    for(int i = 0; i < EVENT_MAX_SOURCES; i++)
+    {
+        if(loop->sources[i].fd == fd)
+        {
+            return &loop->sources[i];
+        }
+    }
+    return NULL;
+}
+
+static void event_stop_handler(void *arg, uint32_t events)
+{
+    event_loop_t *loop = (event_loop_t *)arg;
+    uint64_t value;
+    (void)events;
+
+    if(read(loop->stop_fd, &value, sizeof(value)) < 0)
+    {
+        /* Nothing to drain */
+    }
+    loop->stop = true;
+}
+
+int event_loop_init(event_loop_t *loop)
+{
+    memset(loop, 0, sizeof(event_loop_t));
+    for(int i = 0; i < EVENT_MAX_SOURCES; i++)
+    {
+        loop->sources[i].fd = -1;
+    }
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epoll_fd < 0)
+    {
+        fprintf(stderr, "Error: epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(loop->stop_fd < 0)
+    {
+        fprintf(stderr, "Error: eventfd: %s\n", strerror(errno));
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    if(event_add_fd(loop, loop->stop_fd, EPOLLIN, event_stop_handler, loop) != 0)
+    {
+        close(loop->stop_fd);
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Dispatch events until event_loop_break() or event_loop_stop() is called */
+void event_loop_run(event_loop_t *loop)
+{
+    struct epoll_event events[EVENT_BATCH];
+    event_source_t *source;
+    uint64_t expirations;
+    int n;
+
+    loop->brk = false;
+    while(!loop->stop && !loop->brk)
+    {
+        n = epoll_wait(loop->epoll_fd, events, EVENT_BATCH, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "Error: epoll_wait: %s\n", strerror(errno));
+            return;
+        }
+
+        for(int i = 0; i < n && !loop->stop && !loop->brk; i++)
+        {
+            source = (event_source_t *)events[i].data.ptr;
+            if(source->fd < 0)
+            {
+                /* Removed by an earlier callback in this batch */
+                continue;
+            }
+
+            if(source->is_timer)
+            {
+                if(read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                {
+                    continue;
+                }
+            }
+
+            source->callback(source->arg, events[i].events);
+        }
+    }
+}
+
+/* Return from event_loop_run(), which may be called again. Only from callbacks on the loop's own thread. */
+void event_loop_break(event_loop_t *loop)
+{
+    loop->brk = true;
+}
+
+/* Permanently stop the loop. Async-signal-safe and thread-safe */
+void event_loop_stop(event_loop_t *loop)
+{
+    uint64_t value = 1;
+
+    if(write(loop->stop_fd, &value, sizeof(value)) < 0)
+    {
+        /* Counter saturated, loop is already stopping */
+    }
+}
+
+void event_loop_close(event_loop_t *loop)
+{
+    for(int i = 0; i < EVENT_MAX_SOURCES; i++)
+    {
+        if(loop->sources[i].is_timer)
+        {
+            close(loop->sources[i].fd);
+        }
+        loop->sources[i].fd = -1;
+    }
+
+    close(loop->stop_fd);
+    close(loop->epoll_fd);
+}
+
+int event_add_fd(event_loop_t *loop, int fd, uint32_t events, event_callback_t callback, void *arg)
+{
+    struct epoll_event ev;
+    event_source_t *source;
+
+    source = event_source_find(loop, -1);
+    if(source == NULL)
+    {
+        fprintf(stderr, "Error: Event loop full (%d sources)\n", EVENT_MAX_SOURCES);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = source;
+
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        fprintf(stderr, "Error: epoll_ctl add: %s\n", strerror(errno));
+        return -1;
+    }
+
+    source->fd = fd;
+    source->is_timer = false;
+    source->callback = callback;
+    source->arg = arg;
+
+    return 0;
+}
+
+int event_modify_fd(event_loop_t *loop, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    event_source_t *source;
+
+    source = event_source_find(loop, fd);
+    if(source == NULL)
+    {
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = source;
+
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/* Does not close the fd */
+void event_remove_fd(event_loop_t *loop, int fd)
+{
+    event_source_t *source;
+
+    source = event_source_find(loop, fd);
+    if(source == NULL)
+    {
+        return;
+    }
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    source->fd = -1;
+    source->is_timer = false;
+}
+
+/* Returns timer fd, or -1 on error. interval_ms of 0 gives a one-shot timer, initial_ms of 0 leaves it disarmed. */
+int event_add_timer(event_loop_t *loop, uint32_t initial_ms, uint32_t interval_ms, event_callback_t callback, void *arg)
+{
+    int timer_fd;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timer_fd < 0)
+    {
+        fprintf(stderr, "Error: timerfd_create: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(event_add_fd(loop, timer_fd, EPOLLIN, callback, arg) != 0)
+    {
+        close(timer_fd);
+        return -1;
+    }
+    event_source_find(loop, timer_fd)->is_timer = true;
+
+    if(event_set_timer(timer_fd, initial_ms, interval_ms) != 0)
+    {
+        event_remove_timer(loop, timer_fd);
+        return -1;
+    }
+
+    return timer_fd;
+}
+
+int event_set_timer(int timer_fd, uint32_t initial_ms, uint32_t interval_ms)
+{
+    struct itimerspec its;
+
+    its.it_value.tv_sec = initial_ms / 1000;
+    its.it_value.tv_nsec = (initial_ms % 1000) * 1000 * 1000;
+    its.it_interval.tv_sec = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000 * 1000;
+
+    return timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+void event_remove_timer(event_loop_t *loop, int timer_fd)
+{
+    event_remove_fd(loop, timer_fd);
+    close(timer_fd);
+}
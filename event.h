@@ -0,0 +1,37 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#define EVENT_MAX_SOURCES   32
+
+typedef void (*event_callback_t)(void *arg, uint32_t events);
+
+typedef struct {
+    int fd;
+    bool is_timer;
+    event_callback_t callback;
+    void *arg;
+} event_source_t;
+
+typedef struct {
+    int epoll_fd;
+    int stop_fd;
+    bool stop;
+    bool brk;
+    event_source_t sources[EVENT_MAX_SOURCES];
+} event_loop_t;
+
+int event_loop_init(event_loop_t *loop);
+void event_loop_run(event_loop_t *loop);
+void event_loop_break(event_loop_t *loop);
+void event_loop_stop(event_loop_t *loop);
+void event_loop_close(event_loop_t *loop);
+
+int event_add_fd(event_loop_t *loop, int fd, uint32_t events, event_callback_t callback, void *arg);
+int event_modify_fd(event_loop_t *loop, int fd, uint32_t events);
+void event_remove_fd(event_loop_t *loop, int fd);
+
+int event_add_timer(event_loop_t *loop, uint32_t initial_ms, uint32_t interval_ms, event_callback_t callback, void *arg);
+int event_set_timer(int timer_fd, uint32_t initial_ms, uint32_t interval_ms);
+void event_remove_timer(event_loop_t *loop, int timer_fd);
+
+#endif /* __EVENT_H__ */
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+/* CRC-32 (IEEE 802.3, as zlib), a nibble at a time to keep the table small */
+static const uint32_t crc32_nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t journal_crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0f];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+static uint64_t journal_monotonic_us(void)
+{
+    struct timespec tp;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &tp) != 0)
+    {
+        return 0;
+    }
+
+    return (uint64_t) tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
+/* Returns the payload length of an intact record at offset, or -1 */
+static int64_t journal_record_check(const uint8_t *map, size_t map_size, size_t offset)
+{
+    uint32_t length, crc;
+
+    if(offset + JOURNAL_RECORD_HEADER > map_size)
+    {
+        return -1;
+    }
+
+    memcpy(&length, &map[offset], 4);
+    memcpy(&crc, &map[offset + 4], 4);
+    if(length > JOURNAL_BUFFER_SIZE - JOURNAL_RECORD_HEADER || offset + JOURNAL_RECORD_HEADER + length > map_size)
+    {
+        return -1;
+    }
+
+    if(journal_crc32(journal_crc32(0, &map[offset], 4), &map[offset + JOURNAL_RECORD_HEADER], length) != crc)
+    {
+        return -1;
+    }
+
+    return length;
+}
+
+/* Size of the file up to the end of its last intact record */
+static int journal_recover(int fd, const char *filename, uint64_t *size)
+{
+    struct stat st;
+    const uint8_t *map;
+    size_t offset = JOURNAL_MAGIC_SIZE;
+    int64_t length;
+
+    if(fstat(fd, &st) != 0)
+    {
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    if(memcmp(map, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: '%s' exists but is not a jammon journal\n", filename);
+        munmap((void *)map, st.st_size);
+        return -1;
+    }
+
+    while((length = journal_record_check(map, st.st_size, offset)) >= 0)
+    {
+        offset += JOURNAL_RECORD_HEADER + length;
+    }
+    munmap((void *)map, st.st_size);
+
+    *size = offset;
+    return 0;
+}
+
+int journal_open(journal_t *journal, const char *filename)
+{
+    struct stat st;
+
+    journal->size = 0;
+    journal->synced_size = 0;
+    journal->buffer = journal->buffers[0];
+    journal->used = 0;
+    journal->async = false;
+    journal->in_flight = false;
+    memset(&journal->stats, 0, sizeof(journal_stats_t));
+
+    journal->fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(journal->fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open journal '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(journal->fd, &st) != 0)
+    {
+        goto fail;
+    }
+
+    if(st.st_size < JOURNAL_MAGIC_SIZE)
+    {
+        /* New, or torn before the magic was complete */
+        if(ftruncate(journal->fd, 0) != 0 || write(journal->fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != JOURNAL_MAGIC_SIZE
+            || fdatasync(journal->fd) != 0)
+        {
+            fprintf(stderr, "Error: Unable to write journal header '%s'\n", filename);
+            goto fail;
+        }
+        journal->size = JOURNAL_MAGIC_SIZE;
+    }
+    else
+    {
+        if(journal_recover(journal->fd, filename, &journal->size) != 0)
+        {
+            goto fail;
+        }
+
+        if(journal->size != (uint64_t)st.st_size)
+        {
+            journal->stats.recovered_bytes = st.st_size - journal->size;
+            fprintf(stderr, "Warning: Dropping %"PRIu64" bytes of torn records at the end of '%s'\n", journal->stats.recovered_bytes, filename);
+            if(ftruncate(journal->fd, journal->size) != 0 || fdatasync(journal->fd) != 0)
+            {
+                goto fail;
+            }
+        }
+    }
+    journal->synced_size = journal->size;
+
+    return 0;
+
+fail:
+    close(journal->fd);
+    journal->fd = -1;
+    return -1;
+}
+
+static int journal_write(journal_t *journal)
+{
+    uint32_t written = 0;
+    ssize_t result;
+
+    while(written < journal->used)
+    {
+        result = write(journal->fd, &journal->buffer[written], journal->used - written);
+        if(result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(result <= 0)
+        {
+            /* Cut back what did reach the file, or the next open would drop everything after it as a torn record */
+            journal->stats.errors++;
+            journal->used = 0;
+            if(ftruncate(journal->fd, journal->size) != 0)
+            {
+                fprintf(stderr, "Error: Unable to trim journal after a failed write: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+        written += result;
+    }
+
+    journal->size += journal->used;
+    journal->stats.bytes += journal->used;
+    journal->used = 0;
+    journal->stats.commits++;
+
+    return 0;
+}
+
+/* Records are only written on commit, or when the buffer is full. When asynchronous, a full buffer fails with EAGAIN */
+int journal_append(journal_t *journal, const void *data, uint32_t length)
+{
+    uint8_t *record;
+    uint32_t crc;
+
+    if(journal->fd < 0 || length > JOURNAL_BUFFER_SIZE - JOURNAL_RECORD_HEADER)
+    {
+        return -1;
+    }
+
+    if(journal->used + JOURNAL_RECORD_HEADER + length > JOURNAL_BUFFER_SIZE)
+    {
+        if(journal->async)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        if(journal_write(journal) != 0)
+        {
+            return -1;
+        }
+    }
+
+    record = &journal->buffer[journal->used];
+    memcpy(&record[0], &length, 4);
+    memcpy(&record[JOURNAL_RECORD_HEADER], data, length);
+    crc = journal_crc32(journal_crc32(0, &record[0], 4), &record[JOURNAL_RECORD_HEADER], length);
+    memcpy(&record[4], &crc, 4);
+
+    journal->used += JOURNAL_RECORD_HEADER + length;
+    journal->stats.records++;
+
+    return 0;
+}
+
+/* Group commit, everything appended since the last commit in one write(), made durable with sync */
+int journal_commit(journal_t *journal, bool sync)
+{
+    uint64_t start_us, sync_us;
+
+    if(journal->fd < 0)
+    {
+        return 0;
+    }
+
+    if(journal->used > 0 && journal_write(journal) != 0)
+    {
+        return -1;
+    }
+
+    if(!sync || journal->synced_size == journal->size)
+    {
+        return 0;
+    }
+
+    start_us = journal_monotonic_us();
+    if(fdatasync(journal->fd) != 0)
+    {
+        journal->stats.errors++;
+        return -1;
+    }
+    sync_us = journal_monotonic_us() - start_us;
+
+    journal->stats.syncs++;
+    journal->stats.sync_us_total += sync_us;
+    if(sync_us > journal->stats.sync_us_max)
+    {
+        journal->stats.sync_us_max = sync_us;
+    }
+    journal->stats.pages += ((journal->size + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE) - (journal->synced_size / JOURNAL_PAGE_SIZE);
+    journal->synced_size = journal->size;
+
+    return 0;
+}
+
+/* Hands over everything appended since the last commit, to be written at offset (then synced), and switches buffers.
+ *  Returns false if there's nothing to do, or the last commit is still in flight */
+bool journal_commit_begin(journal_t *journal, bool sync, const uint8_t **data, uint32_t *length, uint64_t *offset)
+{
+    if(journal->fd < 0 || journal->in_flight)
+    {
+        return false;
+    }
+
+    if(journal->used == 0 && (!sync || journal->synced_size == journal->size))
+    {
+        return false;
+    }
+
+    *data = journal->buffer;
+    *length = journal->used;
+    *offset = journal->size;
+
+    journal->in_flight = true;
+    journal->in_flight_length = journal->used;
+    journal->buffer = (journal->buffer == journal->buffers[0]) ? journal->buffers[1] : journal->buffers[0];
+    journal->used = 0;
+
+    return true;
+}
+
+/* result as from write(), or -errno */
+void journal_commit_end(journal_t *journal, int result, bool sync, uint64_t commit_us)
+{
+    journal->in_flight = false;
+
+    if(result < 0)
+    {
+        fprintf(stderr, "Error: Journal commit of %"PRIu32" bytes failed: %s\n", journal->in_flight_length, strerror(-result));
+        journal->stats.errors++;
+        if(ftruncate(journal->fd, journal->size) != 0)
+        {
+            fprintf(stderr, "Error: Unable to trim journal after a failed write: %s\n", strerror(errno));
+        }
+        return;
+    }
+
+    if(journal->in_flight_length > 0)
+    {
+        journal->size += journal->in_flight_length;
+        journal->stats.bytes += journal->in_flight_length;
+        journal->stats.commits++;
+    }
+
+    if(sync)
+    {
+        journal->stats.syncs++;
+        journal->stats.sync_us_total += commit_us;
+        if(commit_us > journal->stats.sync_us_max)
+        {
+            journal->stats.sync_us_max = commit_us;
+        }
+        journal->stats.pages += ((journal->size + JOURNAL_PAGE_SIZE - 1) / JOURNAL_PAGE_SIZE) - (journal->synced_size / JOURNAL_PAGE_SIZE);
+        journal->synced_size = journal->size;
+    }
+}
+
+/* Nothing may be in flight */
+void journal_close(journal_t *journal)
+{
+    if(journal->fd >= 0)
+    {
+        journal_commit(journal, true);
+        close(journal->fd);
+        journal->fd = -1;
+    }
+}
+
+void journal_stats_add(journal_stats_t *total, const journal_stats_t *stats)
+{
+    total->records += stats->records;
+    total->commits += stats->commits;
+    total->syncs += stats->syncs;
+    total->bytes += stats->bytes;
+    total->pages += stats->pages;
+    total->sync_us_total += stats->sync_us_total;
+    if(stats->sync_us_max > total->sync_us_max)
+    {
+        total->sync_us_max = stats->sync_us_max;
+    }
+    total->recovered_bytes += stats->recovered_bytes;
+    total->errors += stats->errors;
+}
+
+int journal_reader_open(journal_reader_t *reader, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(reader, 0, sizeof(journal_reader_t));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open journal '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size < JOURNAL_MAGIC_SIZE)
+    {
+        fprintf(stderr, "Error: Journal '%s' is too short\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(reader->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Unable to map journal '%s': %s\n", filename, strerror(errno));
+        reader->map = NULL;
+        return -1;
+    }
+    reader->map_size = st.st_size;
+
+    if(memcmp(reader->map, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: '%s' is not a jammon journal\n", filename);
+        journal_reader_close(reader);
+        return -1;
+    }
+    reader->offset = JOURNAL_MAGIC_SIZE;
+
+    return 0;
+}
+
+/* Returns false at the end, or at a torn or corrupt record (reader->offset is then short of map_size) */
+bool journal_reader_next(journal_reader_t *reader, const uint8_t **data, uint32_t *length)
+{
+    int64_t record_length = journal_record_check(reader->map, reader->map_size, reader->offset);
+
+    if(record_length < 0)
+    {
+        return false;
+    }
+
+    *data = &reader->map[reader->offset + JOURNAL_RECORD_HEADER];
+    *length = record_length;
+    reader->offset += JOURNAL_RECORD_HEADER + record_length;
+
+    return true;
+}
+
+void journal_reader_close(journal_reader_t *reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->map_size);
+        reader->map = NULL;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+/* Crash-safe append log, little-endian:
+ *  JOURNAL_MAGIC, then records of a u32 payload length, a u32 CRC-32 of the length and payload, and the payload.
+ *  Records are gathered in memory and written with a single O_APPEND write() per commit, optionally followed by
+ *  fdatasync(), or handed to an asynchronous writer with journal_commit_begin()/end() while appending carries on into a
+ *  second buffer. On open, a torn or corrupt tail (eg. from a power cut) is found by its CRC and truncated away. */
+
+#define JOURNAL_MAGIC           "JMJNLv1\n"
+#define JOURNAL_MAGIC_SIZE      8
+#define JOURNAL_RECORD_HEADER   8
+#define JOURNAL_BUFFER_SIZE     (64 * 1024)
+#define JOURNAL_PAGE_SIZE       4096 /* For the write amplification estimate */
+
+typedef struct {
+    uint64_t records;
+    uint64_t commits;
+    uint64_t syncs;
+    uint64_t bytes;
+    uint64_t pages; /* Written by syncs, counting a partly filled page each time it's synced */
+    uint64_t sync_us_total; /* Of fdatasync(), or the whole commit when asynchronous */
+    uint64_t sync_us_max;
+    uint64_t recovered_bytes; /* Dropped from torn tails */
+    uint64_t errors;
+} journal_stats_t;
+
+typedef struct {
+    int fd;
+    uint64_t size; /* Written so far */
+    uint64_t synced_size;
+    uint8_t buffers[2][JOURNAL_BUFFER_SIZE];
+    uint8_t *buffer; /* Being appended to */
+    uint32_t used;
+    bool async; /* Set after opening, commits are then only by journal_commit_begin()/end() */
+    bool in_flight; /* The other buffer */
+    uint32_t in_flight_length;
+    journal_stats_t stats;
+} journal_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    size_t offset; /* Of the next record */
+} journal_reader_t;
+
+uint32_t journal_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+int journal_open(journal_t *journal, const char *filename);
+int journal_append(journal_t *journal, const void *data, uint32_t length);
+int journal_commit(journal_t *journal, bool sync);
+bool journal_commit_begin(journal_t *journal, bool sync, const uint8_t **data, uint32_t *length, uint64_t *offset);
+void journal_commit_end(journal_t *journal, int result, bool sync, uint64_t commit_us);
+void journal_close(journal_t *journal);
+void journal_stats_add(journal_stats_t *total, const journal_stats_t *stats);
+
+int journal_reader_open(journal_reader_t *reader, const char *filename);
+bool journal_reader_next(journal_reader_t *reader, const uint8_t **data, uint32_t *length);
+void journal_reader_close(journal_reader_t *reader);
+
+#endif /* __JOURNAL_H__ */
@@ -1,7 +1,17 @@
 #ifndef __MAIN_H__
 #define __MAIN_H__
 
+#define RECEIVER_ID_LENGTH  16
+
+extern atomic_bool app_exit;
+
+uint64_t monotonic_ms(void);
+uint64_t monotonic_us(void);
+void sleep_ms(uint32_t _duration);
+
 typedef struct {
+    char receiver_id[RECEIVER_ID_LENGTH]; /* Empty for a lone un-named receiver */
+
     uint64_t mon_rf_monotonic;
     uint16_t agc, noise;
     uint8_t jam_cw, jam_bb;
@@ -25,6 +35,7 @@ typedef struct {
     uint64_t nav_pvt_monotonic;
     bool time_valid;
     uint64_t gnss_timestamp;
+    uint16_t gnss_timestamp_ms; /* Sub-second part, for rates above 1 Hz */
     int32_t lat, lon, alt;
     uint32_t h_acc, v_acc;
 
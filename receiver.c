@@ -0,0 +1,1370 @@
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libgen.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#include "main.h"
+#include "ubx.h"
+#include "event.h"
+#include "configure.h"
+#include "epoch.h"
+#include "ring.h"
+#include "capture.h"
+#include "sink.h"
+#include "receiver.h"
+
+#define HOUSEKEEPING_INTERVAL_MS    5000
+#define DEVICE_POLL_INTERVAL_MS     250
+#define CONFIGURE_RETRY_INTERVAL_MS 1000
+#define RECONNECT_BACKOFF_MIN_MS    250
+#define RECONNECT_BACKOFF_MAX_MS    30000
+#define RECONNECT_STABLE_MS         10000 /* A connection lasting this long resets the backoff */
+#define REPLAY_GAP_MAX_MS           60000 /* Longer gaps between captured frames are taken as a new session */
+
+/* After a reset, USB receivers drop off the bus and re-enumerate, UART-attached ones don't */
+#define RESET_REMOVAL_TIMEOUT_MS    2000
+#define RESET_READY_TIMEOUT_MS      10000
+#define RESET_POLL_INTERVAL_MS      250
+
+/* Reset */
+static const uint8_t ubx_cfg_rst[] = {
+    0xb5, 0x62,
+    0x06, 0x04,
+    0x04, 0x00,
+    0x00, 0x00, /* BBR Sections to clear (0x0000 == Hot Start) */
+    0x04, /* 0x04 = Hardware reset (watchdog) aftershutdown */
+    0x00, /* [Reserved] */
+    0x12, 0x6c /* Checksum */
+};
+
+/* Disable NMEA */
+static const uint8_t ubx_disable_nmea_usb[] = {
+    0xb5, 0x62,
+    0x06, 0x00,
+    0x14, 0x00,
+    0x03 /* USB */ ,0x00,
+    0x00,0x00,
+    0x00,0x00,
+    0x00,0x00,
+    0x00,0x00,0x00,0x00,
+    0x03,0x00,0x01,0x00,
+    0x00,0x00,0x00,0x00,
+    0x21, 0xa2 /* Checksum */
+};
+
+/* Enable Interference Detection  */
+static const uint8_t ubx_cfg_valset_enable_itfm[] = {
+    0xb5, 0x62,
+    0x06, 0x8a, /* UBX-CFG-VALSET */
+    0x0e, 0x00,
+    0x00, 0x01, 0x00, 0x00,
+    0x0d, 0x00, 0x41, 0x10, 0x01, // Enable ITFM ( 0x1041000d )
+    0x10, 0x00, 0x41, 0x20, 0x02, // Set Active Antenna ( 0x20410010 )
+    0x71, 0xd8 /* Checksum */
+};
+
+/* Set Automotive dynamic model */
+static const uint8_t ubx_set_nav_automotive[] = {
+    0xb5, 0x62,
+    0x06, 0x24,
+    0x24, 0x00,
+    0x01, 0x00, /* Bitmask of settings to apply: bit 0 = dynamic model only */
+    0x04, /* Dynamic Model = 4 (Automotive) */
+    0x00, /* Fix Type */
+    0x00, 0x00, 0x00, 0x00, /* 2D Altitude Value */
+    0x00, 0x00, 0x00, 0x00, /* 2D Altitude Variance */
+    0x00, /* Minimum GNSS Satellite Elevation */
+    0x00, /* Reserved */
+    0x00, 0x00, /* Position DOP Mask */
+    0x00, 0x00, /* Time DOP Mask */
+    0x00, 0x00, /* Position Accuracy Mask */
+    0x00, 0x00, /* Time Accuracy Mask */
+    0x00, /* Static hold threshold */
+    0x00, /* DGNSS Timeout */
+    0x00, /* Min Satellites for Fix */
+    0x00, /* Min C/N0 Threshold for Satellites */
+    0x00, 0x00, /* Reserved */
+    0x00, 0x00, /* Static Hold Distance Threshold */
+    0x00, /* UTC Standard (Automatic) */
+    0x00, 0x00, 0x00, 0x00, 0x00, /* Reserved */
+    0x53, 0x70 /* Checksum */
+};
+
+/* Time & Position Message */
+static const uint8_t ubx_enable_nav_pvt[] = {
+    0xb5, 0x62,
+    0x06, 0x01, /* UBX-CFG-MSG */
+    0x08, 0x00,
+    0x01, 0x07, /* Enable UBX-NAV-PVT */
+    0x00, /* Port 0 (I2C) */
+    0x00, /* Port 1 (UART/UART1) */
+    0x00, /* Port 2 (UART2) */
+    0x01, /* Port 3 (USB) at 1 second interval */
+    0x00, /* Port 4 */
+    0x00, /* Port 5 */
+    0x18, 0xdf /* Checksum */
+};
+
+/* Jamming indicators Message */
+static const uint8_t ubx_enable_mon_rf[] = {
+    0xb5, 0x62,
+    0x06, 0x01, /* UBX-CFG-MSG */
+    0x08, 0x00,
+    0x0A, 0x38, /* Enable UBX-MON-RF */
+    0x00, /* Port 0 (I2C) */
+    0x00, /* Port 1 (UART/UART1) */
+    0x00, /* Port 2 (UART2) */
+    0x01, /* Port 3 (USB) at 1 second interval */
+    0x00, /* Port 4 */
+    0x00, /* Port 5 */
+    0x52, 0x7E /* Checksum */
+};
+
+/* Crude Spectrum Analyzer */
+static const uint8_t ubx_enable_mon_span[] = {
+    0xb5, 0x62,
+    0x06, 0x01, /* UBX-CFG-MSG */
+    0x08, 0x00,
+    0x0A, 0x31, /* Enable UBX-MON-SPAN */
+    0x00, /* Port 0 (I2C) */
+    0x00, /* Port 1 (UART/UART1) */
+    0x00, /* Port 2 (UART2) */
+    0x01, /* Port 3 (USB) at 1 second interval */
+    0x00, /* Port 4 */
+    0x00, /* Port 5 */
+    0x4b, 0x4d /* Checksum */
+};
+
+/* SV Signals */
+static const uint8_t ubx_enable_nav_sat[] = {
+    0xb5, 0x62,
+    0x06, 0x01, /* UBX-CFG-MSG */
+    0x08, 0x00,
+    0x01, 0x35, /* Enable UBX-NAV-SAT */
+    0x00, /* Port 0 (I2C) */
+    0x00, /* Port 1 (UART/UART1) */
+    0x00, /* Port 2 (UART2) */
+    0x01, /* Port 3 (USB) at 1 second interval */
+    0x00, /* Port 4 */
+    0x00, /* Port 5 */
+    0x46, 0x21 /* Checksum */
+};
+
+/* SV Signals */
+static const uint8_t ubx_enable_nav_sig[] = {
+    0xb5, 0x62,
+    0x06, 0x01, /* UBX-CFG-MSG */
+    0x08, 0x00,
+    0x01, 0x43, /* Enable UBX-NAV-SIG */
+    0x00, /* Port 0 (I2C) */
+    0x00, /* Port 1 (UART/UART1) */
+    0x00, /* Port 2 (UART2) */
+    0x01, /* Port 3 (USB) at 1 second interval */
+    0x00, /* Port 4 */
+    0x00, /* Port 5 */
+    0x54, 0x83 /* Checksum */
+};
+
+/* Values of the configuration interface keys that show each step is already applied */
+static const configure_key_t nmea_usb_keys[] = {
+    { 0x10780001, 1 }, /* CFG-USBOUTPROT-UBX */
+    { 0x10780002, 0 } /* CFG-USBOUTPROT-NMEA */
+};
+static const configure_key_t itfm_keys[] = {
+    { 0x1041000d, 1 }, /* CFG-ITFM-ENABLE */
+    { 0x20410010, 2 } /* CFG-ITFM-ANTSETTING (Active) */
+};
+static const configure_key_t nav_automotive_keys[] = {
+    { 0x20110021, 4 } /* CFG-NAVSPG-DYNMODEL (Automotive) */
+};
+static const configure_key_t nav_pvt_keys[] = {
+    { 0x20910009, 1 } /* CFG-MSGOUT-UBX_NAV_PVT_USB */
+};
+static const configure_key_t nav_sat_keys[] = {
+    { 0x20910018, 1 } /* CFG-MSGOUT-UBX_NAV_SAT_USB */
+};
+static const configure_key_t nav_sig_keys[] = {
+    { 0x20910348, 1 } /* CFG-MSGOUT-UBX_NAV_SIG_USB */
+};
+static const configure_key_t mon_rf_keys[] = {
+    { 0x2091035c, 1 } /* CFG-MSGOUT-UBX_MON_RF_USB */
+};
+static const configure_key_t mon_span_keys[] = {
+    { 0x2091038e, 1 } /* CFG-MSGOUT-UBX_MON_SPAN_USB */
+};
+
+static const configure_key_t cfg_rate_keys_template[] = {
+    { 0x30210001, 1000 }, /* CFG-RATE-MEAS (ms), replaced with the configured rate */
+    { 0x30210002, 1 } /* CFG-RATE-NAV */
+};
+
+#define CONFIGURE_ITEM(_name, _frame, _keys) \
+    { _name, _frame, sizeof(_frame), _keys, sizeof(_keys) / sizeof(configure_key_t) }
+
+static const configure_item_t configure_items[] = {
+    CONFIGURE_ITEM("Disable NMEA on USB", ubx_disable_nmea_usb, nmea_usb_keys),
+    CONFIGURE_ITEM("Enable interference detection", ubx_cfg_valset_enable_itfm, itfm_keys),
+    CONFIGURE_ITEM("Set automotive mode", ubx_set_nav_automotive, nav_automotive_keys),
+    CONFIGURE_ITEM("Enable NAV-PVT", ubx_enable_nav_pvt, nav_pvt_keys),
+    CONFIGURE_ITEM("Enable NAV-SAT", ubx_enable_nav_sat, nav_sat_keys),
+    CONFIGURE_ITEM("Enable NAV-SIG", ubx_enable_nav_sig, nav_sig_keys),
+    CONFIGURE_ITEM("Enable MON-RF", ubx_enable_mon_rf, mon_rf_keys),
+    CONFIGURE_ITEM("Enable MON-SPAN", ubx_enable_mon_span, mon_span_keys)
+};
+
+static uint8_t send_ubx(int fd, const uint8_t *buffer, uint32_t buffer_size)
+{
+    if(write(fd, buffer, buffer_size) != (int)buffer_size)
+    {
+        return 3;
+    }
+
+    tcflush(fd, TCIFLUSH);
+    return 0;
+}
+
+static void handle_mon_rf(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose)
+    {
+        printf("# Got MON-RF at %.3f (monotonic)\n", (double)received_monotonic_ms / 1000);
+    }
+
+    epoch_mon(&receiver->epoch, EPOCH_MON_RF, received_monotonic_ms);
+
+    const mon_rf_header_t *rf_header = (const mon_rf_header_t *)(payload);
+
+    if(receiver->multiband == false)
+    {
+        /* Single-band, (probably L1) - eg. M9 */
+
+        if(rf_header->num_rfblocks != 1)
+        {
+            fprintf(stderr, "[%s] Error: Number of MON-RF RF Blocks, expected 1 (single-band), received: %"PRIu8"\n", receiver->device, rf_header->num_rfblocks);
+            return;
+        }
+
+        if(payload_length < 4+(1*24))
+        {
+            fprintf(stderr, "[%s] Error: MON-RF too short for 1 RF Block: %"PRIu16"\n", receiver->device, payload_length);
+            return;
+        }
+
+        const mon_rf_rfblock_t *rf_rfblock = (const mon_rf_rfblock_t *)(&payload[4+0]);
+
+        receiver->datapoint.agc = rf_rfblock->agcCnt;
+        receiver->datapoint.noise = rf_rfblock->noisePerMS;
+        receiver->datapoint.jam_cw = rf_rfblock->jamInd;
+        receiver->datapoint.jam_bb = (rf_rfblock->flags & 0x03) >> 2; /* 0 - unknown, 1 - OK, 2 - Warning, 3 - Critical */
+    }
+    else
+    {
+        /* Dual-band (probably L1 + L2) - eg. F9 */
+
+        if(rf_header->num_rfblocks != 2)
+        {
+            fprintf(stderr, "[%s] Error: Number of MON-RF RF Blocks, expected 2 (multi-band), received: %"PRIu8"\n", receiver->device, rf_header->num_rfblocks);
+            return;
+        }
+
+        if(payload_length < 4+(2*24))
+        {
+            fprintf(stderr, "[%s] Error: MON-RF too short for 2 RF Blocks: %"PRIu16"\n", receiver->device, payload_length);
+            return;
+        }
+
+        const mon_rf_rfblock_t *rf_rfblock = (const mon_rf_rfblock_t *)(&payload[4+0]);
+
+        receiver->datapoint.agc = rf_rfblock->agcCnt;
+        receiver->datapoint.noise = rf_rfblock->noisePerMS;
+        receiver->datapoint.jam_cw = rf_rfblock->jamInd;
+        receiver->datapoint.jam_bb = (rf_rfblock->flags & 0x03); /* 0 - unknown, 1 - OK, 2 - Warning, 3 - Critical */
+
+        /* Re-use pointer for second block */
+        rf_rfblock = (const mon_rf_rfblock_t *)(&payload[4+24]);
+
+        receiver->datapoint.agc2 = rf_rfblock->agcCnt;
+        receiver->datapoint.noise2 = rf_rfblock->noisePerMS;
+        receiver->datapoint.jam_cw2 = rf_rfblock->jamInd;
+        receiver->datapoint.jam_bb2 = (rf_rfblock->flags & 0x03); /* 0 - unknown, 1 - OK, 2 - Warning, 3 - Critical */
+    }
+
+    receiver->datapoint.mon_rf_monotonic = received_monotonic_ms;
+    epoch_add(&receiver->epoch, EPOCH_MON_RF, received_monotonic_ms);
+}
+
+static void handle_mon_span(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose)
+    {
+        printf("# Got MON-SPAN at %.3f (monotonic)\n", (double)received_monotonic_ms / 1000);
+    }
+
+    epoch_mon(&receiver->epoch, EPOCH_MON_SPAN, received_monotonic_ms);
+
+    const mon_span_header_t *span_header = (const mon_span_header_t *)(payload);
+
+    if(receiver->multiband == false)
+    {
+        /* Single-band, (probably L1) - eg. M9 */
+
+        if(span_header->num_rfblocks != 1)
+        {
+            fprintf(stderr, "[%s] Error: Number of MON-SPAN RF Blocks, expected 1 (single-band), received: %"PRIu8"\n", receiver->device, span_header->num_rfblocks);
+            return;
+        }
+
+        if(payload_length < 4+(1*272))
+        {
+            fprintf(stderr, "[%s] Error: MON-SPAN too short for 1 RF Block: %"PRIu16"\n", receiver->device, payload_length);
+            return;
+        }
+
+        const mon_span_rfblock_t *span_rfblock = (const mon_span_rfblock_t *)(&payload[4+0]);
+
+        memcpy(receiver->datapoint.spectrum, span_rfblock->spectrum, 256);
+
+        receiver->datapoint.span = span_rfblock->span;
+        receiver->datapoint.res = span_rfblock->res;
+        receiver->datapoint.center = span_rfblock->center;
+        receiver->datapoint.pga = span_rfblock->pga;
+    }
+    else
+    {
+        /* Dual-band (probably L1 + L2) - eg. F9 */
+
+        if(span_header->num_rfblocks != 2)
+        {
+            fprintf(stderr, "[%s] Error: Number of MON-SPAN RF Blocks, expected 2 (multi-band), received: %"PRIu8"\n", receiver->device, span_header->num_rfblocks);
+            return;
+        }
+
+        if(payload_length < 4+(2*272))
+        {
+            fprintf(stderr, "[%s] Error: MON-SPAN too short for 2 RF Blocks: %"PRIu16"\n", receiver->device, payload_length);
+            return;
+        }
+
+        const mon_span_rfblock_t *span_rfblock = (const mon_span_rfblock_t *)(&payload[4+0]);
+
+        memcpy(receiver->datapoint.spectrum, span_rfblock->spectrum, 256);
+
+        receiver->datapoint.span = span_rfblock->span;
+        receiver->datapoint.res = span_rfblock->res;
+        receiver->datapoint.center = span_rfblock->center;
+        receiver->datapoint.pga = span_rfblock->pga;
+
+        /* Re-use pointer for second block */
+        span_rfblock = (const mon_span_rfblock_t *)(&payload[4+0+272]);
+
+        memcpy(receiver->datapoint.spectrum2, span_rfblock->spectrum, 256);
+
+        receiver->datapoint.span2 = span_rfblock->span;
+        receiver->datapoint.res2 = span_rfblock->res;
+        receiver->datapoint.center2 = span_rfblock->center;
+        receiver->datapoint.pga2 = span_rfblock->pga;
+    }
+
+    receiver->datapoint.mon_span_monotonic = received_monotonic_ms;
+    epoch_add(&receiver->epoch, EPOCH_MON_SPAN, received_monotonic_ms);
+}
+
+static void handle_nav_pvt(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose)
+    {
+        printf("# Got NAV-PVT at %.3f (monotonic)\n", (double)received_monotonic_ms / 1000);
+    }
+
+    const nav_pvt_t *pvt = (const nav_pvt_t *)(payload);
+    (void)payload_length; /* Fixed length, checked by dispatcher */
+
+    epoch_nav(&receiver->epoch, pvt->itow, received_monotonic_ms);
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = pvt->year - 1900;
+    tm.tm_mon = pvt->month - 1;
+    tm.tm_mday = pvt->day;
+    tm.tm_hour = pvt->hour;
+    tm.tm_min = pvt->min;
+    tm.tm_sec = pvt->sec;
+
+    receiver->datapoint.time_valid = !!((pvt->valid & 0x03) == 0x03);
+    receiver->datapoint.gnss_timestamp = mktime(&tm);
+    receiver->datapoint.gnss_timestamp_ms = pvt->itow % 1000; /* GPS seconds are aligned with UTC seconds */
+    receiver->datapoint.lat = pvt->lat;
+    receiver->datapoint.lon = pvt->lon;
+    receiver->datapoint.alt = pvt->height;
+    receiver->datapoint.h_acc = pvt->hAcc;
+    receiver->datapoint.v_acc = pvt->vAcc;
+
+    receiver->datapoint.nav_pvt_monotonic = received_monotonic_ms;
+    epoch_add(&receiver->epoch, EPOCH_NAV_PVT, received_monotonic_ms);
+}
+
+static void handle_nav_sat(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose)
+    {
+        printf("# Got NAV-SAT at %.3f (monotonic)\n", (double)received_monotonic_ms / 1000);
+    }
+
+    const nav_sat_header_t *sat_header = (const nav_sat_header_t *)(payload);
+
+    if(payload_length < 8+(12*sat_header->num_svs))
+    {
+        fprintf(stderr, "[%s] Error: NAV-SAT too short for %"PRIu8" SVs: %"PRIu16"\n", receiver->device, sat_header->num_svs, payload_length);
+        return;
+    }
+
+    epoch_nav(&receiver->epoch, sat_header->itow, received_monotonic_ms);
+
+    receiver->datapoint.svs_nav = 0;
+
+    const nav_sat_sv_t *sat_sv;
+    for(int i = 0; i < sat_header->num_svs; i++)
+    {
+        sat_sv = (const nav_sat_sv_t *)(&payload[8+(12*i)]);
+
+        if(((sat_sv->flags & 0x8) >> 3) == 1)
+        {
+            /* Used in navigation solution */
+            receiver->datapoint.svs_nav++;
+        }
+    }
+
+    receiver->datapoint.nav_sat_monotonic = received_monotonic_ms;
+    epoch_add(&receiver->epoch, EPOCH_NAV_SAT, received_monotonic_ms);
+}
+
+static void handle_nav_sig(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose)
+    {
+        printf("# Got NAV-SIG at %.3f (monotonic)\n", (double)received_monotonic_ms / 1000);
+    }
+
+    const nav_sig_header_t *sig_header = (const nav_sig_header_t *)(payload);
+
+    if(payload_length < 8+(16*sig_header->num_svs))
+    {
+        fprintf(stderr, "[%s] Error: NAV-SIG too short for %"PRIu8" SVs: %"PRIu16"\n", receiver->device, sig_header->num_svs, payload_length);
+        return;
+    }
+
+    epoch_nav(&receiver->epoch, sig_header->itow, received_monotonic_ms);
+
+    receiver->datapoint.svs_acquired_l1 = 0;
+    receiver->datapoint.svs_acquired_l2 = 0;
+    receiver->datapoint.svs_locked_l1 = 0;
+    receiver->datapoint.svs_locked_l2 = 0;
+
+    const nav_sig_sv_t *sig_sv;
+    for(int i = 0; i < sig_header->num_svs; i++)
+    {
+        sig_sv = (const nav_sig_sv_t *)(&payload[8+(16*i)]);
+
+        if(sig_sv->qualInd >= 2)
+        {
+            /* SV acquired (note: locked are included) */
+            if(sig_sv->sig_id == 0 || sig_sv->sig_id == 1)
+            {
+                receiver->datapoint.svs_acquired_l1++;
+            }
+            else
+            {
+                receiver->datapoint.svs_acquired_l2++;
+            }
+        }
+
+        if(sig_sv->qualInd >= 4)
+        {
+            /* SV locked */
+            if(sig_sv->sig_id == 0 || sig_sv->sig_id == 1)
+            {
+                receiver->datapoint.svs_locked_l1++;
+            }
+            else
+            {
+                receiver->datapoint.svs_locked_l2++;
+            }
+        }
+    }
+
+    receiver->datapoint.nav_sig_monotonic = received_monotonic_ms;
+    epoch_add(&receiver->epoch, EPOCH_NAV_SIG, received_monotonic_ms);
+}
+
+static void handle_mon_ver(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    const mon_ver_t *ver = (const mon_ver_t *)(payload);
+    const char *extension;
+    (void)received_monotonic_ms;
+
+    /* Prefer the firmware version extension (eg. "FWVER=HPG 1.32") over the less specific software version */
+    snprintf(receiver->firmware, sizeof(receiver->firmware), "%.*s", (int)sizeof(ver->sw_version), ver->sw_version);
+    for(uint32_t offset = sizeof(mon_ver_t); offset + 30 <= payload_length; offset += 30)
+    {
+        extension = (const char *)&payload[offset];
+        if(strncmp(extension, "FWVER=", 6) == 0)
+        {
+            snprintf(receiver->firmware, sizeof(receiver->firmware), "%.*s", 30 - 6, &extension[6]);
+        }
+    }
+
+    printf("[%s] Receiver firmware: %s (hardware %.*s)\n", receiver->device, receiver->firmware, (int)sizeof(ver->hw_version), ver->hw_version);
+}
+
+static void epoch_emit_handler(void *arg, uint32_t itow, uint8_t members)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(receiver->verbose && members != EPOCH_ALL)
+    {
+        printf("[%s] Epoch %"PRIu32" incomplete (members 0x%02"PRIx8"), emitting\n", receiver->device, itow, members);
+    }
+
+    /* Output I/O runs on the sinks' own threads, so the serial port is always drained. Replay has no port to drain, so waits instead */
+    output_publish(&receiver->output, &receiver->datapoint, receiver->replay_path != NULL);
+    receiver->datapoints++;
+}
+
+static void epoch_timer_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    (void)events;
+
+    epoch_check_deadline(&receiver->epoch, monotonic_ms());
+}
+
+static void handle_ubx_frame(receiver_t *receiver, const uint8_t *buffer, uint32_t length, uint64_t received_monotonic_ms)
+{
+    #if 0
+    for(unsigned int i = 0; i < length; i++)
+    {
+        printf("%02x", buffer[i]);
+    }
+    printf("\n");
+    #endif
+
+    /* Frame time rather than the clock, so that replay is deterministic */
+    epoch_check_deadline(&receiver->epoch, received_monotonic_ms);
+
+    ubx_dispatch(&receiver->dispatcher, buffer, length, received_monotonic_ms);
+}
+
+static int receiver_configure(receiver_t *receiver);
+
+static int send_mon_ver_poll(receiver_t *receiver)
+{
+    uint8_t frame[6+2];
+    uint32_t frame_length;
+
+    frame_length = ubx_frame_build(frame, sizeof(frame), 0x0a, 0x04, NULL, 0);
+
+    return (write(receiver->fd, frame, frame_length) == (int)frame_length) ? 0 : -1;
+}
+
+/* Ends the post-reset wait, either on the first valid frame or when giving up */
+static void receiver_ready(receiver_t *receiver, bool responded)
+{
+    uint64_t now_ms = monotonic_ms();
+
+    event_remove_timer(&receiver->event_loop, receiver->ready_timer_fd);
+    receiver->ready_timer_fd = -1;
+
+    if(responded)
+    {
+        printf("[%s] Receiver ready %.3fs after reset (removed: %s, re-opened: %.3fs, firmware: %s)\n", receiver->device,
+            (double)(now_ms - receiver->reset_monotonic_ms) / 1000,
+            receiver->reset_removed ? "yes" : "no",
+            (double)(receiver->reset_reopened_monotonic_ms - receiver->reset_monotonic_ms) / 1000,
+            receiver->firmware[0] != '\0' ? receiver->firmware : "unknown");
+    }
+    else
+    {
+        fprintf(stderr, "[%s] Warning: No response %.3fs after reset, configuring anyway\n", receiver->device,
+            (double)(now_ms - receiver->reset_monotonic_ms) / 1000);
+    }
+
+    if(receiver_configure(receiver) != 0)
+    {
+        receiver->configure_failed = true;
+        event_loop_break(&receiver->event_loop);
+    }
+}
+
+static void ready_poll_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    (void)events;
+
+    if(receiver->reset_monotonic_ms + RESET_READY_TIMEOUT_MS < monotonic_ms())
+    {
+        receiver_ready(receiver, false);
+        return;
+    }
+
+    /* Write errors are expected while the receiver is still booting */
+    send_mon_ver_poll(receiver);
+}
+
+static void serial_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    int32_t device_response;
+    uint32_t length;
+    uint8_t *buffer;
+    uint64_t received_monotonic_ms;
+    (void)events;
+
+    /* Single non-blocking block read, then handle every complete frame it produced */
+    device_response = ubx_framer_fill(&receiver->framer, receiver->fd);
+    if(device_response == 0)
+    {
+        fprintf(stderr, "[%s] GNSS Device EOF (device disconnected).\n", receiver->device);
+        event_loop_break(&receiver->event_loop);
+        return;
+    }
+    else if(device_response < 0)
+    {
+        if(errno == EAGAIN || errno == EINTR)
+        {
+            return;
+        }
+        fprintf(stderr, "[%s] GNSS Device Read Error: %s\n", receiver->device, strerror(errno));
+        event_loop_break(&receiver->event_loop);
+        return;
+    }
+
+    received_monotonic_ms = monotonic_ms();
+    receiver->last_received_monotonic_ms = received_monotonic_ms;
+
+    while((length = ubx_framer_next(&receiver->framer, &buffer)) > 0)
+    {
+        if(receiver->capture.fd >= 0)
+        {
+            capture_write(&receiver->capture, buffer, length, received_monotonic_ms);
+        }
+
+        handle_ubx_frame(receiver, buffer, length, received_monotonic_ms);
+
+        if(receiver->ready_timer_fd >= 0)
+        {
+            receiver_ready(receiver, true);
+        }
+    }
+}
+
+/* Compare the datapoint rate since the last check against the configured rate, while configured and connected throughout */
+static void receiver_check_rate(receiver_t *receiver)
+{
+    uint64_t now_ms = monotonic_ms();
+    uint64_t window_ms = now_ms - receiver->rate_window_monotonic_ms;
+    double rate;
+
+    if(receiver->fd >= 0 && receiver->rate_window_monotonic_ms != 0 && window_ms >= (HOUSEKEEPING_INTERVAL_MS / 2))
+    {
+        rate = (double)(receiver->datapoints - receiver->rate_window_datapoints) * 1000 / window_ms;
+
+        if(rate < receiver->rate_hz * 0.9)
+        {
+            fprintf(stderr, "[%s] Warning: Output rate %.1f datapoints/s, configured for %"PRIu8" Hz\n", receiver->device, rate, receiver->rate_hz);
+        }
+        else if(receiver->verbose)
+        {
+            printf("[%s] Output rate %.1f datapoints/s\n", receiver->device, rate);
+        }
+    }
+
+    receiver->rate_window_monotonic_ms = (receiver->fd >= 0 && receiver->ready_timer_fd < 0 && receiver->configure.timer_fd < 0) ? now_ms : 0;
+    receiver->rate_window_datapoints = receiver->datapoints;
+}
+
+static void housekeeping_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    (void)events;
+
+    if(receiver->fd >= 0 && receiver->last_received_monotonic_ms + HOUSEKEEPING_INTERVAL_MS < monotonic_ms())
+    {
+        fprintf(stderr, "[%s] Warning: No data received from GNSS device for %.1fs\n", receiver->device, (double)(monotonic_ms() - receiver->last_received_monotonic_ms) / 1000);
+    }
+
+    receiver_check_rate(receiver);
+
+    output_check_drops(&receiver->output);
+
+    if(receiver->verbose)
+    {
+        printf("[%s] ", receiver->device);
+        ubx_framer_print_stats(&receiver->framer, stdout);
+        printf("[%s] ", receiver->device);
+        epoch_print_stats(&receiver->epoch, stdout);
+        output_print_stats(&receiver->output, stdout);
+    }
+}
+
+static void open_serialDevice(int *fd_ptr, char *devName)
+{
+    struct termios tty;
+
+    *fd_ptr = open(devName, O_RDWR);
+    if(*fd_ptr < 0)
+    {
+        fprintf(stderr, "Error: Cannot open serial device '%s'\n", devName);
+        return;
+    }
+
+    if (tcgetattr (*fd_ptr, &tty) != 0)
+    {
+        fprintf(stderr, "Error: tcgetattr\n");
+        close(*fd_ptr);
+        *fd_ptr = -1;
+        return;
+    }
+
+    cfsetospeed (&tty, B115200);
+    cfsetispeed (&tty, B115200);
+
+    tty.c_iflag &= ~(IGNBRK | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+    tty.c_oflag &= ~(ONLCR | OCRNL);
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tty.c_cc[VMIN]  = 1; // read doesn't block
+    tty.c_cc[VTIME] = 1; // 0.1 seconds read timeout
+
+    tty.c_cflag = (tty.c_cflag & ~CSIZE) | CS8;
+    tty.c_cflag |= (CLOCAL | CREAD);
+    tty.c_cflag &= ~(PARENB | PARODD);
+    tty.c_cflag |= 0;
+    tty.c_cflag &= ~CSTOPB;
+    tty.c_cflag &= ~CRTSCTS;
+
+    if (tcsetattr (*fd_ptr, TCSANOW, &tty) != 0)
+    {
+        fprintf(stderr, "Error: tcsetattr\n");
+        close(*fd_ptr);
+        *fd_ptr = -1;
+        return;
+    }
+}
+
+static void configure_done_handler(void *arg, bool success)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+
+    if(!success)
+    {
+        fprintf(stderr, "[%s] Configuration failed\n", receiver->device);
+        receiver->configure_failed = true;
+        event_loop_break(&receiver->event_loop);
+        return;
+    }
+
+    /* SBAS */
+    /* Defaults to using SBAS for navigation and differential correction */
+
+    printf("[%s] Configuration Successful in %"PRIu64" ms (%"PRIu32" sent, %"PRIu32" already set, %"PRIu32" retries)\n",
+        receiver->device, receiver->configure.duration_ms,
+        receiver->configure.sent, receiver->configure.skipped, receiver->configure.retries);
+}
+
+/* The measurement rate depends on -f, so the item list is per receiver.
+ *  Message rates above are per navigation solution, so output follows the measurement rate. */
+static void receiver_build_configure_items(receiver_t *receiver)
+{
+    configure_item_t *item;
+    uint8_t payload[6];
+    uint16_t meas_rate_ms = 1000 / receiver->rate_hz;
+
+    payload[0] = meas_rate_ms & 0xFF;
+    payload[1] = meas_rate_ms >> 8;
+    payload[2] = 0x01; /* Navigation rate, measurement cycles per solution */
+    payload[3] = 0x00;
+    payload[4] = 0x01; /* Time reference, GPS */
+    payload[5] = 0x00;
+    ubx_frame_build(receiver->cfg_rate_frame, sizeof(receiver->cfg_rate_frame), 0x06, 0x08, payload, sizeof(payload));
+
+    memcpy(receiver->cfg_rate_keys, cfg_rate_keys_template, sizeof(cfg_rate_keys_template));
+    receiver->cfg_rate_keys[0].value = meas_rate_ms;
+
+    item = &receiver->configure_items[0];
+    item->name = "Set measurement rate";
+    item->frame = receiver->cfg_rate_frame;
+    item->frame_length = sizeof(receiver->cfg_rate_frame);
+    item->keys = receiver->cfg_rate_keys;
+    item->keys_count = sizeof(cfg_rate_keys_template) / sizeof(configure_key_t);
+
+    memcpy(&receiver->configure_items[1], configure_items, sizeof(configure_items));
+    receiver->configure_items_count = 1 + (sizeof(configure_items) / sizeof(configure_item_t));
+}
+
+/* Runs alongside normal frame handling, so data flows as soon as the receiver starts sending it */
+static int receiver_configure(receiver_t *receiver)
+{
+    printf("[%s] Configuring..\n", receiver->device);
+
+    if(receiver->configure_items_count == 0)
+    {
+        receiver_build_configure_items(receiver);
+    }
+
+    receiver->configure_failed = false;
+    receiver->configure.verbose = receiver->verbose;
+
+    if(receiver->firmware[0] == '\0')
+    {
+        /* Answer is logged by handle_mon_ver() */
+        send_mon_ver_poll(receiver);
+    }
+
+    return configure_start(&receiver->configure, &receiver->event_loop, receiver->fd,
+        receiver->configure_items, receiver->configure_items_count, configure_done_handler, receiver);
+}
+
+/* Called on any change in the device directory, and periodically as a fallback */
+static void device_check(receiver_t *receiver)
+{
+    if(receiver->await_removal)
+    {
+        if(access(receiver->device, F_OK) != 0)
+        {
+            event_loop_break(&receiver->event_loop);
+        }
+        return;
+    }
+
+    if(receiver->fd >= 0 || access(receiver->device, R_OK | W_OK) != 0)
+    {
+        return;
+    }
+
+    open_serialDevice(&receiver->fd, receiver->device);
+    if(receiver->fd >= 0)
+    {
+        event_loop_break(&receiver->event_loop);
+    }
+}
+
+static void device_watch_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    uint8_t inotify_buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    (void)events;
+
+    /* Any change is a prompt to retry, the events themselves aren't needed */
+    while(read(receiver->inotify_fd, inotify_buffer, sizeof(inotify_buffer)) > 0);
+
+    device_check(receiver);
+}
+
+static void device_poll_handler(void *arg, uint32_t events)
+{
+    (void)events;
+    device_check((receiver_t *)arg);
+}
+
+static void device_timeout_handler(void *arg, uint32_t events)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    (void)events;
+
+    event_loop_break(&receiver->event_loop);
+}
+
+/* Services the event loop until device_check() breaks it, or timeout_ms (0 for no timeout) has passed.
+ *  The directory is watched with inotify, with polling to cover directories that come and go, eg. /dev/serial/by-id */
+static void receiver_watch_device(receiver_t *receiver, uint32_t timeout_ms)
+{
+    char *device_dir;
+    int poll_timer_fd;
+    int timeout_timer_fd = -1;
+
+    receiver->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(receiver->inotify_fd >= 0)
+    {
+        device_dir = strdup(receiver->device);
+        if(inotify_add_watch(receiver->inotify_fd, dirname(device_dir), IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM) < 0
+            || event_add_fd(&receiver->event_loop, receiver->inotify_fd, EPOLLIN, device_watch_handler, receiver) != 0)
+        {
+            close(receiver->inotify_fd);
+            receiver->inotify_fd = -1;
+        }
+        free(device_dir);
+    }
+
+    poll_timer_fd = event_add_timer(&receiver->event_loop, DEVICE_POLL_INTERVAL_MS, DEVICE_POLL_INTERVAL_MS, device_poll_handler, receiver);
+    if(timeout_ms > 0)
+    {
+        timeout_timer_fd = event_add_timer(&receiver->event_loop, timeout_ms, 0, device_timeout_handler, receiver);
+    }
+
+    event_loop_run(&receiver->event_loop);
+
+    if(timeout_timer_fd >= 0)
+    {
+        event_remove_timer(&receiver->event_loop, timeout_timer_fd);
+    }
+    if(poll_timer_fd >= 0)
+    {
+        event_remove_timer(&receiver->event_loop, poll_timer_fd);
+    }
+    if(receiver->inotify_fd >= 0)
+    {
+        event_remove_fd(&receiver->event_loop, receiver->inotify_fd);
+        close(receiver->inotify_fd);
+        receiver->inotify_fd = -1;
+    }
+}
+
+/* Blocks (servicing the event loop) until the device node exists and is opened */
+static int receiver_wait_device(receiver_t *receiver)
+{
+    device_check(receiver);
+    if(receiver->fd >= 0)
+    {
+        return 0;
+    }
+
+    printf("[%s] Waiting for device..\n", receiver->device);
+
+    receiver_watch_device(receiver, 0);
+
+    return (receiver->fd >= 0) ? 0 : -1;
+}
+
+/* Blocks (servicing the event loop) until the device node disappears, or timeout_ms has passed. Returns true if it disappeared */
+static bool receiver_wait_removal(receiver_t *receiver, uint32_t timeout_ms)
+{
+    if(access(receiver->device, F_OK) == 0)
+    {
+        receiver->await_removal = true;
+        receiver_watch_device(receiver, timeout_ms);
+        receiver->await_removal = false;
+    }
+
+    return access(receiver->device, F_OK) != 0;
+}
+
+/* Sleeps before the next connection attempt, doubling the delay each time up to RECONNECT_BACKOFF_MAX_MS, so a device
+ *  that opens and fails straight away is not reopened in a tight loop */
+static void receiver_backoff(receiver_t *receiver, uint32_t *backoff_ms, uint64_t connected_ms)
+{
+    uint32_t delay_ms;
+    uint64_t deadline_ms;
+
+    if(connected_ms >= RECONNECT_STABLE_MS)
+    {
+        *backoff_ms = RECONNECT_BACKOFF_MIN_MS;
+    }
+
+    delay_ms = *backoff_ms;
+    if(receiver->configure_failed && delay_ms < CONFIGURE_RETRY_INTERVAL_MS)
+    {
+        /* A receiver that NAKs will do so again */
+        delay_ms = CONFIGURE_RETRY_INTERVAL_MS;
+    }
+
+    *backoff_ms = (*backoff_ms * 2 < RECONNECT_BACKOFF_MAX_MS) ? *backoff_ms * 2 : RECONNECT_BACKOFF_MAX_MS;
+
+    if(delay_ms > RECONNECT_BACKOFF_MIN_MS)
+    {
+        printf("[%s] Retrying in %.3fs\n", receiver->device, (double)delay_ms / 1000);
+    }
+
+    /* In steps, so that exit is not held up */
+    deadline_ms = monotonic_ms() + delay_ms;
+    while(!app_exit && monotonic_ms() < deadline_ms)
+    {
+        sleep_ms(DEVICE_POLL_INTERVAL_MS);
+    }
+}
+
+static void receiver_disconnect(receiver_t *receiver)
+{
+    configure_cancel(&receiver->configure);
+    epoch_reset(&receiver->epoch);
+    receiver->firmware[0] = '\0';
+    if(receiver->ready_timer_fd >= 0)
+    {
+        event_remove_timer(&receiver->event_loop, receiver->ready_timer_fd);
+        receiver->ready_timer_fd = -1;
+    }
+    event_remove_fd(&receiver->event_loop, receiver->fd);
+    close(receiver->fd);
+    receiver->fd = -1;
+
+    ubx_framer_reset(&receiver->framer);
+}
+
+/* Feed a capture file through the same frame handling as a live receiver.
+ *  Frames carry their recorded monotonic timestamps, so datapoint assembly is deterministic,
+ *  real-time mode only adds pacing. Sessions appended to the same capture each have their own clock (eg. across a
+ *  reboot), so where the timestamps go backwards or jump by more than REPLAY_GAP_MAX_MS the replay clock is re-based
+ *  to carry on one epoch deadline after the last frame, once any epoch still open has been closed. The same is done
+ *  for the epoch open at the end of the capture. */
+static void receiver_replay(receiver_t *receiver)
+{
+    capture_reader_t reader;
+    const capture_record_header_t *record;
+    const uint8_t *frame;
+    uint64_t frames = 0, invalid_frames = 0;
+    uint64_t first_record_monotonic_ms = 0, last_record_monotonic_ms = 0;
+    uint64_t start_monotonic_ms, elapsed_ms, due_ms, now_ms;
+    uint64_t record_monotonic_ms, previous_monotonic_ms = 0;
+    uint64_t offset_ms = 0; /* Added to the recorded clock, modulo 2^64 */
+    uint64_t sessions = 1;
+
+    if(capture_reader_open(&reader, receiver->replay_path) != 0)
+    {
+        return;
+    }
+
+    printf("[%s] Replaying capture (%s)..\n", receiver->device, receiver->replay_realtime ? "real-time" : "full speed");
+
+    start_monotonic_ms = monotonic_ms();
+
+    while(!app_exit && (frame = capture_reader_next(&reader, &record)) != NULL)
+    {
+        if(frames == 0)
+        {
+            first_record_monotonic_ms = record->monotonic_ms;
+            last_record_monotonic_ms = record->monotonic_ms;
+        }
+        else if(record->monotonic_ms < previous_monotonic_ms || record->monotonic_ms - previous_monotonic_ms > REPLAY_GAP_MAX_MS)
+        {
+            /* New session */
+            epoch_check_deadline(&receiver->epoch, last_record_monotonic_ms + receiver->epoch.deadline_ms);
+            offset_ms = last_record_monotonic_ms + receiver->epoch.deadline_ms - record->monotonic_ms;
+            sessions++;
+        }
+        previous_monotonic_ms = record->monotonic_ms;
+        record_monotonic_ms = record->monotonic_ms + offset_ms;
+        last_record_monotonic_ms = record_monotonic_ms;
+
+        if(receiver->replay_realtime)
+        {
+            due_ms = start_monotonic_ms + (record_monotonic_ms - first_record_monotonic_ms);
+            while(!app_exit && (now_ms = monotonic_ms()) < due_ms)
+            {
+                /* Short naps so that signals are noticed across long gaps */
+                sleep_ms((due_ms - now_ms) < 100 ? (due_ms - now_ms) : 100);
+            }
+        }
+
+        frames++;
+
+        if(frame[0] != 0xb5 || frame[1] != 0x62
+            || (uint32_t)(6+2+(frame[5] << 8 | frame[4])) != record->length
+            || !ubx_verify_checksum(frame, record->length))
+        {
+            invalid_frames++;
+            continue;
+        }
+
+        handle_ubx_frame(receiver, frame, record->length, record_monotonic_ms);
+    }
+
+    /* No timer in replay, so the last epoch is closed as its deadline would have */
+    if(!app_exit && frames > 0)
+    {
+        epoch_check_deadline(&receiver->epoch, last_record_monotonic_ms + receiver->epoch.deadline_ms);
+    }
+
+    elapsed_ms = monotonic_ms() - start_monotonic_ms;
+
+    printf("[%s] Replay: %"PRIu64" frames (%"PRIu64" invalid) in %"PRIu64" sessions, %"PRIu64" datapoints in %.3fs"
+        " (%.0f frames/s, %.0f datapoints/s), capture spans %.1fs (%.0fx real-time)\n",
+        receiver->device, frames, invalid_frames, sessions, receiver->datapoints, elapsed_ms / 1000.0,
+        elapsed_ms > 0 ? frames * 1000.0 / elapsed_ms : 0.0,
+        elapsed_ms > 0 ? receiver->datapoints * 1000.0 / elapsed_ms : 0.0,
+        (last_record_monotonic_ms - first_record_monotonic_ms) / 1000.0,
+        elapsed_ms > 0 ? (double)(last_record_monotonic_ms - first_record_monotonic_ms) / elapsed_ms : 0.0
+    );
+
+    capture_reader_close(&reader);
+}
+
+static void *receiver_thread(void *arg)
+{
+    receiver_t *receiver = (receiver_t *)arg;
+    bool first_connection = true;
+    bool reset_pending = false;
+    uint64_t disconnected_monotonic_ms = 0;
+    uint64_t connected_monotonic_ms;
+    uint32_t backoff_ms = RECONNECT_BACKOFF_MIN_MS;
+    bool connected;
+
+    if(receiver->replay_path != NULL)
+    {
+        receiver_replay(receiver);
+        return NULL;
+    }
+
+    if(event_add_timer(&receiver->event_loop, HOUSEKEEPING_INTERVAL_MS, HOUSEKEEPING_INTERVAL_MS, housekeeping_handler, receiver) < 0)
+    {
+        return NULL;
+    }
+
+    /* Armed by the epoch assembler for each open epoch */
+    receiver->epoch.timer_fd = event_add_timer(&receiver->event_loop, 0, 0, epoch_timer_handler, receiver);
+    if(receiver->epoch.timer_fd < 0)
+    {
+        return NULL;
+    }
+
+    /* Datapoint, framer statistics and output state persist across reconnections */
+    while(!app_exit)
+    {
+        if(receiver_wait_device(receiver) != 0)
+        {
+            /* Stopped */
+            break;
+        }
+
+        if(first_connection && receiver->reset)
+        {
+            printf("[%s] Resetting GNSS Receiver..\n", receiver->device);
+
+            if(0 != send_ubx(receiver->fd, ubx_cfg_rst, sizeof(ubx_cfg_rst)))
+            {
+                fprintf(stderr, "[%s] Failed to send reset command\n", receiver->device);
+            }
+            receiver->reset_monotonic_ms = monotonic_ms();
+            close(receiver->fd);
+            receiver->fd = -1;
+
+            /* Readiness is then detected from the receiver's response to MON-VER polls, rather than a fixed delay */
+            receiver->reset_removed = receiver_wait_removal(receiver, RESET_REMOVAL_TIMEOUT_MS);
+            if(app_exit || receiver_wait_device(receiver) != 0)
+            {
+                break;
+            }
+            receiver->reset_reopened_monotonic_ms = monotonic_ms();
+            reset_pending = true;
+        }
+
+        /* Serial is serviced from the event loop from here on */
+        connected_monotonic_ms = monotonic_ms();
+        connected = true;
+        tcflush(receiver->fd, TCIFLUSH);
+        if(fcntl(receiver->fd, F_SETFL, fcntl(receiver->fd, F_GETFL) | O_NONBLOCK) != 0
+            || event_add_fd(&receiver->event_loop, receiver->fd, EPOLLIN, serial_handler, receiver) != 0)
+        {
+            fprintf(stderr, "[%s] Error: Unable to add serial device to event loop: %s\n", receiver->device, strerror(errno));
+            connected = false;
+        }
+        else if(reset_pending)
+        {
+            reset_pending = false;
+
+            /* Configured from receiver_ready() */
+            receiver->ready_timer_fd = event_add_timer(&receiver->event_loop, 1, RESET_POLL_INTERVAL_MS, ready_poll_handler, receiver);
+            connected = (receiver->ready_timer_fd >= 0);
+        }
+        /* Configuration is held in receiver RAM and must be re-applied after the device re-enumerates, but never reset again */
+        else if(receiver_configure(receiver) != 0)
+        {
+            fprintf(stderr, "[%s] Error: Unable to start configuration\n", receiver->device);
+            receiver->configure_failed = true;
+            connected = false;
+        }
+
+        if(connected)
+        {
+            if(!first_connection)
+            {
+                printf("[%s] Reconnected after %.3fs\n", receiver->device, (double)(monotonic_ms() - disconnected_monotonic_ms) / 1000);
+            }
+            first_connection = false;
+
+            receiver->last_received_monotonic_ms = monotonic_ms();
+            if(!app_exit)
+            {
+                event_loop_run(&receiver->event_loop);
+            }
+        }
+
+        receiver_disconnect(receiver);
+        disconnected_monotonic_ms = monotonic_ms();
+
+        if(!app_exit)
+        {
+            receiver_backoff(receiver, &backoff_ms, disconnected_monotonic_ms - connected_monotonic_ms);
+        }
+    }
+
+    if(receiver->fd >= 0)
+    {
+        close(receiver->fd);
+        receiver->fd = -1;
+    }
+
+    return NULL;
+}
+
+void receiver_init(receiver_t *receiver, const char *id, const char *device)
+{
+    memset(receiver, 0, sizeof(receiver_t));
+
+    snprintf(receiver->id, sizeof(receiver->id), "%s", id);
+    receiver->device = strdup(device);
+    receiver->fd = -1;
+    receiver->inotify_fd = -1;
+    receiver->ready_timer_fd = -1;
+    receiver->capture.fd = -1;
+    receiver->udp_port = 44333;
+    receiver->epoch_deadline_ms = EPOCH_DEADLINE_DEFAULT_MS;
+    receiver->rate_hz = 1;
+
+    ubx_framer_init(&receiver->framer);
+
+    ubx_dispatch_init(&receiver->dispatcher, receiver->device);
+    ubx_dispatch_register(&receiver->dispatcher, 0x0a, 0x04, "MON-VER", sizeof(mon_ver_t), UBX_NO_VERSION, 0, handle_mon_ver, receiver);
+    configure_init(&receiver->configure, receiver->device, &receiver->dispatcher);
+    ubx_dispatch_register(&receiver->dispatcher, 0x0a, 0x38, "MON-RF", 4, 0, 0x00, handle_mon_rf, receiver);
+    ubx_dispatch_register(&receiver->dispatcher, 0x0a, 0x31, "MON-SPAN", 4, 0, 0x00, handle_mon_span, receiver);
+    ubx_dispatch_register(&receiver->dispatcher, 0x01, 0x07, "NAV-PVT", sizeof(nav_pvt_t), UBX_NO_VERSION, 0, handle_nav_pvt, receiver);
+    ubx_dispatch_register(&receiver->dispatcher, 0x01, 0x35, "NAV-SAT", sizeof(nav_sat_header_t), 4, 0x01, handle_nav_sat, receiver);
+    ubx_dispatch_register(&receiver->dispatcher, 0x01, 0x43, "NAV-SIG", sizeof(nav_sig_header_t), 4, 0x00, handle_nav_sig, receiver);
+
+    memcpy(receiver->datapoint.receiver_id, receiver->id, sizeof(receiver->datapoint.receiver_id));
+}
+
+int receiver_start(receiver_t *receiver)
+{
+    receiver->datapoint.multiband = receiver->multiband;
+    epoch_init(&receiver->epoch, receiver->epoch_deadline_ms, epoch_emit_handler, receiver);
+
+    if(receiver->capture_path != NULL)
+    {
+        if(capture_open(&receiver->capture, receiver->capture_path) != 0)
+        {
+            return -1;
+        }
+        printf("[%s] Capturing UBX frames to: %s\n", receiver->device, receiver->capture_path);
+    }
+
+    receiver->framer.verbose = receiver->verbose;
+
+    receiver->sink_context.label = receiver->device;
+    receiver->sink_context.id = receiver->id;
+    receiver->sink_context.verbose = receiver->verbose;
+    receiver->sink_context.rate_hz = receiver->rate_hz;
+    receiver->sink_context.udp_hosts = receiver->udp_hosts;
+    receiver->sink_context.udp_hosts_count = receiver->udp_hosts_count;
+    receiver->sink_context.udp_port = receiver->udp_port;
+    output_init(&receiver->output, &receiver->sink_context);
+
+    for(uint32_t i = 0; i < receiver->sink_specs_count; i++)
+    {
+        if(output_add_sink(&receiver->output, receiver->sink_specs[i]) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if(output_start(&receiver->output) != 0)
+    {
+        return -1;
+    }
+
+    if(event_loop_init(&receiver->event_loop) != 0)
+    {
+        return -1;
+    }
+
+    if(pthread_create(&receiver->thread, NULL, receiver_thread, receiver) != 0)
+    {
+        fprintf(stderr, "[%s] Error: Unable to start receiver thread\n", receiver->device);
+        event_loop_close(&receiver->event_loop);
+        return -1;
+    }
+    receiver->thread_running = true;
+
+    return 0;
+}
+
+/* Queued output is written before returning */
+static void receiver_output_stop(receiver_t *receiver)
+{
+    output_stop(&receiver->output);
+    output_print_stats(&receiver->output, stdout);
+}
+
+/* Async-signal-safe */
+void receiver_stop(receiver_t *receiver)
+{
+    if(receiver->thread_running)
+    {
+        event_loop_stop(&receiver->event_loop);
+    }
+}
+
+void receiver_join(receiver_t *receiver)
+{
+    if(!receiver->thread_running)
+    {
+        receiver_output_stop(receiver);
+        return;
+    }
+
+    pthread_join(receiver->thread, NULL);
+    receiver->thread_running = false;
+    event_loop_close(&receiver->event_loop);
+
+    receiver_output_stop(receiver);
+
+    if(receiver->replay_path == NULL)
+    {
+        printf("[%s] ", receiver->device);
+        ubx_framer_print_stats(&receiver->framer, stdout);
+    }
+    printf("[%s] ", receiver->device);
+    ubx_dispatch_print_stats(&receiver->dispatcher, stdout);
+    printf("[%s] ", receiver->device);
+    epoch_print_stats(&receiver->epoch, stdout);
+
+    if(receiver->capture.fd >= 0)
+    {
+        printf("[%s] Capture: %"PRIu64" frames, %"PRIu64" bytes, %"PRIu64" write errors\n", receiver->device,
+            receiver->capture.frames, receiver->capture.bytes, receiver->capture.errors);
+        capture_close(&receiver->capture);
+    }
+}
+
+void receiver_close(receiver_t *receiver)
+{
+    free(receiver->device);
+    receiver->device = NULL;
+    free(receiver->capture_path);
+    receiver->capture_path = NULL;
+
+    ubx_dispatch_free(&receiver->dispatcher);
+
+    output_free(&receiver->output);
+}
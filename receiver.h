@@ -0,0 +1,68 @@
+#ifndef __RECEIVER_H__
+#define __RECEIVER_H__
+
+#define RECEIVER_MAX    8
+#define RATE_MAX_HZ     25
+
+typedef struct {
+    /* Configuration */
+    char id[RECEIVER_ID_LENGTH]; /* Empty for a lone un-named receiver */
+    char *device;
+    bool multiband;
+    bool reset;
+    bool verbose;
+    const char *const *udp_hosts;
+    uint32_t udp_hosts_count;
+    uint16_t udp_port;
+    char *capture_path; /* Optional, owned */
+    const char *replay_path; /* Replay capture instead of opening device */
+    bool replay_realtime;
+    uint32_t epoch_deadline_ms;
+    uint8_t rate_hz; /* Navigation and output rate */
+    const char *sink_specs[SINK_MAX]; /* -o, "<name>[:<options>]" */
+    uint32_t sink_specs_count;
+
+    /* Worker state */
+    pthread_t thread;
+    bool thread_running;
+    event_loop_t event_loop;
+    int fd;
+    int inotify_fd;
+    bool await_removal;
+
+    /* Reset, -r */
+    uint64_t reset_monotonic_ms;
+    uint64_t reset_reopened_monotonic_ms;
+    bool reset_removed;
+    int ready_timer_fd; /* MON-VER polling until the receiver responds, -1 once ready */
+    char firmware[32]; /* From MON-VER, empty until known */
+
+    ubx_framer_t framer;
+    ubx_dispatcher_t dispatcher;
+    configure_t configure;
+    bool configure_failed;
+    configure_item_t configure_items[CONFIGURE_MAX_ITEMS];
+    uint32_t configure_items_count;
+    uint8_t cfg_rate_frame[6+6+2];
+    configure_key_t cfg_rate_keys[2];
+    capture_t capture;
+
+    jammon_datapoint_t datapoint;
+    epoch_t epoch;
+
+    /* Output, datapoints are handed to the sinks' threads so that file and network I/O never stall the serial port */
+    sink_context_t sink_context;
+    output_t output;
+    uint64_t last_received_monotonic_ms;
+    uint64_t datapoints;
+    uint64_t rate_window_monotonic_ms; /* Start of output rate measurement, 0 while not (yet) configured and connected */
+    uint64_t rate_window_datapoints;
+} receiver_t;
+
+void receiver_init(receiver_t *receiver, const char *id, const char *device);
+int receiver_start(receiver_t *receiver);
+void receiver_stop(receiver_t *receiver);
+void receiver_join(receiver_t *receiver);
+void receiver_close(receiver_t *receiver);
+
+#endif /* __RECEIVER_H__ */
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "ring.h"
+
+int ring_init(ring_t *ring, uint32_t item_size, uint32_t capacity)
+{
+    memset(ring, 0, sizeof(ring_t));
+
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0)
+    {
+        fprintf(stderr, "Error: Ring capacity must be a power of 2 (%"PRIu32")\n", capacity);
+        return -1;
+    }
+
+    ring->slots = malloc((size_t)item_size * capacity);
+    if(ring->slots == NULL)
+    {
+        fprintf(stderr, "Error: Unable to allocate ring of %"PRIu32" x %"PRIu32" bytes\n", capacity, item_size);
+        return -1;
+    }
+    ring->item_size = item_size;
+    ring->capacity = capacity;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return 0;
+}
+
+void ring_free(ring_t *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+bool ring_full(ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    return (tail - atomic_load_explicit(&ring->head, memory_order_acquire)) >= ring->capacity;
+}
+
+/* Copies the item in, returns false (and counts the drop) if the ring is full */
+bool ring_push(ring_t *ring, const void *item)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t depth = tail - atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if(depth >= ring->capacity)
+    {
+        ring->dropped++;
+        return false;
+    }
+
+    memcpy(&ring->slots[(size_t)(tail & (ring->capacity - 1)) * ring->item_size], item, ring->item_size);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    ring->pushed++;
+    if(depth + 1 > ring->depth_max)
+    {
+        ring->depth_max = depth + 1;
+    }
+
+    return true;
+}
+
+/* Oldest item in place, or NULL if empty. Valid until ring_release() */
+void *ring_peek(ring_t *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if(head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+    {
+        return NULL;
+    }
+
+    return &ring->slots[(size_t)(head & (ring->capacity - 1)) * ring->item_size];
+}
+
+void ring_release(ring_t *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    ring->popped++;
+}
+
+void ring_print_stats(ring_t *ring, FILE *stream)
+{
+    fprintf(stream, "Queue: %"PRIu64" queued, %"PRIu64" processed, %"PRIu64" dropped (full), max depth %"PRIu32"/%"PRIu32"\n",
+        ring->pushed,
+        ring->popped,
+        ring->dropped,
+        ring->depth_max,
+        ring->capacity
+    );
+}
@@ -0,0 +1,38 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+/* Bounded lock-free single-producer/single-consumer ring of fixed-size items.
+ *  The producer never blocks, a push to a full ring is dropped and counted. */
+
+#define RING_CACHELINE  64
+
+typedef struct {
+    uint8_t *slots;
+    uint32_t item_size;
+    uint32_t capacity; /* Power of 2 */
+
+    /* Written by the consumer only */
+    _Atomic uint32_t head __attribute__((aligned(RING_CACHELINE)));
+    uint64_t popped;
+
+    /* Written by the producer only */
+    _Atomic uint32_t tail __attribute__((aligned(RING_CACHELINE)));
+    uint64_t pushed;
+    uint64_t dropped;
+    uint32_t depth_max;
+} ring_t;
+
+int ring_init(ring_t *ring, uint32_t item_size, uint32_t capacity);
+void ring_free(ring_t *ring);
+
+/* Producer */
+bool ring_full(ring_t *ring);
+bool ring_push(ring_t *ring, const void *item);
+
+/* Consumer, peek then release once the item has been used */
+void *ring_peek(ring_t *ring);
+void ring_release(ring_t *ring);
+
+void ring_print_stats(ring_t *ring, FILE *stream);
+
+#endif /* __RING_H__ */
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+
+static const sink_ops_t *const sink_types[] = {
+    &sink_csv_ops,
+    &sink_udp_ops,
+    &sink_print_ops,
+    &sink_spectrum_ops,
+    &sink_archive_ops,
+    &sink_rollup_ops
+};
+
+/* "<name>[:<options>]" */
+static const sink_ops_t *sink_find(const char *spec)
+{
+    size_t name_length = strcspn(spec, ":");
+
+    for(uint32_t i = 0; i < sizeof(sink_types) / sizeof(sink_types[0]); i++)
+    {
+        if(strlen(sink_types[i]->name) == name_length && strncmp(sink_types[i]->name, spec, name_length) == 0)
+        {
+            return sink_types[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool sink_spec_valid(const char *spec)
+{
+    return sink_find(spec) != NULL;
+}
+
+/* Splits "<key>=<value>,.." sink options in place. Returns the next key, or NULL at the end, with *value NULL if there's no '=' */
+char *sink_option_next(char **options, char **value)
+{
+    char *key;
+
+    do
+    {
+        key = strsep(options, ",");
+    } while(key != NULL && key[0] == '\0');
+
+    if(key == NULL)
+    {
+        return NULL;
+    }
+
+    *value = strchr(key, '=');
+    if(*value != NULL)
+    {
+        **value = '\0';
+        (*value)++;
+    }
+
+    return key;
+}
+
+void sink_day_init(sink_day_t *day)
+{
+    memset(day, 0, sizeof(sink_day_t));
+    day->timestamp = -1;
+}
+
+/* Date of a GNSS timestamp as it appears in filenames, eg. 20210405. localtime_r() is only called once per second */
+int sink_day(sink_day_t *day, time_t timestamp)
+{
+    if(timestamp != day->timestamp)
+    {
+        localtime_r(&timestamp, &day->tm);
+        day->timestamp = timestamp;
+        day->day = (day->tm.tm_year + 1900) * 10000 + (day->tm.tm_mon + 1) * 100 + day->tm.tm_mday;
+    }
+
+    return day->day;
+}
+
+/* Whole seconds at 1 Hz, as always, milliseconds are only added when there's more than one datapoint per second */
+void sink_format_timestamp(const sink_t *sink, const jammon_datapoint_t *datapoint, char *timestamp, size_t timestamp_size)
+{
+    if(sink->context->rate_hz > 1)
+    {
+        snprintf(timestamp, timestamp_size, "%"PRIu64".%03"PRIu16, datapoint->gnss_timestamp, datapoint->gnss_timestamp_ms);
+    }
+    else
+    {
+        snprintf(timestamp, timestamp_size, "%"PRIu64, datapoint->gnss_timestamp);
+    }
+}
+
+/* eg. "log-jammon-2021-04-05.csv", or "log-jammon-<id>-2021-04-05.csv" for a named receiver */
+void sink_filename_format(const sink_t *sink, char *filename, size_t filename_size, const char *prefix, const struct tm *tm, const char *extension)
+{
+    int len;
+
+    if(sink->context->id[0] != '\0')
+    {
+        len = snprintf(filename, filename_size, "%s-jammon-%s-", prefix, sink->context->id);
+    }
+    else
+    {
+        len = snprintf(filename, filename_size, "%s-jammon-", prefix);
+    }
+
+    if(len < 0 || (size_t)len >= filename_size)
+    {
+        filename[0] = '\0';
+        return;
+    }
+
+    len += strftime(&filename[len], filename_size - len, "%Y-%m-%d", tm);
+    snprintf(&filename[len], filename_size - len, ".%s", extension);
+}
+
+static void sink_write(sink_t *sink, sink_item_t **batch, uint32_t count)
+{
+    const jammon_datapoint_t *datapoints[SINK_BATCH_MAX];
+    uint64_t start_us, write_us, now_ms, latency_ms;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        datapoints[i] = &batch[i]->datapoint;
+    }
+
+    start_us = monotonic_us();
+    if(sink->ops->write_batch(sink, datapoints, count) != 0)
+    {
+        sink->errors++;
+    }
+    write_us = monotonic_us() - start_us;
+    now_ms = monotonic_ms();
+
+    sink->batches++;
+    sink->items += count;
+    sink->write_us_total += write_us;
+    if(write_us > sink->write_us_max)
+    {
+        sink->write_us_max = write_us;
+    }
+    if(sink->first_write_monotonic_ms == 0)
+    {
+        sink->first_write_monotonic_ms = now_ms;
+    }
+    sink->last_write_monotonic_ms = now_ms;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        latency_ms = now_ms - batch[i]->queued_monotonic_ms;
+        sink->latency_ms_total += latency_ms;
+        if(latency_ms > sink->latency_ms_max)
+        {
+            sink->latency_ms_max = latency_ms;
+        }
+
+        /* Last use of the item by this sink, it may be reused as soon as this lands */
+        atomic_fetch_sub_explicit(&batch[i]->refs, 1, memory_order_release);
+    }
+}
+
+static void sink_flush(sink_t *sink)
+{
+    if(sink->ops->flush != NULL && sink->ops->flush(sink) != 0)
+    {
+        sink->errors++;
+    }
+}
+
+static void *sink_thread(void *arg)
+{
+    sink_t *sink = (sink_t *)arg;
+    sink_item_t *batch[SINK_BATCH_MAX];
+    sink_item_t **slot;
+    uint32_t count;
+    struct pollfd pfd[2] = {
+        { .fd = sink->event_fd, .events = POLLIN },
+        { .fd = sink->poll_fd, .events = POLLIN }
+    };
+    eventfd_t value;
+    bool dirty = false;
+    bool stopping = false;
+    uint64_t flushed_monotonic_ms = monotonic_ms();
+    uint64_t now_ms;
+    int timeout_ms;
+
+    while(true)
+    {
+        count = 0;
+        while(count < SINK_BATCH_MAX && (slot = ring_peek(&sink->queue)) != NULL)
+        {
+            batch[count++] = *slot;
+            ring_release(&sink->queue);
+        }
+
+        if(count > 0)
+        {
+            sink_write(sink, batch, count);
+            dirty = true;
+            continue;
+        }
+
+        /* Queue is empty */
+        now_ms = monotonic_ms();
+        if(dirty && (sink->flush_interval_ms == 0 || flushed_monotonic_ms + sink->flush_interval_ms <= now_ms))
+        {
+            sink_flush(sink);
+            dirty = false;
+            flushed_monotonic_ms = now_ms;
+        }
+
+        /* Set once the producer has exited, so the queue is complete once it's seen */
+        if(stopping)
+        {
+            break;
+        }
+        stopping = atomic_load(&sink->stop);
+        if(stopping)
+        {
+            continue;
+        }
+
+        timeout_ms = -1;
+        if(dirty)
+        {
+            timeout_ms = (int)(flushed_monotonic_ms + sink->flush_interval_ms - now_ms);
+        }
+
+        if(poll(pfd, (sink->poll_fd >= 0) ? 2 : 1, timeout_ms) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "[%s] Error: Sink %s wakeup: %s\n", sink->context->label, sink->ops->name, strerror(errno));
+            break;
+        }
+        if(pfd[0].revents & POLLIN)
+        {
+            eventfd_read(sink->event_fd, &value);
+        }
+        if(pfd[1].revents & POLLIN)
+        {
+            sink->ops->poll(sink);
+        }
+    }
+
+    if(dirty)
+    {
+        sink_flush(sink);
+    }
+
+    return NULL;
+}
+
+void output_init(output_t *output, const sink_context_t *context)
+{
+    memset(output, 0, sizeof(output_t));
+    output->context = context;
+}
+
+int output_add_sink(output_t *output, const char *spec)
+{
+    const sink_ops_t *ops = sink_find(spec);
+    const char *options = strchr(spec, ':');
+    sink_t *sink;
+
+    if(ops == NULL)
+    {
+        fprintf(stderr, "Error: Unknown output sink '%s'\n", spec);
+        return -1;
+    }
+
+    if(output->sinks_count >= SINK_MAX)
+    {
+        fprintf(stderr, "Error: Too many output sinks, maximum is %d\n", SINK_MAX);
+        return -1;
+    }
+
+    sink = &output->sinks[output->sinks_count];
+    memset(sink, 0, sizeof(sink_t));
+    sink->ops = ops;
+    sink->context = output->context;
+    sink->options = (options != NULL) ? strdup(options + 1) : NULL;
+    sink->event_fd = -1;
+    sink->poll_fd = -1;
+
+    output->sinks_count++;
+
+    return 0;
+}
+
+int output_start(output_t *output)
+{
+    sink_t *sink;
+
+    output->pool = calloc(SINK_POOL_LENGTH, sizeof(sink_item_t));
+    if(output->pool == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to allocate output pool\n", output->context->label);
+        return -1;
+    }
+    for(uint32_t i = 0; i < SINK_POOL_LENGTH; i++)
+    {
+        atomic_init(&output->pool[i].refs, 0);
+    }
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+
+        if(sink->ops->init(sink, sink->options) != 0)
+        {
+            return -1;
+        }
+        sink->inited = true;
+
+        if(ring_init(&sink->queue, sizeof(sink_item_t *), SINK_QUEUE_LENGTH) != 0)
+        {
+            return -1;
+        }
+
+        sink->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(sink->event_fd < 0)
+        {
+            fprintf(stderr, "[%s] Error: eventfd: %s\n", output->context->label, strerror(errno));
+            return -1;
+        }
+
+        atomic_init(&sink->stop, false);
+        if(pthread_create(&sink->thread, NULL, sink_thread, sink) != 0)
+        {
+            fprintf(stderr, "[%s] Error: Unable to start %s sink thread\n", output->context->label, sink->ops->name);
+            return -1;
+        }
+        sink->thread_running = true;
+    }
+
+    return 0;
+}
+
+/* Producer side, from the receiver's thread only */
+static sink_item_t *output_pool_get(output_t *output)
+{
+    sink_item_t *item;
+
+    for(uint32_t i = 0; i < SINK_POOL_LENGTH; i++)
+    {
+        item = &output->pool[(output->pool_next + i) % SINK_POOL_LENGTH];
+        if(atomic_load_explicit(&item->refs, memory_order_acquire) == 0)
+        {
+            output->pool_next = (output->pool_next + i + 1) % SINK_POOL_LENGTH;
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+/* Copied once, then queued by reference to every sink. With wait set (eg. replay), blocks rather than dropping */
+void output_publish(output_t *output, const jammon_datapoint_t *datapoint, bool wait)
+{
+    sink_item_t *item;
+    sink_t *sink;
+
+    if(output->sinks_count == 0)
+    {
+        return;
+    }
+
+    while((item = output_pool_get(output)) == NULL)
+    {
+        if(!wait || app_exit)
+        {
+            output->pool_exhausted++;
+            return;
+        }
+        sleep_ms(1);
+    }
+
+    memcpy(&item->datapoint, datapoint, sizeof(jammon_datapoint_t));
+    item->queued_monotonic_ms = monotonic_ms();
+
+    /* All references are taken before the first push, so an early release can't free it under the others */
+    atomic_store_explicit(&item->refs, output->sinks_count, memory_order_relaxed);
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+
+        while(wait && ring_full(&sink->queue) && !app_exit)
+        {
+            sleep_ms(1);
+        }
+
+        if(ring_push(&sink->queue, &item))
+        {
+            eventfd_write(sink->event_fd, 1);
+        }
+        else
+        {
+            atomic_fetch_sub_explicit(&item->refs, 1, memory_order_relaxed);
+        }
+    }
+}
+
+/* Warn of datapoints dropped since the last check */
+void output_check_drops(output_t *output)
+{
+    sink_t *sink;
+
+    if(output->pool_exhausted != output->pool_exhausted_reported)
+    {
+        fprintf(stderr, "[%s] Warning: All output sinks backed up, %"PRIu64" datapoints dropped\n", output->context->label,
+            output->pool_exhausted - output->pool_exhausted_reported);
+        output->pool_exhausted_reported = output->pool_exhausted;
+    }
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+        if(sink->queue.dropped != sink->dropped_reported)
+        {
+            fprintf(stderr, "[%s] Warning: Sink %s queue full, %"PRIu64" datapoints dropped\n", output->context->label,
+                sink->ops->name, sink->queue.dropped - sink->dropped_reported);
+            sink->dropped_reported = sink->queue.dropped;
+        }
+    }
+}
+
+/* Queued datapoints are written before returning. Also closes the sinks output_start() left initialised when it failed */
+void output_stop(output_t *output)
+{
+    sink_t *sink;
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+        if(sink->thread_running)
+        {
+            atomic_store(&sink->stop, true);
+            eventfd_write(sink->event_fd, 1);
+        }
+    }
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+        if(sink->thread_running)
+        {
+            pthread_join(sink->thread, NULL);
+            sink->thread_running = false;
+        }
+        if(sink->inited)
+        {
+            sink->ops->close(sink);
+            sink->inited = false;
+        }
+    }
+}
+
+void output_print_stats(output_t *output, FILE *stream)
+{
+    sink_t *sink;
+    uint64_t span_ms;
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+        span_ms = sink->last_write_monotonic_ms - sink->first_write_monotonic_ms;
+
+        fprintf(stream, "[%s] Sink %s: %"PRIu64" written in %"PRIu64" batches (%"PRIu64" errors), %"PRIu64" dropped (queue full),"
+            " write mean %.0f us, max %"PRIu64" us, latency mean %.1f ms, max %"PRIu64" ms, %.1f/s (capacity %.0f/s)\n",
+            output->context->label, sink->ops->name,
+            sink->items, sink->batches, sink->errors, sink->queue.dropped,
+            sink->batches > 0 ? (double)sink->write_us_total / sink->batches : 0.0,
+            sink->write_us_max,
+            sink->items > 0 ? (double)sink->latency_ms_total / sink->items : 0.0,
+            sink->latency_ms_max,
+            span_ms > 0 ? (double)(sink->items - 1) * 1000 / span_ms : 0.0,
+            sink->write_us_total > 0 ? (double)sink->items * 1000000 / sink->write_us_total : 0.0
+        );
+    }
+
+    if(output->pool_exhausted > 0)
+    {
+        fprintf(stream, "[%s] Output: %"PRIu64" datapoints dropped for all sinks (pool exhausted)\n", output->context->label, output->pool_exhausted);
+    }
+}
+
+void output_free(output_t *output)
+{
+    sink_t *sink;
+
+    for(uint32_t i = 0; i < output->sinks_count; i++)
+    {
+        sink = &output->sinks[i];
+        ring_free(&sink->queue);
+        if(sink->event_fd >= 0)
+        {
+            close(sink->event_fd);
+            sink->event_fd = -1;
+        }
+        free(sink->options);
+        sink->options = NULL;
+    }
+    output->sinks_count = 0;
+
+    free(output->pool);
+    output->pool = NULL;
+}
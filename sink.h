@@ -0,0 +1,114 @@
+#ifndef __SINK_H__
+#define __SINK_H__
+
+/* Output sinks, selected with -o <name>[:<options>].
+ *  Each datapoint is copied once into a reference-counted pool slot and a pointer to it is queued to every sink.
+ *  Every sink has its own queue and worker thread, so a slow sink only delays (and eventually drops) its own output. */
+
+#define SINK_MAX            8
+#define SINK_QUEUE_LENGTH   64 /* Per sink, power of 2 */
+#define SINK_POOL_LENGTH    128 /* Datapoints in flight across all sinks of a receiver, ~1 KB each */
+#define SINK_BATCH_MAX      16
+#define UDP_HOSTS_MAX       8 /* -H destinations */
+
+/* Shared by the sinks of a receiver, owned by the receiver */
+typedef struct {
+    const char *label; /* For messages */
+    const char *id; /* Receiver id, empty for a lone un-named receiver */
+    bool verbose;
+    uint8_t rate_hz;
+    const char *const *udp_hosts;
+    uint32_t udp_hosts_count;
+    uint16_t udp_port; /* Unless given with the host */
+} sink_context_t;
+
+typedef struct sink_s sink_t;
+
+/* For sinks that write daily files */
+typedef struct {
+    time_t timestamp;
+    int day;
+    struct tm tm;
+} sink_day_t;
+
+/* init() and close() are called from the receiver's thread before the worker starts and after it has exited,
+ *  write_batch(), flush() and poll() from the worker. write_batch() and flush() return 0 on success. */
+typedef struct {
+    const char *name;
+    int (*init)(sink_t *sink, char *options); /* options may be modified in place, NULL if none */
+    int (*write_batch)(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count);
+    int (*flush)(sink_t *sink); /* Optional */
+    void (*poll)(sink_t *sink); /* Optional, when poll_fd is readable, eg. to reap I/O completions */
+    void (*close)(sink_t *sink);
+} sink_ops_t;
+
+extern const sink_ops_t sink_csv_ops;
+extern const sink_ops_t sink_udp_ops;
+extern const sink_ops_t sink_print_ops;
+extern const sink_ops_t sink_spectrum_ops;
+extern const sink_ops_t sink_archive_ops;
+extern const sink_ops_t sink_rollup_ops;
+
+typedef struct {
+    jammon_datapoint_t datapoint;
+    atomic_uint refs; /* Sinks yet to finish with it, free at 0 */
+    uint64_t queued_monotonic_ms;
+} sink_item_t;
+
+struct sink_s {
+    const sink_ops_t *ops;
+    const sink_context_t *context;
+    char *options; /* Owned, NULL if none */
+    void *state; /* Sink-private, from init() */
+    bool inited; /* init() succeeded, so close() is owed even if the worker never started */
+    uint32_t flush_interval_ms; /* Set by init(), 0 to flush whenever the queue empties */
+    int poll_fd; /* Set by init() to have the worker also wait on it, -1 if not */
+
+    ring_t queue; /* Of sink_item_t * */
+    int event_fd;
+    pthread_t thread;
+    bool thread_running;
+    atomic_bool stop;
+
+    /* Statistics, written by the worker */
+    uint64_t items;
+    uint64_t batches;
+    uint64_t errors;
+    uint64_t write_us_total;
+    uint64_t write_us_max;
+    uint64_t latency_ms_total; /* Queued to written */
+    uint64_t latency_ms_max;
+    uint64_t first_write_monotonic_ms;
+    uint64_t last_write_monotonic_ms;
+
+    uint64_t dropped_reported;
+};
+
+typedef struct {
+    const sink_context_t *context;
+    sink_t sinks[SINK_MAX];
+    uint32_t sinks_count;
+
+    sink_item_t *pool;
+    uint32_t pool_next;
+    uint64_t pool_exhausted; /* Datapoints dropped for every sink */
+    uint64_t pool_exhausted_reported;
+} output_t;
+
+bool sink_spec_valid(const char *spec);
+char *sink_option_next(char **options, char **value);
+void sink_day_init(sink_day_t *day);
+int sink_day(sink_day_t *day, time_t timestamp);
+void sink_filename_format(const sink_t *sink, char *filename, size_t filename_size, const char *prefix, const struct tm *tm, const char *extension);
+void sink_format_timestamp(const sink_t *sink, const jammon_datapoint_t *datapoint, char *timestamp, size_t timestamp_size);
+
+void output_init(output_t *output, const sink_context_t *context);
+int output_add_sink(output_t *output, const char *spec);
+int output_start(output_t *output);
+void output_publish(output_t *output, const jammon_datapoint_t *datapoint, bool wait);
+void output_check_drops(output_t *output);
+void output_stop(output_t *output);
+void output_print_stats(output_t *output, FILE *stream);
+void output_free(output_t *output);
+
+#endif /* __SINK_H__ */
@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+#include "journal.h"
+#include "aio.h"
+
+/* Daily log, spectruml1 and (multiband) spectruml2 CSV files in the working directory.
+ *  Files are held open and buffered, and only re-opened when the GNSS date rolls over.
+ *  Options: flush=<ms> (default 1000) to write out buffered lines, fsync=<ms> (default 0, only on rotation and close),
+ *  journal[=<ms>] for power-cut safe ".jnl" files instead, see journal.h, each line a record and group committed
+ *  (written and fdatasync'd) every <ms> (default 1000). "jammon-tool jnl2csv" turns them back into CSV.
+ *  aio[=threads] (implies journal) commits asynchronously through io_uring, or a thread pool, reaping completions
+ *  in the sink's worker loop, so a slow SD card stalls neither it nor the receiver */
+
+#define CSV_LOG             0
+#define CSV_SPECTRUM_L1     1
+#define CSV_SPECTRUM_L2     2
+#define CSV_FILES           3
+
+#define CSV_BUFFER_SIZE             (64 * 1024)
+#define CSV_FLUSH_INTERVAL_DEFAULT  1000
+#define CSV_COMMIT_INTERVAL_DEFAULT 1000
+
+static const char *const csv_prefixes[CSV_FILES] = {
+    "log",
+    "spectruml1",
+    "spectruml2"
+};
+
+typedef struct {
+    FILE *fptr;
+    journal_t journal; /* Instead of fptr, in journal mode */
+    int day; /* Of the open file, as in its filename, eg. 20210405 */
+    bool written; /* Since the last fsync */
+
+    /* Asynchronous journal commits */
+    aio_t *aio;
+    bool commit_sync; /* Of the one in flight */
+    uint64_t commit_monotonic_us;
+    bool commit_again; /* Requested while one was in flight */
+} csv_file_t;
+
+typedef struct {
+    csv_file_t files[CSV_FILES];
+    bool journal;
+    journal_stats_t journal_stats; /* Of closed journals */
+    aio_t *aio;
+    uint32_t fsync_interval_ms;
+    uint64_t synced_monotonic_ms;
+
+    sink_day_t day;
+
+    /* Formatting, nothing is allocated per datapoint */
+    char line[1024];
+    char hex[256][2];
+    time_t ctime_timestamp;
+    char ctime_buffer[26];
+
+    uint64_t rotations;
+    uint64_t fsyncs;
+} csv_state_t;
+
+static int csv_commit_async(csv_file_t *file);
+
+static void csv_commit_done(void *context, int result)
+{
+    csv_file_t *file = (csv_file_t *)context;
+
+    journal_commit_end(&file->journal, result, file->commit_sync, monotonic_us() - file->commit_monotonic_us);
+
+    if(file->commit_again)
+    {
+        file->commit_again = false;
+        csv_commit_async(file);
+    }
+}
+
+/* One commit per journal in flight, so its writes land in order */
+static int csv_commit_async(csv_file_t *file)
+{
+    const uint8_t *data;
+    uint32_t length;
+    uint64_t offset;
+
+    if(file->journal.in_flight)
+    {
+        file->commit_again = true;
+        return 0;
+    }
+
+    if(!journal_commit_begin(&file->journal, true, &data, &length, &offset))
+    {
+        return 0;
+    }
+
+    file->commit_sync = true;
+    file->commit_monotonic_us = monotonic_us();
+    if(aio_write(file->aio, file->journal.fd, data, length, offset, true, csv_commit_done, file) != 0)
+    {
+        journal_commit_end(&file->journal, -EAGAIN, true, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Blocking, for rotation and close */
+static void csv_commit_wait(csv_file_t *file)
+{
+    while(file->journal.in_flight || file->commit_again)
+    {
+        if(!file->journal.in_flight)
+        {
+            file->commit_again = false;
+            csv_commit_async(file);
+            continue;
+        }
+        aio_wait(file->aio);
+    }
+}
+
+static int csv_file_sync(csv_file_t *file)
+{
+    int result = 0;
+
+    if(file->journal.fd >= 0)
+    {
+        if(file->journal.async)
+        {
+            return csv_commit_async(file);
+        }
+        return journal_commit(&file->journal, true);
+    }
+
+    if(file->fptr == NULL)
+    {
+        return 0;
+    }
+
+    if(fflush(file->fptr) != 0)
+    {
+        result = -1;
+    }
+
+    if(file->written)
+    {
+        if(fsync(fileno(file->fptr)) != 0)
+        {
+            result = -1;
+        }
+        file->written = false;
+    }
+
+    return result;
+}
+
+static void csv_file_close(csv_state_t *state, csv_file_t *file)
+{
+    if(file->journal.fd >= 0)
+    {
+        if(file->journal.async)
+        {
+            csv_commit_wait(file);
+        }
+        journal_close(&file->journal);
+        journal_stats_add(&state->journal_stats, &file->journal.stats);
+        return;
+    }
+
+    if(file->fptr == NULL)
+    {
+        return;
+    }
+
+    csv_file_sync(file);
+    fclose(file->fptr);
+    file->fptr = NULL;
+}
+
+static int csv_file_write(sink_t *sink, uint32_t index, time_t gnss_time, const char *line, int length)
+{
+    csv_state_t *state = (csv_state_t *)sink->state;
+    csv_file_t *file = &state->files[index];
+    char csv_filename[64];
+
+    int day = sink_day(&state->day, gnss_time);
+
+    if((file->fptr != NULL || file->journal.fd >= 0) && file->day != day)
+    {
+        /* GNSS date has rolled over */
+        csv_file_close(state, file);
+        state->rotations++;
+    }
+
+    if(state->journal)
+    {
+        if(file->journal.fd < 0)
+        {
+            sink_filename_format(sink, csv_filename, sizeof(csv_filename), csv_prefixes[index], &state->day.tm, "jnl");
+            if(journal_open(&file->journal, csv_filename) != 0)
+            {
+                return -1;
+            }
+            file->journal.async = (state->aio != NULL);
+            file->aio = state->aio;
+            file->day = day;
+        }
+
+        /* The buffer can only fill between commits when the card can't keep up, that then blocks */
+        while(journal_append(&file->journal, line, length) != 0)
+        {
+            if(!file->journal.async || errno != EAGAIN)
+            {
+                return -1;
+            }
+            if(file->journal.in_flight)
+            {
+                aio_wait(state->aio);
+            }
+            else if(csv_commit_async(file) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    if(file->fptr == NULL)
+    {
+        sink_filename_format(sink, csv_filename, sizeof(csv_filename), csv_prefixes[index], &state->day.tm, "csv");
+
+        file->fptr = fopen(csv_filename, "a+");
+        if(file->fptr == NULL)
+        {
+            fprintf(stderr, "[%s] Error: Unable to open CSV file %s: %s\n", sink->context->label, csv_filename, strerror(errno));
+            return -1;
+        }
+        setvbuf(file->fptr, NULL, _IOFBF, CSV_BUFFER_SIZE);
+        file->day = day;
+    }
+
+    if(fwrite(line, 1, length, file->fptr) != (size_t)length)
+    {
+        return -1;
+    }
+    file->written = true;
+
+    return 0;
+}
+
+/* "<timestamp>,<span>,<res>,<center>,<pga>,"<hex spectrum>"" */
+static int csv_format_spectrum(csv_state_t *state, const char *timestamp,
+    uint32_t span, uint32_t res, uint32_t center, uint8_t pga, const uint8_t *spectrum)
+{
+    char *line = state->line;
+    int len;
+
+    len = snprintf(line, sizeof(state->line), "%s,%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu8",\"", timestamp, span, res, center, pga);
+    if(len < 0 || (size_t)len + (2*256) + 3 > sizeof(state->line))
+    {
+        return -1;
+    }
+
+    for(int i = 0; i < 256; i++)
+    {
+        memcpy(&line[len], state->hex[spectrum[i]], 2);
+        len += 2;
+    }
+    line[len++] = '"';
+    line[len++] = '\n';
+
+    return len;
+}
+
+static int csv_write(sink_t *sink, const jammon_datapoint_t *jammon_datapoint)
+{
+    csv_state_t *state = (csv_state_t *)sink->state;
+    char timestamp[32];
+    time_t gnss_time = (time_t)jammon_datapoint->gnss_timestamp;
+    int len;
+    int result = 0;
+
+    if(!jammon_datapoint->time_valid)
+    {
+        return 0;
+    }
+
+    if(gnss_time != state->ctime_timestamp)
+    {
+        ctime_r(&gnss_time, state->ctime_buffer);
+        state->ctime_timestamp = gnss_time;
+    }
+    sink_format_timestamp(sink, jammon_datapoint, timestamp, sizeof(timestamp));
+
+    len = snprintf(state->line, sizeof(state->line), "%s,%.24s,%.5f,%.5f,%.1f,%.1f,%.1f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+        timestamp, state->ctime_buffer,
+        (jammon_datapoint->lat / 1.0e7), (jammon_datapoint->lon / 1.0e7), (jammon_datapoint->alt / 1.0e3),
+        jammon_datapoint->h_acc / 1.0e3, jammon_datapoint->v_acc / 1.0e3,
+        jammon_datapoint->svs_acquired_l1, jammon_datapoint->svs_acquired_l2, jammon_datapoint->svs_locked_l1, jammon_datapoint->svs_locked_l2, jammon_datapoint->svs_nav,
+        jammon_datapoint->agc, jammon_datapoint->noise, jammon_datapoint->jam_cw, jammon_datapoint->jam_bb,
+        jammon_datapoint->agc2, jammon_datapoint->noise2, jammon_datapoint->jam_cw2, jammon_datapoint->jam_bb2
+    );
+    if(len < 0 || (size_t)len >= sizeof(state->line) || csv_file_write(sink, CSV_LOG, gnss_time, state->line, len) != 0)
+    {
+        result = -1;
+    }
+
+    len = csv_format_spectrum(state, timestamp,
+        jammon_datapoint->span, jammon_datapoint->res, jammon_datapoint->center, jammon_datapoint->pga,
+        jammon_datapoint->spectrum);
+    if(len < 0 || csv_file_write(sink, CSV_SPECTRUM_L1, gnss_time, state->line, len) != 0)
+    {
+        result = -1;
+    }
+
+    if(jammon_datapoint->multiband)
+    {
+        len = csv_format_spectrum(state, timestamp,
+            jammon_datapoint->span2, jammon_datapoint->res2, jammon_datapoint->center2, jammon_datapoint->pga2,
+            jammon_datapoint->spectrum2);
+        if(len < 0 || csv_file_write(sink, CSV_SPECTRUM_L2, gnss_time, state->line, len) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static int csv_init(sink_t *sink, char *options)
+{
+    csv_state_t *state;
+    char *key, *value;
+
+    state = calloc(1, sizeof(csv_state_t));
+    if(state == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to allocate CSV sink\n", sink->context->label);
+        return -1;
+    }
+    sink_day_init(&state->day);
+    state->ctime_timestamp = -1;
+    for(int i = 0; i < 256; i++)
+    {
+        state->hex[i][0] = "0123456789abcdef"[i >> 4];
+        state->hex[i][1] = "0123456789abcdef"[i & 0x0f];
+    }
+    state->synced_monotonic_ms = monotonic_ms();
+    for(uint32_t i = 0; i < CSV_FILES; i++)
+    {
+        state->files[i].journal.fd = -1;
+    }
+
+    sink->state = state;
+    sink->flush_interval_ms = CSV_FLUSH_INTERVAL_DEFAULT;
+
+    while((key = sink_option_next(&options, &value)) != NULL)
+    {
+        if(strcmp(key, "flush") == 0 && value != NULL)
+        {
+            sink->flush_interval_ms = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "fsync") == 0 && value != NULL)
+        {
+            state->fsync_interval_ms = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "journal") == 0)
+        {
+            state->journal = true;
+            sink->flush_interval_ms = (value != NULL) ? strtoul(value, NULL, 10) : CSV_COMMIT_INTERVAL_DEFAULT;
+        }
+        else if(strcmp(key, "aio") == 0 && (value == NULL || strcmp(value, "threads") == 0))
+        {
+            if(!state->journal)
+            {
+                state->journal = true;
+                sink->flush_interval_ms = CSV_COMMIT_INTERVAL_DEFAULT;
+            }
+            if(state->aio == NULL)
+            {
+                state->aio = aio_create(value != NULL);
+                if(state->aio == NULL)
+                {
+                    fprintf(stderr, "[%s] Error: Unable to start asynchronous I/O\n", sink->context->label);
+                    free(state);
+                    sink->state = NULL;
+                    return -1;
+                }
+                sink->poll_fd = aio_event_fd(state->aio);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown csv sink option '%s'\n", key);
+            aio_destroy(state->aio);
+            free(state);
+            sink->state = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int csv_write_batch(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    int result = 0;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(csv_write(sink, datapoints[i]) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/* Buffered lines are written out every flush interval, and made durable every fsync interval. Journals commit every flush */
+static int csv_flush(sink_t *sink)
+{
+    csv_state_t *state = (csv_state_t *)sink->state;
+    uint64_t now_ms = monotonic_ms();
+    bool sync = (state->fsync_interval_ms > 0 && state->synced_monotonic_ms + state->fsync_interval_ms <= now_ms);
+    int result = 0;
+
+    if(state->journal)
+    {
+        for(uint32_t i = 0; i < CSV_FILES; i++)
+        {
+            if(csv_file_sync(&state->files[i]) != 0)
+            {
+                result = -1;
+            }
+        }
+
+        if(result != 0)
+        {
+            fprintf(stderr, "[%s] Error: Committing CSV journals: %s\n", sink->context->label, strerror(errno));
+        }
+        return result;
+    }
+
+    for(uint32_t i = 0; i < CSV_FILES; i++)
+    {
+        if(state->files[i].fptr == NULL)
+        {
+            continue;
+        }
+
+        if(sync)
+        {
+            if(csv_file_sync(&state->files[i]) != 0)
+            {
+                result = -1;
+            }
+        }
+        else if(fflush(state->files[i].fptr) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    if(sync)
+    {
+        state->synced_monotonic_ms = now_ms;
+        state->fsyncs++;
+    }
+
+    if(result != 0)
+    {
+        fprintf(stderr, "[%s] Error: Writing CSV files: %s\n", sink->context->label, strerror(errno));
+    }
+
+    return result;
+}
+
+static void csv_poll(sink_t *sink)
+{
+    csv_state_t *state = (csv_state_t *)sink->state;
+
+    aio_reap(state->aio);
+}
+
+/* Also reached on SIGINT/SIGTERM, once the queue has been written */
+static void csv_close(sink_t *sink)
+{
+    csv_state_t *state = (csv_state_t *)sink->state;
+
+    if(state == NULL)
+    {
+        return;
+    }
+
+    for(uint32_t i = 0; i < CSV_FILES; i++)
+    {
+        csv_file_close(state, &state->files[i]);
+    }
+
+    if(sink->context->verbose)
+    {
+        printf("[%s] CSV: %"PRIu64" day rotations, %"PRIu64" periodic fsyncs\n", sink->context->label, state->rotations, state->fsyncs);
+    }
+
+    if(sink->context->verbose && state->journal)
+    {
+        journal_stats_t *stats = &state->journal_stats;
+
+        printf("[%s] CSV journal: %"PRIu64" records in %"PRIu64" commits (%.1f per commit, %"PRIu64" bytes), %"PRIu64" syncs mean %"PRIu64" us max %"PRIu64" us, "
+            "%"PRIu64" pages written (%.2fx write amplification), %"PRIu64" torn bytes recovered, %"PRIu64" errors\n",
+            sink->context->label, stats->records, stats->commits, stats->commits > 0 ? (double)stats->records / stats->commits : 0.0, stats->bytes,
+            stats->syncs, stats->syncs > 0 ? stats->sync_us_total / stats->syncs : 0, stats->sync_us_max,
+            stats->pages, stats->bytes > 0 ? (double)(stats->pages * JOURNAL_PAGE_SIZE) / stats->bytes : 0.0,
+            stats->recovered_bytes, stats->errors);
+    }
+
+    if(sink->context->verbose && state->aio != NULL)
+    {
+        aio_print_stats(state->aio, sink->context->label);
+    }
+    aio_destroy(state->aio);
+
+    free(state);
+    sink->state = NULL;
+}
+
+const sink_ops_t sink_csv_ops = {
+    .name = "csv",
+    .init = csv_init,
+    .write_batch = csv_write_batch,
+    .flush = csv_flush,
+    .poll = csv_poll,
+    .close = csv_close
+};
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+
+/* Human-readable datapoints on stdout, added by -v */
+
+static int print_init(sink_t *sink, char *options)
+{
+    (void)sink;
+    (void)options;
+
+    return 0;
+}
+
+static int print_write_batch(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    const jammon_datapoint_t *jammon_datapoint;
+    char ctime_buffer[26];
+    char timestamp[32];
+    time_t gnss_time;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        jammon_datapoint = datapoints[i];
+        gnss_time = (time_t)jammon_datapoint->gnss_timestamp;
+
+        ctime_r(&gnss_time, ctime_buffer);
+        sink_format_timestamp(sink, jammon_datapoint, timestamp, sizeof(timestamp));
+
+        printf("Datapoint: %s\n", jammon_datapoint->receiver_id);
+        printf(" - Timestamp: %s - %.24s\n", timestamp, ctime_buffer);
+        printf(" - Position: %d, %d, %d\n", jammon_datapoint->lat, jammon_datapoint->lon, jammon_datapoint->alt);
+        printf(" - Accuracy: H: %.1fm, V: %.1fm\n", jammon_datapoint->h_acc / 1.0e3, jammon_datapoint->v_acc / 1.0e3);
+        printf(" - SVs: Acquired: (%d|%d), Locked: (%d|%d), Used in Nav: %d\n", jammon_datapoint->svs_acquired_l1, jammon_datapoint->svs_acquired_l2, jammon_datapoint->svs_locked_l1, jammon_datapoint->svs_locked_l2, jammon_datapoint->svs_nav);
+        printf(" - AGC: %d|%d, Noise: %d|%d\n", jammon_datapoint->agc, jammon_datapoint->agc2, jammon_datapoint->noise, jammon_datapoint->noise2);
+        printf(" - L1 Jamming: CW: %d / 255, Broadband: %d / 3 (0 = invalid)\n", jammon_datapoint->jam_cw, jammon_datapoint->jam_bb);
+        printf(" - L2 Jamming: CW: %d / 255, Broadband: %d / 3 (0 = invalid)\n", jammon_datapoint->jam_cw2, jammon_datapoint->jam_bb2);
+    }
+
+    return 0;
+}
+
+static int print_flush(sink_t *sink)
+{
+    (void)sink;
+
+    return fflush(stdout) == 0 ? 0 : -1;
+}
+
+static void print_close(sink_t *sink)
+{
+    (void)sink;
+}
+
+const sink_ops_t sink_print_ops = {
+    .name = "print",
+    .init = print_init,
+    .write_batch = print_write_batch,
+    .flush = print_flush,
+    .close = print_close
+};
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+
+/* Per-minute and per-hour aggregates, kept alongside (and outliving) the raw logs, as daily CSV files:
+ *  rollup-<minute|hour>-jammon[-<id>]-YYYY-MM-DD.csv:
+ *   <period start>,<datapoints>, then <min>,<max>,<mean> of each of agc, noise, jam_cw, jam_bb, agc2, noise2, jam_cw2, jam_bb2,
+ *   svs_acquired_l1, svs_acquired_l2, svs_locked_l1, svs_locked_l2, svs_nav, h_acc (m)
+ *  spectrumrollup-<minute|hour>-jammon[-<id>]-YYYY-MM-DD.csv, a line per band:
+ *   <period start>,<datapoints>,<band>,<span>,<res>,<center>,<pga>,"<max-hold hex>","<min-hold hex>","<mean hex>"
+ *  Periods are on GNSS time and a period's line is written once the next one starts, or on close.
+ *  Options: retention=<days> (default 0, keep forever) removes raw log, spectrum and archive files of this receiver
+ *   once they are that many days old. Rollups are never removed. */
+
+#define ROLLUP_TIERS        2
+#define ROLLUP_SCALARS      14
+#define ROLLUP_BANDS        2
+#define ROLLUP_LINE_MAX     2048
+
+static const char *const rollup_raw_prefixes[] = {
+    "log",
+    "spectruml1",
+    "spectruml2",
+    "spectrum"
+};
+
+static const char *const rollup_raw_extensions[] = {
+    ".csv",
+    ".jnl",
+    ".bin",
+    ".jma",
+    ".jma.idx"
+};
+
+typedef struct {
+    const char *name;
+    uint32_t seconds;
+    uint64_t start; /* Of the period being aggregated */
+    uint32_t count;
+
+    double min[ROLLUP_SCALARS];
+    double max[ROLLUP_SCALARS];
+    double sum[ROLLUP_SCALARS];
+
+    bool multiband;
+    uint32_t span[ROLLUP_BANDS], res[ROLLUP_BANDS], center[ROLLUP_BANDS];
+    uint8_t pga[ROLLUP_BANDS];
+    uint8_t spectrum_max[ROLLUP_BANDS][256];
+    uint8_t spectrum_min[ROLLUP_BANDS][256];
+    uint32_t spectrum_sum[ROLLUP_BANDS][256];
+} rollup_tier_t;
+
+typedef struct {
+    rollup_tier_t tiers[ROLLUP_TIERS];
+    uint32_t retention_days;
+    int retention_day; /* Last day the raw files were checked */
+
+    sink_day_t day;
+    char line[ROLLUP_LINE_MAX];
+    char hex[256][2];
+
+    uint64_t lines;
+    uint64_t removed;
+} rollup_state_t;
+
+static void rollup_scalars(const jammon_datapoint_t *jammon_datapoint, double *values)
+{
+    values[0] = jammon_datapoint->agc;
+    values[1] = jammon_datapoint->noise;
+    values[2] = jammon_datapoint->jam_cw;
+    values[3] = jammon_datapoint->jam_bb;
+    values[4] = jammon_datapoint->agc2;
+    values[5] = jammon_datapoint->noise2;
+    values[6] = jammon_datapoint->jam_cw2;
+    values[7] = jammon_datapoint->jam_bb2;
+    values[8] = jammon_datapoint->svs_acquired_l1;
+    values[9] = jammon_datapoint->svs_acquired_l2;
+    values[10] = jammon_datapoint->svs_locked_l1;
+    values[11] = jammon_datapoint->svs_locked_l2;
+    values[12] = jammon_datapoint->svs_nav;
+    values[13] = jammon_datapoint->h_acc / 1.0e3;
+}
+
+/* Lines are infrequent, so files are only open while one is appended */
+static int rollup_append(sink_t *sink, const char *prefix, const rollup_tier_t *tier, const char *line, int length)
+{
+    rollup_state_t *state = (rollup_state_t *)sink->state;
+    char prefix_tier[32];
+    char filename[80];
+    FILE *fptr;
+    int result = 0;
+
+    sink_day(&state->day, (time_t)tier->start);
+    snprintf(prefix_tier, sizeof(prefix_tier), "%s-%s", prefix, tier->name);
+    sink_filename_format(sink, filename, sizeof(filename), prefix_tier, &state->day.tm, "csv");
+
+    fptr = fopen(filename, "a");
+    if(fptr == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to open rollup file %s: %s\n", sink->context->label, filename, strerror(errno));
+        return -1;
+    }
+
+    if(fwrite(line, 1, length, fptr) != (size_t)length)
+    {
+        result = -1;
+    }
+    if(fclose(fptr) != 0)
+    {
+        result = -1;
+    }
+
+    state->lines++;
+    return result;
+}
+
+static int rollup_hex(const rollup_state_t *state, char *line, int length, const uint8_t *spectrum)
+{
+    line[length++] = ',';
+    line[length++] = '"';
+    for(int i = 0; i < 256; i++)
+    {
+        memcpy(&line[length], state->hex[spectrum[i]], 2);
+        length += 2;
+    }
+    line[length++] = '"';
+
+    return length;
+}
+
+static int rollup_emit(sink_t *sink, rollup_tier_t *tier)
+{
+    rollup_state_t *state = (rollup_state_t *)sink->state;
+    char *line = state->line;
+    uint8_t mean[256];
+    int length;
+    int result = 0;
+
+    if(tier->count == 0)
+    {
+        return 0;
+    }
+
+    length = snprintf(line, ROLLUP_LINE_MAX, "%"PRIu64",%"PRIu32, tier->start, tier->count);
+    for(int i = 0; i < ROLLUP_SCALARS && length > 0 && length < ROLLUP_LINE_MAX; i++)
+    {
+        length += snprintf(&line[length], ROLLUP_LINE_MAX - length, ",%g,%g,%.2f", tier->min[i], tier->max[i], tier->sum[i] / tier->count);
+    }
+    if(length < 0 || length + 1 >= ROLLUP_LINE_MAX)
+    {
+        return -1;
+    }
+    line[length++] = '\n';
+    if(rollup_append(sink, "rollup", tier, line, length) != 0)
+    {
+        result = -1;
+    }
+
+    for(int b = 0; b < (tier->multiband ? 2 : 1); b++)
+    {
+        for(int i = 0; i < 256; i++)
+        {
+            mean[i] = (tier->spectrum_sum[b][i] + (tier->count / 2)) / tier->count;
+        }
+
+        length = snprintf(line, ROLLUP_LINE_MAX, "%"PRIu64",%"PRIu32",%d,%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu8,
+            tier->start, tier->count, b + 1, tier->span[b], tier->res[b], tier->center[b], tier->pga[b]);
+        if(length < 0 || (size_t)length + (3 * ((2 * 256) + 3)) + 1 > ROLLUP_LINE_MAX)
+        {
+            return -1;
+        }
+        length = rollup_hex(state, line, length, tier->spectrum_max[b]);
+        length = rollup_hex(state, line, length, tier->spectrum_min[b]);
+        length = rollup_hex(state, line, length, mean);
+        line[length++] = '\n';
+        if(rollup_append(sink, "spectrumrollup", tier, line, length) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static void rollup_band(rollup_tier_t *tier, int band, uint32_t span, uint32_t res, uint32_t center, uint8_t pga, const uint8_t *spectrum)
+{
+    tier->span[band] = span;
+    tier->res[band] = res;
+    tier->center[band] = center;
+    tier->pga[band] = pga;
+
+    for(int i = 0; i < 256; i++)
+    {
+        if(tier->count == 1 || spectrum[i] > tier->spectrum_max[band][i])
+        {
+            tier->spectrum_max[band][i] = spectrum[i];
+        }
+        if(tier->count == 1 || spectrum[i] < tier->spectrum_min[band][i])
+        {
+            tier->spectrum_min[band][i] = spectrum[i];
+        }
+        tier->spectrum_sum[band][i] = (tier->count == 1) ? spectrum[i] : tier->spectrum_sum[band][i] + spectrum[i];
+    }
+}
+
+static void rollup_add(rollup_tier_t *tier, const jammon_datapoint_t *jammon_datapoint, const double *values)
+{
+    tier->count++;
+
+    for(int i = 0; i < ROLLUP_SCALARS; i++)
+    {
+        if(tier->count == 1)
+        {
+            tier->min[i] = tier->max[i] = tier->sum[i] = values[i];
+            continue;
+        }
+        if(values[i] < tier->min[i])
+        {
+            tier->min[i] = values[i];
+        }
+        if(values[i] > tier->max[i])
+        {
+            tier->max[i] = values[i];
+        }
+        tier->sum[i] += values[i];
+    }
+
+    rollup_band(tier, 0, jammon_datapoint->span, jammon_datapoint->res, jammon_datapoint->center, jammon_datapoint->pga, jammon_datapoint->spectrum);
+    tier->multiband = jammon_datapoint->multiband;
+    if(jammon_datapoint->multiband)
+    {
+        rollup_band(tier, 1, jammon_datapoint->span2, jammon_datapoint->res2, jammon_datapoint->center2, jammon_datapoint->pga2, jammon_datapoint->spectrum2);
+    }
+}
+
+/* "<raw prefix>-jammon[-<id>]-YYYY-MM-DD<raw extension>" of this receiver, returns the day or 0 */
+static int rollup_raw_day(const sink_t *sink, const char *name)
+{
+    char head[64];
+    int year, month, mday, consumed = 0;
+    size_t head_length;
+
+    for(uint32_t p = 0; p < sizeof(rollup_raw_prefixes) / sizeof(rollup_raw_prefixes[0]); p++)
+    {
+        if(sink->context->id[0] != '\0')
+        {
+            snprintf(head, sizeof(head), "%s-jammon-%s-", rollup_raw_prefixes[p], sink->context->id);
+        }
+        else
+        {
+            snprintf(head, sizeof(head), "%s-jammon-", rollup_raw_prefixes[p]);
+        }
+        head_length = strlen(head);
+
+        if(strncmp(name, head, head_length) != 0
+            || sscanf(&name[head_length], "%4d-%2d-%2d%n", &year, &month, &mday, &consumed) != 3 || consumed != 10)
+        {
+            continue;
+        }
+
+        for(uint32_t e = 0; e < sizeof(rollup_raw_extensions) / sizeof(rollup_raw_extensions[0]); e++)
+        {
+            if(strcmp(&name[head_length + 10], rollup_raw_extensions[e]) == 0)
+            {
+                return (year * 10000) + (month * 100) + mday;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Raw files are named by day, so are removed a whole day at a time */
+static void rollup_retention(sink_t *sink, time_t gnss_time)
+{
+    rollup_state_t *state = (rollup_state_t *)sink->state;
+    struct dirent *entry;
+    DIR *dir;
+    int cutoff, day;
+
+    cutoff = sink_day(&state->day, gnss_time - ((time_t)state->retention_days * 86400));
+
+    dir = opendir(".");
+    if(dir == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to list the working directory: %s\n", sink->context->label, strerror(errno));
+        return;
+    }
+
+    while((entry = readdir(dir)) != NULL)
+    {
+        day = rollup_raw_day(sink, entry->d_name);
+        if(day == 0 || day >= cutoff)
+        {
+            continue;
+        }
+
+        if(unlink(entry->d_name) != 0)
+        {
+            fprintf(stderr, "[%s] Error: Unable to remove %s: %s\n", sink->context->label, entry->d_name, strerror(errno));
+            continue;
+        }
+        state->removed++;
+        if(sink->context->verbose)
+        {
+            printf("[%s] Rollup: removed %s, older than %"PRIu32" days\n", sink->context->label, entry->d_name, state->retention_days);
+        }
+    }
+
+    closedir(dir);
+}
+
+static int rollup_write(sink_t *sink, const jammon_datapoint_t *jammon_datapoint)
+{
+    rollup_state_t *state = (rollup_state_t *)sink->state;
+    double values[ROLLUP_SCALARS];
+    rollup_tier_t *tier;
+    uint64_t start;
+    int day;
+    int result = 0;
+
+    if(!jammon_datapoint->time_valid)
+    {
+        return 0;
+    }
+
+    rollup_scalars(jammon_datapoint, values);
+
+    for(int t = 0; t < ROLLUP_TIERS; t++)
+    {
+        tier = &state->tiers[t];
+        start = jammon_datapoint->gnss_timestamp - (jammon_datapoint->gnss_timestamp % tier->seconds);
+
+        if(tier->count > 0 && tier->start != start)
+        {
+            if(rollup_emit(sink, tier) != 0)
+            {
+                result = -1;
+            }
+            tier->count = 0;
+        }
+
+        tier->start = start;
+        rollup_add(tier, jammon_datapoint, values);
+    }
+
+    if(state->retention_days > 0)
+    {
+        day = sink_day(&state->day, (time_t)jammon_datapoint->gnss_timestamp);
+        if(day != state->retention_day)
+        {
+            rollup_retention(sink, (time_t)jammon_datapoint->gnss_timestamp);
+            state->retention_day = day;
+        }
+    }
+
+    return result;
+}
+
+static int rollup_init(sink_t *sink, char *options)
+{
+    rollup_state_t *state;
+    char *key, *value;
+
+    state = calloc(1, sizeof(rollup_state_t));
+    if(state == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to allocate rollup sink\n", sink->context->label);
+        return -1;
+    }
+    sink_day_init(&state->day);
+    state->tiers[0].name = "minute";
+    state->tiers[0].seconds = 60;
+    state->tiers[1].name = "hour";
+    state->tiers[1].seconds = 3600;
+    for(int i = 0; i < 256; i++)
+    {
+        state->hex[i][0] = "0123456789abcdef"[i >> 4];
+        state->hex[i][1] = "0123456789abcdef"[i & 0x0f];
+    }
+
+    sink->state = state;
+
+    while((key = sink_option_next(&options, &value)) != NULL)
+    {
+        if(strcmp(key, "retention") == 0 && value != NULL)
+        {
+            state->retention_days = strtoul(value, NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown rollup sink option '%s'\n", key);
+            free(state);
+            sink->state = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int rollup_write_batch(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    int result = 0;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(rollup_write(sink, datapoints[i]) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/* The periods in progress are written as they stand, a restart within the same period adds a second line for it */
+static void rollup_close(sink_t *sink)
+{
+    rollup_state_t *state = (rollup_state_t *)sink->state;
+
+    if(state == NULL)
+    {
+        return;
+    }
+
+    for(int t = 0; t < ROLLUP_TIERS; t++)
+    {
+        rollup_emit(sink, &state->tiers[t]);
+    }
+
+    if(sink->context->verbose)
+    {
+        printf("[%s] Rollup: %"PRIu64" lines written, %"PRIu64" raw files removed\n", sink->context->label, state->lines, state->removed);
+    }
+
+    free(state);
+    sink->state = NULL;
+}
+
+const sink_ops_t sink_rollup_ops = {
+    .name = "rollup",
+    .init = rollup_init,
+    .write_batch = rollup_write_batch,
+    .close = rollup_close
+};
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+#include "spectrum.h"
+
+/* Daily binary spectrum log, see spectrum.h, eg. "spectrum-jammon-2021-04-05.bin".
+ *  Options: flush=<ms> (default 1000), fsync=<ms> (default 0, only on rotation and close) */
+
+#define SPECTRUM_FLUSH_INTERVAL_DEFAULT 1000
+
+typedef struct {
+    spectrum_writer_t writer;
+    int day; /* Of the open file */
+    uint32_t fsync_interval_ms;
+    uint64_t synced_monotonic_ms;
+    sink_day_t days;
+    spectrum_record_t record;
+} spectrum_state_t;
+
+static int spectrum_write(sink_t *sink, const jammon_datapoint_t *jammon_datapoint)
+{
+    spectrum_state_t *state = (spectrum_state_t *)sink->state;
+    char filename[64];
+    uint8_t blocks = jammon_datapoint->multiband ? 2 : 1;
+    int day;
+
+    if(!jammon_datapoint->time_valid)
+    {
+        return 0;
+    }
+
+    day = sink_day(&state->days, (time_t)jammon_datapoint->gnss_timestamp);
+    if(state->writer.fptr != NULL && state->day != day)
+    {
+        /* GNSS date has rolled over */
+        spectrum_writer_close(&state->writer);
+    }
+
+    if(state->writer.fptr == NULL)
+    {
+        sink_filename_format(sink, filename, sizeof(filename), "spectrum", &state->days.tm, "bin");
+        if(spectrum_writer_open(&state->writer, filename, blocks, sink->context->rate_hz > 1 ? SPECTRUM_FLAG_SUBSECOND : 0) != 0)
+        {
+            return -1;
+        }
+        state->day = day;
+    }
+
+    state->record.timestamp_ms = (jammon_datapoint->gnss_timestamp * 1000) + jammon_datapoint->gnss_timestamp_ms;
+    spectrum_block_fill(&state->record.block[0], jammon_datapoint->span, jammon_datapoint->res, jammon_datapoint->center, jammon_datapoint->pga, jammon_datapoint->spectrum);
+    if(blocks > 1)
+    {
+        spectrum_block_fill(&state->record.block[1], jammon_datapoint->span2, jammon_datapoint->res2, jammon_datapoint->center2, jammon_datapoint->pga2, jammon_datapoint->spectrum2);
+    }
+
+    return spectrum_writer_append(&state->writer, &state->record);
+}
+
+static int spectrum_init(sink_t *sink, char *options)
+{
+    spectrum_state_t *state;
+    char *key, *value;
+
+    state = calloc(1, sizeof(spectrum_state_t));
+    if(state == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to allocate spectrum sink\n", sink->context->label);
+        return -1;
+    }
+    sink_day_init(&state->days);
+    state->synced_monotonic_ms = monotonic_ms();
+
+    sink->state = state;
+    sink->flush_interval_ms = SPECTRUM_FLUSH_INTERVAL_DEFAULT;
+
+    while((key = sink_option_next(&options, &value)) != NULL)
+    {
+        if(strcmp(key, "flush") == 0 && value != NULL)
+        {
+            sink->flush_interval_ms = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "fsync") == 0 && value != NULL)
+        {
+            state->fsync_interval_ms = strtoul(value, NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown spectrum sink option '%s'\n", key);
+            free(state);
+            sink->state = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int spectrum_write_batch(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    int result = 0;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(spectrum_write(sink, datapoints[i]) != 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static int spectrum_flush(sink_t *sink)
+{
+    spectrum_state_t *state = (spectrum_state_t *)sink->state;
+    uint64_t now_ms = monotonic_ms();
+    bool sync = (state->fsync_interval_ms > 0 && state->synced_monotonic_ms + state->fsync_interval_ms <= now_ms);
+
+    if(sync)
+    {
+        state->synced_monotonic_ms = now_ms;
+    }
+
+    if(spectrum_writer_flush(&state->writer, sync) != 0)
+    {
+        fprintf(stderr, "[%s] Error: Writing spectrum log: %s\n", sink->context->label, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void spectrum_close(sink_t *sink)
+{
+    spectrum_state_t *state = (spectrum_state_t *)sink->state;
+
+    if(state == NULL)
+    {
+        return;
+    }
+
+    spectrum_writer_close(&state->writer);
+
+    free(state);
+    sink->state = NULL;
+}
+
+const sink_ops_t sink_spectrum_ops = {
+    .name = "spectrum",
+    .init = spectrum_init,
+    .write_batch = spectrum_write_batch,
+    .flush = spectrum_flush,
+    .close = spectrum_close
+};
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "ring.h"
+#include "sink.h"
+#include "telemetry.h"
+
+/* Msgpack telemetry to every -H <host>[:<port>], on -P <port> by default
+ *  Options:
+ *   refresh=<s> re-resolves the host every s seconds (default 300)
+ *   batch=<n> packs up to n datapoints into each datagram, sent when full, after hold=<ms> (default 1000), or at once
+ *    when the jamming state changes, mtu=<bytes> (default 1472) limits the datagram size
+ *   delta[=<n>] sends spectra in full every n datapoints (default 30), in between only the bins that moved by more
+ *    than threshold=<units> (default 2, of 0.25 dB) from the full one
+ *   spool=<path> keeps datagrams a destination could not take in a file of up to spoolsize=<MB> (default 16), ".<id>"
+ *    appended for a named receiver, and sends them again marked as backfill once it's back, at up to
+ *    backfill=<datagrams/s> (default 20). With delta, the batch on which it came back is sent again too, as its
+ *    spectra refer to a keyframe in the backfill */
+
+#define UDP_HOLD_DEFAULT    1000
+#define UDP_SPOOL_DEFAULT   16 /* MB */
+
+static int udp_init(sink_t *sink, char *options)
+{
+    char *key, *value;
+    uint32_t refresh_s = TELEMETRY_REFRESH_DEFAULT_S;
+    uint32_t batch = 0;
+    uint32_t mtu = TELEMETRY_MTU_DEFAULT;
+    uint32_t hold_ms = UDP_HOLD_DEFAULT;
+    uint32_t keyframe_interval = 0;
+    uint32_t threshold = TELEMETRY_THRESHOLD_DEFAULT;
+    const char *spool = NULL;
+    uint64_t spool_mb = UDP_SPOOL_DEFAULT;
+    uint32_t backfill = TELEMETRY_BACKFILL_DEFAULT;
+    char *spool_path;
+
+    while((key = sink_option_next(&options, &value)) != NULL)
+    {
+        if(strcmp(key, "refresh") == 0 && value != NULL)
+        {
+            refresh_s = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "batch") == 0 && value != NULL)
+        {
+            batch = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "hold") == 0 && value != NULL)
+        {
+            hold_ms = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "mtu") == 0 && value != NULL)
+        {
+            mtu = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "delta") == 0)
+        {
+            keyframe_interval = (value != NULL) ? strtoul(value, NULL, 10) : TELEMETRY_KEYFRAME_DEFAULT;
+        }
+        else if(strcmp(key, "threshold") == 0 && value != NULL && strtoul(value, NULL, 10) <= 255)
+        {
+            threshold = strtoul(value, NULL, 10);
+        }
+        else if(strcmp(key, "spool") == 0 && value != NULL)
+        {
+            spool = value;
+        }
+        else if(strcmp(key, "spoolsize") == 0 && value != NULL && strtoull(value, NULL, 10) > 0)
+        {
+            spool_mb = strtoull(value, NULL, 10);
+        }
+        else if(strcmp(key, "backfill") == 0 && value != NULL && strtoul(value, NULL, 10) > 0)
+        {
+            backfill = strtoul(value, NULL, 10);
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown udp sink option '%s'\n", key);
+            return -1;
+        }
+    }
+
+    sink->state = telemetry_create(sink->context->udp_hosts, sink->context->udp_hosts_count, sink->context->udp_port, refresh_s);
+    if(sink->state == NULL)
+    {
+        fprintf(stderr, "[%s] Error: Unable to start telemetry\n", sink->context->label);
+        return -1;
+    }
+
+    if(keyframe_interval > 0)
+    {
+        telemetry_set_spectrum_delta((telemetry_t *)sink->state, keyframe_interval, threshold);
+    }
+
+    if(batch > 0)
+    {
+        if(telemetry_set_batching((telemetry_t *)sink->state, batch, mtu) != 0)
+        {
+            telemetry_destroy((telemetry_t *)sink->state);
+            sink->state = NULL;
+            return -1;
+        }
+        /* A partly filled datagram waits for the flush */
+        sink->flush_interval_ms = hold_ms;
+    }
+
+    if(spool != NULL)
+    {
+        /* One spool per receiver, as with captures */
+        if(sink->context->id[0] != '\0')
+        {
+            if(asprintf(&spool_path, "%s.%s", spool, sink->context->id) < 0)
+            {
+                spool_path = NULL;
+            }
+        }
+        else
+        {
+            spool_path = strdup(spool);
+        }
+
+        if(spool_path == NULL || telemetry_set_spool((telemetry_t *)sink->state, spool_path, spool_mb * 1024 * 1024, backfill) != 0)
+        {
+            fprintf(stderr, "[%s] Error: Unable to open telemetry spool\n", sink->context->label);
+            free(spool_path);
+            telemetry_destroy((telemetry_t *)sink->state);
+            sink->state = NULL;
+            return -1;
+        }
+        free(spool_path);
+    }
+
+    return 0;
+}
+
+static int udp_write_batch(sink_t *sink, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    /* Best effort, errors are counted per destination in the telemetry statistics rather than the sink's */
+    telemetry_send_batch((telemetry_t *)sink->state, datapoints, count);
+
+    return 0;
+}
+
+static int udp_flush(sink_t *sink)
+{
+    telemetry_flush((telemetry_t *)sink->state);
+
+    return 0;
+}
+
+static void udp_close(sink_t *sink)
+{
+    telemetry_t *telemetry = (telemetry_t *)sink->state;
+
+    if(telemetry == NULL)
+    {
+        return;
+    }
+
+    if(sink->context->verbose)
+    {
+        telemetry_print_stats(telemetry, sink->context->label);
+    }
+    telemetry_destroy(telemetry);
+    sink->state = NULL;
+}
+
+const sink_ops_t sink_udp_ops = {
+    .name = "udp",
+    .init = udp_init,
+    .write_batch = udp_write_batch,
+    .flush = udp_flush,
+    .close = udp_close
+};
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spectrum.h"
+
+/* Self-description for tools that don't share this header */
+#define SPECTRUM_SCHEMA_FORMAT  "timestamp_ms:u64;block[%"PRIu8"]:{span_hz:u32,res_hz:u32,center_hz:u32,pga_db:u8,reserved:u8[3],spectrum:u8[256]}"
+
+uint32_t spectrum_record_size(uint8_t blocks)
+{
+    return sizeof(uint64_t) + ((uint32_t)blocks * sizeof(spectrum_block_t));
+}
+
+void spectrum_block_fill(spectrum_block_t *block, uint32_t span, uint32_t res, uint32_t center, uint8_t pga, const uint8_t *spectrum)
+{
+    block->span = span;
+    block->res = res;
+    block->center = center;
+    block->pga = pga;
+    memset(block->reserved, 0, sizeof(block->reserved));
+    memcpy(block->spectrum, spectrum, SPECTRUM_BINS);
+}
+
+static int spectrum_header_build(uint8_t *buffer, size_t buffer_size, uint8_t blocks, uint8_t flags)
+{
+    spectrum_file_header_t header;
+    int schema_length;
+    size_t header_size;
+
+    memset(buffer, 0, buffer_size);
+
+    schema_length = snprintf((char *)&buffer[sizeof(header)], buffer_size - sizeof(header), SPECTRUM_SCHEMA_FORMAT, blocks);
+    if(schema_length < 0 || sizeof(header) + schema_length + 1 > buffer_size)
+    {
+        return -1;
+    }
+
+    /* Keep records 8-byte aligned in the mapping */
+    header_size = (sizeof(header) + schema_length + 1 + 7) & ~(size_t)7;
+
+    memcpy(header.magic, SPECTRUM_MAGIC, SPECTRUM_MAGIC_SIZE);
+    header.header_size = header_size;
+    header.record_size = spectrum_record_size(blocks);
+    header.blocks = blocks;
+    header.flags = flags;
+    header.schema_length = schema_length;
+    memcpy(buffer, &header, sizeof(header));
+
+    return header_size;
+}
+
+/* Appends to an existing log of the same layout, or starts a new one. A partial final record (eg. power loss) is dropped */
+int spectrum_writer_open(spectrum_writer_t *writer, const char *filename, uint8_t blocks, uint8_t flags)
+{
+    uint8_t header_buffer[256];
+    spectrum_file_header_t header;
+    struct stat st;
+    int header_size;
+    off_t records_size;
+    int fd;
+
+    memset(writer, 0, sizeof(spectrum_writer_t));
+
+    if(blocks < 1 || blocks > SPECTRUM_BLOCKS_MAX)
+    {
+        return -1;
+    }
+    writer->blocks = blocks;
+    writer->record_size = spectrum_record_size(blocks);
+
+    fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open spectrum log '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    if(st.st_size == 0)
+    {
+        header_size = spectrum_header_build(header_buffer, sizeof(header_buffer), blocks, flags);
+        if(header_size < 0 || write(fd, header_buffer, header_size) != header_size)
+        {
+            fprintf(stderr, "Error: Unable to write spectrum log header '%s'\n", filename);
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        if(pread(fd, &header, sizeof(header), 0) != sizeof(header)
+            || memcmp(header.magic, SPECTRUM_MAGIC, SPECTRUM_MAGIC_SIZE) != 0
+            || header.blocks != blocks || header.record_size != writer->record_size
+            || st.st_size < header.header_size)
+        {
+            fprintf(stderr, "Error: '%s' exists but is not a spectrum log of %"PRIu8" block(s)\n", filename, blocks);
+            close(fd);
+            return -1;
+        }
+
+        records_size = st.st_size - header.header_size;
+        if(records_size % writer->record_size != 0)
+        {
+            fprintf(stderr, "Warning: Dropping partial record at the end of '%s'\n", filename);
+            if(ftruncate(fd, st.st_size - (records_size % writer->record_size)) != 0)
+            {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    writer->fptr = fdopen(fd, "a");
+    if(writer->fptr == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* A whole number of records per buffer, so a crash only ever loses whole records */
+    setvbuf(writer->fptr, NULL, _IOFBF, 64 * writer->record_size);
+
+    return 0;
+}
+
+int spectrum_writer_append(spectrum_writer_t *writer, const spectrum_record_t *record)
+{
+    if(fwrite(record, writer->record_size, 1, writer->fptr) != 1)
+    {
+        writer->errors++;
+        return -1;
+    }
+
+    writer->records++;
+    return 0;
+}
+
+int spectrum_writer_flush(spectrum_writer_t *writer, bool sync)
+{
+    if(writer->fptr == NULL)
+    {
+        return 0;
+    }
+
+    if(fflush(writer->fptr) != 0)
+    {
+        return -1;
+    }
+
+    if(sync && fsync(fileno(writer->fptr)) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void spectrum_writer_close(spectrum_writer_t *writer)
+{
+    if(writer->fptr != NULL)
+    {
+        spectrum_writer_flush(writer, true);
+        fclose(writer->fptr);
+        writer->fptr = NULL;
+    }
+}
+
+int spectrum_reader_open(spectrum_reader_t *reader, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    memset(reader, 0, sizeof(spectrum_reader_t));
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open spectrum log '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(spectrum_file_header_t))
+    {
+        fprintf(stderr, "Error: Spectrum log '%s' is too short\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(reader->map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Unable to map spectrum log '%s': %s\n", filename, strerror(errno));
+        reader->map = NULL;
+        return -1;
+    }
+    reader->map_size = st.st_size;
+    reader->header = (const spectrum_file_header_t *)reader->map;
+
+    if(memcmp(reader->header->magic, SPECTRUM_MAGIC, SPECTRUM_MAGIC_SIZE) != 0
+        || reader->header->blocks < 1 || reader->header->blocks > SPECTRUM_BLOCKS_MAX
+        || reader->header->record_size != spectrum_record_size(reader->header->blocks)
+        || reader->header->header_size > reader->map_size
+        || sizeof(spectrum_file_header_t) + reader->header->schema_length > reader->header->header_size)
+    {
+        fprintf(stderr, "Error: '%s' is not a jammon spectrum log\n", filename);
+        spectrum_reader_close(reader);
+        return -1;
+    }
+
+    reader->schema = (const char *)&reader->map[sizeof(spectrum_file_header_t)];
+    reader->records = &reader->map[reader->header->header_size];
+    reader->record_size = reader->header->record_size;
+    /* A partial final record is ignored */
+    reader->count = (reader->map_size - reader->header->header_size) / reader->record_size;
+
+    return 0;
+}
+
+const spectrum_record_t *spectrum_reader_record(const spectrum_reader_t *reader, uint64_t index)
+{
+    if(index >= reader->count)
+    {
+        return NULL;
+    }
+
+    return (const spectrum_record_t *)&reader->records[index * reader->record_size];
+}
+
+/* Index of the first record at or after timestamp_ms, or count if there's none */
+uint64_t spectrum_reader_find(const spectrum_reader_t *reader, uint64_t timestamp_ms)
+{
+    uint64_t low = 0, high = reader->count, mid;
+
+    while(low < high)
+    {
+        mid = low + ((high - low) / 2);
+        if(spectrum_reader_record(reader, mid)->timestamp_ms < timestamp_ms)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+void spectrum_reader_close(spectrum_reader_t *reader)
+{
+    if(reader->map != NULL)
+    {
+        munmap((void *)reader->map, reader->map_size);
+        reader->map = NULL;
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef __SPECTRUM_H__
+#define __SPECTRUM_H__
+
+/* Binary spectrum log layout, little-endian:
+ *  spectrum_file_header_t, the schema text (NUL-padded to header_size), then fixed-size records in time order:
+ *  timestamp_ms, followed by one spectrum_block_t per RF block (1, or 2 for multiband).
+ *  Records are located by index, so files can be memory-mapped and binary searched on time. */
+
+#define SPECTRUM_MAGIC          "JMSPECv1"
+#define SPECTRUM_MAGIC_SIZE     8
+#define SPECTRUM_BINS           256
+#define SPECTRUM_BLOCKS_MAX     2
+
+/* spectrum_file_header_t flags */
+#define SPECTRUM_FLAG_SUBSECOND 0x01 /* Written at more than 1 Hz, CSV timestamps carry milliseconds */
+
+typedef struct
+{
+    char magic[SPECTRUM_MAGIC_SIZE];
+    uint16_t header_size; /* Offset of the first record */
+    uint16_t record_size;
+    uint8_t blocks;
+    uint8_t flags;
+    uint16_t schema_length;
+} __attribute__((packed)) spectrum_file_header_t;
+
+typedef struct
+{
+    uint32_t span; /* Hz */
+    uint32_t res; /* Hz */
+    uint32_t center; /* Hz */
+    uint8_t pga; /* dB */
+    uint8_t reserved[3];
+    uint8_t spectrum[SPECTRUM_BINS];
+} __attribute__((packed)) spectrum_block_t;
+
+typedef struct
+{
+    uint64_t timestamp_ms; /* GNSS time, as the CSV timestamp column */
+    spectrum_block_t block[SPECTRUM_BLOCKS_MAX]; /* Only the file's number of blocks are stored */
+} __attribute__((packed)) spectrum_record_t;
+
+typedef struct {
+    FILE *fptr;
+    uint8_t blocks;
+    uint32_t record_size;
+    uint64_t records;
+    uint64_t errors;
+} spectrum_writer_t;
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_size;
+    const spectrum_file_header_t *header;
+    const char *schema;
+    const uint8_t *records;
+    uint32_t record_size;
+    uint64_t count;
+} spectrum_reader_t;
+
+uint32_t spectrum_record_size(uint8_t blocks);
+void spectrum_block_fill(spectrum_block_t *block, uint32_t span, uint32_t res, uint32_t center, uint8_t pga, const uint8_t *spectrum);
+
+int spectrum_writer_open(spectrum_writer_t *writer, const char *filename, uint8_t blocks, uint8_t flags);
+int spectrum_writer_append(spectrum_writer_t *writer, const spectrum_record_t *record);
+int spectrum_writer_flush(spectrum_writer_t *writer, bool sync);
+void spectrum_writer_close(spectrum_writer_t *writer);
+
+int spectrum_reader_open(spectrum_reader_t *reader, const char *filename);
+const spectrum_record_t *spectrum_reader_record(const spectrum_reader_t *reader, uint64_t index);
+uint64_t spectrum_reader_find(const spectrum_reader_t *reader, uint64_t timestamp_ms);
+void spectrum_reader_close(spectrum_reader_t *reader);
+
+#endif /* __SPECTRUM_H__ */
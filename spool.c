@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "journal.h"
+#include "spool.h"
+
+static int spool_header_write(spool_t *spool)
+{
+    uint8_t header[SPOOL_HEADER_SIZE] = { 0 };
+
+    memcpy(header, SPOOL_MAGIC, SPOOL_MAGIC_SIZE);
+    memcpy(&header[8], &spool->capacity, 8);
+    memcpy(&header[16], &spool->head, 8);
+    memcpy(&header[24], &spool->head_sequence, 8);
+
+    if(pwrite(spool->fd, header, SPOOL_HEADER_SIZE, 0) != SPOOL_HEADER_SIZE)
+    {
+        spool->stats.errors++;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Reads the record at *offset, or at the start of the ring if the end was reached there, into spool->record.
+ *  With payload, the whole record is read and its CRC checked. Returns the payload length, or -1 */
+static int64_t spool_record_read(spool_t *spool, uint64_t *offset, bool payload)
+{
+    uint8_t *record = spool->record;
+    uint32_t length, crc;
+
+    for(uint32_t attempt = 0; attempt < 2; attempt++)
+    {
+        if(*offset + SPOOL_RECORD_HEADER > spool->capacity)
+        {
+            *offset = 0;
+        }
+
+        if(pread(spool->fd, record, SPOOL_RECORD_HEADER, SPOOL_HEADER_SIZE + *offset) != SPOOL_RECORD_HEADER)
+        {
+            return -1;
+        }
+        memcpy(&length, record, 4);
+        if(length != 0 || *offset == 0)
+        {
+            break;
+        }
+        /* The rest of the ring was too short for the record that followed */
+        *offset = 0;
+    }
+
+    if(length == 0 || length > SPOOL_PAYLOAD_MAX || *offset + SPOOL_RECORD_HEADER + length > spool->capacity)
+    {
+        return -1;
+    }
+
+    if(payload)
+    {
+        if(pread(spool->fd, &record[SPOOL_RECORD_HEADER], length, SPOOL_HEADER_SIZE + *offset + SPOOL_RECORD_HEADER) != length)
+        {
+            return -1;
+        }
+        memcpy(&crc, &record[4], 4);
+        if(journal_crc32(0, &record[8], SPOOL_RECORD_HEADER - 8 + length) != crc)
+        {
+            return -1;
+        }
+    }
+
+    return length;
+}
+
+/* From the oldest record, as long as the sequence numbers follow on and the CRCs match */
+static void spool_recover(spool_t *spool)
+{
+    uint64_t offset = spool->head;
+    uint64_t sequence;
+    int64_t length;
+
+    spool->tail = spool->head;
+    spool->next_sequence = spool->head_sequence;
+
+    while((length = spool_record_read(spool, &offset, true)) > 0)
+    {
+        memcpy(&sequence, &spool->record[8], 8);
+        if(sequence != spool->next_sequence)
+        {
+            break;
+        }
+
+        if(spool->records == 0)
+        {
+            spool->head = offset;
+        }
+        offset += SPOOL_RECORD_HEADER + length;
+        spool->tail = offset;
+        spool->records++;
+        spool->bytes += SPOOL_RECORD_HEADER + length;
+        spool->next_sequence++;
+    }
+
+    spool->stats.recovered = spool->records;
+    if(spool->records == 0)
+    {
+        spool->head = 0;
+        spool->tail = 0;
+    }
+}
+
+int spool_open(spool_t *spool, const char *filename, uint64_t capacity)
+{
+    uint8_t header[SPOOL_HEADER_SIZE];
+    struct stat st;
+
+    memset(spool, 0, sizeof(spool_t));
+    spool->capacity = (capacity < SPOOL_CAPACITY_MIN) ? SPOOL_CAPACITY_MIN : capacity;
+
+    spool->fd = open(filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(spool->fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open spool '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(spool->fd, &st) != 0)
+    {
+        goto fail;
+    }
+
+    if(st.st_size < SPOOL_HEADER_SIZE)
+    {
+        /* New, the ring is left sparse */
+        if(ftruncate(spool->fd, SPOOL_HEADER_SIZE + spool->capacity) != 0 || spool_header_write(spool) != 0)
+        {
+            fprintf(stderr, "Error: Unable to write spool header '%s'\n", filename);
+            goto fail;
+        }
+        return 0;
+    }
+
+    if(pread(spool->fd, header, SPOOL_HEADER_SIZE, 0) != SPOOL_HEADER_SIZE || memcmp(header, SPOOL_MAGIC, SPOOL_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "Error: '%s' exists but is not a jammon spool\n", filename);
+        goto fail;
+    }
+
+    memcpy(&capacity, &header[8], 8);
+    if(capacity != spool->capacity)
+    {
+        fprintf(stderr, "Warning: Keeping the %"PRIu64" byte size of the existing spool '%s'\n", capacity, filename);
+        spool->capacity = capacity;
+    }
+    memcpy(&spool->head, &header[16], 8);
+    memcpy(&spool->head_sequence, &header[24], 8);
+    if(spool->head >= spool->capacity || (uint64_t)st.st_size < SPOOL_HEADER_SIZE + spool->capacity)
+    {
+        fprintf(stderr, "Error: Spool '%s' is corrupt\n", filename);
+        goto fail;
+    }
+
+    spool_recover(spool);
+
+    return 0;
+
+fail:
+    close(spool->fd);
+    spool->fd = -1;
+    return -1;
+}
+
+/* Whether the ring range would overwrite a record still queued */
+static bool spool_overlaps(const spool_t *spool, uint64_t offset, uint64_t size)
+{
+    if(spool->head < spool->tail)
+    {
+        return spool->head < offset + size && offset < spool->tail;
+    }
+
+    /* Wrapped, or full */
+    return offset + size > spool->head || offset < spool->tail;
+}
+
+static void spool_drop_oldest(spool_t *spool)
+{
+    int64_t length = spool_record_read(spool, &spool->head, false);
+
+    if(length < 0)
+    {
+        /* Unreadable, nothing after it can be found either */
+        spool->stats.errors++;
+        spool->stats.evicted += spool->records;
+        spool->stats.evicted_bytes += spool->bytes;
+        spool->head_sequence = spool->next_sequence;
+        spool->records = 0;
+        spool->bytes = 0;
+        return;
+    }
+
+    spool->head += SPOOL_RECORD_HEADER + length;
+    spool->head_sequence++;
+    spool->records--;
+    spool->bytes -= SPOOL_RECORD_HEADER + length;
+    spool->stats.evicted++;
+    spool->stats.evicted_bytes += SPOOL_RECORD_HEADER + length;
+}
+
+int spool_append(spool_t *spool, uint8_t destinations, const uint8_t *data, uint32_t length)
+{
+    uint8_t header[SPOOL_RECORD_HEADER];
+    struct iovec iov[2];
+    uint64_t size = SPOOL_RECORD_HEADER + length;
+    uint64_t offset;
+    uint32_t crc;
+    bool head_moved = false;
+
+    if(spool->fd < 0 || length == 0 || length > SPOOL_PAYLOAD_MAX)
+    {
+        return -1;
+    }
+
+    if(spool->records == 0)
+    {
+        spool->head = 0;
+        spool->tail = 0;
+    }
+
+    offset = (spool->tail + size <= spool->capacity) ? spool->tail : 0;
+    while(spool->records > 0 && spool_overlaps(spool, offset, size))
+    {
+        spool_drop_oldest(spool);
+        head_moved = true;
+    }
+    if(spool->records == 0)
+    {
+        spool->head = offset;
+        spool->head_sequence = spool->next_sequence;
+        head_moved = true;
+    }
+
+    if(offset == 0 && spool->tail != 0 && spool->tail + 4 <= spool->capacity)
+    {
+        /* Readers reaching the end of the ring start over */
+        memset(header, 0, 4);
+        if(pwrite(spool->fd, header, 4, SPOOL_HEADER_SIZE + spool->tail) != 4)
+        {
+            spool->stats.errors++;
+            return -1;
+        }
+    }
+
+    memcpy(&header[8], &spool->next_sequence, 8);
+    header[16] = destinations;
+    crc = journal_crc32(journal_crc32(0, &header[8], SPOOL_RECORD_HEADER - 8), data, length);
+    memcpy(&header[0], &length, 4);
+    memcpy(&header[4], &crc, 4);
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = SPOOL_RECORD_HEADER;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = length;
+    if(pwritev(spool->fd, iov, 2, SPOOL_HEADER_SIZE + offset) != (ssize_t)size)
+    {
+        spool->stats.errors++;
+        return -1;
+    }
+
+    spool->tail = offset + size;
+    spool->records++;
+    spool->bytes += size;
+    spool->next_sequence++;
+    spool->stats.appended++;
+
+    if(head_moved)
+    {
+        return spool_header_write(spool);
+    }
+
+    return 0;
+}
+
+/* The oldest record, valid until the spool is next changed */
+bool spool_peek(spool_t *spool, uint8_t *destinations, uint8_t **data, uint32_t *length)
+{
+    int64_t result;
+
+    if(spool->records == 0)
+    {
+        return false;
+    }
+
+    result = spool_record_read(spool, &spool->head, true);
+    if(result < 0)
+    {
+        spool->stats.errors++;
+        spool_drop_oldest(spool);
+        spool_header_write(spool);
+        return false;
+    }
+
+    *destinations = spool->record[16];
+    *data = &spool->record[SPOOL_RECORD_HEADER];
+    *length = result;
+
+    return true;
+}
+
+/* Narrows the destinations of the oldest record, after spool_peek() */
+int spool_update(spool_t *spool, uint8_t destinations)
+{
+    uint32_t length, crc;
+
+    memcpy(&length, spool->record, 4);
+    spool->record[16] = destinations;
+    crc = journal_crc32(0, &spool->record[8], SPOOL_RECORD_HEADER - 8 + length);
+    memcpy(&spool->record[4], &crc, 4);
+
+    if(pwrite(spool->fd, spool->record, SPOOL_RECORD_HEADER, SPOOL_HEADER_SIZE + spool->head) != SPOOL_RECORD_HEADER)
+    {
+        spool->stats.errors++;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Of the oldest record, after spool_peek() */
+void spool_remove(spool_t *spool)
+{
+    uint32_t length;
+
+    memcpy(&length, spool->record, 4);
+    spool->head += SPOOL_RECORD_HEADER + length;
+    spool->head_sequence++;
+    spool->records--;
+    spool->bytes -= SPOOL_RECORD_HEADER + length;
+    spool->stats.removed++;
+
+    spool_header_write(spool);
+}
+
+void spool_close(spool_t *spool)
+{
+    if(spool->fd >= 0)
+    {
+        spool_header_write(spool);
+        close(spool->fd);
+        spool->fd = -1;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __SPOOL_H__
+#define __SPOOL_H__
+
+/* Disk-backed FIFO of telemetry datagrams, for store-and-forward through uplink outages, little-endian:
+ *  SPOOL_MAGIC, the capacity, and the offset and sequence number of the oldest record, then a fixed-size ring of
+ *  records of a u32 payload length, a u32 CRC-32 of the sequence number, destinations and payload, a u64 sequence
+ *  number, a u8 destination bitmask and the payload. A record that would not fit before the end of the ring is
+ *  preceded by a zero length and starts over at the beginning, and the oldest records are evicted to make room.
+ *  Appending is a single pwrite(), with no allocation. The header is only rewritten as the oldest record changes, on
+ *  open the newest records are found by following the sequence numbers and CRCs on from the oldest. */
+
+#define SPOOL_MAGIC             "JMSPLv1\n"
+#define SPOOL_MAGIC_SIZE        8
+#define SPOOL_HEADER_SIZE       64 /* Of the file, the ring follows */
+#define SPOOL_RECORD_HEADER     17
+#define SPOOL_PAYLOAD_MAX       4096
+#define SPOOL_CAPACITY_MIN      (64 * 1024)
+
+typedef struct {
+    uint64_t appended;
+    uint64_t evicted; /* Oldest first, to make room */
+    uint64_t evicted_bytes;
+    uint64_t removed; /* Forwarded */
+    uint64_t recovered; /* Found on open */
+    uint64_t errors;
+} spool_stats_t;
+
+typedef struct {
+    int fd;
+    uint64_t capacity; /* Of the ring */
+    uint64_t head; /* Ring offset of the oldest record */
+    uint64_t tail; /* Of the next to append */
+    uint64_t head_sequence;
+    uint64_t next_sequence;
+    uint64_t records;
+    uint64_t bytes; /* Of records, excluding any unused end of the ring */
+    uint8_t record[SPOOL_RECORD_HEADER + SPOOL_PAYLOAD_MAX]; /* The oldest, once read */
+    spool_stats_t stats;
+} spool_t;
+
+int spool_open(spool_t *spool, const char *filename, uint64_t capacity);
+int spool_append(spool_t *spool, uint8_t destinations, const uint8_t *data, uint32_t length);
+bool spool_peek(spool_t *spool, uint8_t *destinations, uint8_t **data, uint32_t *length);
+int spool_update(spool_t *spool, uint8_t destinations);
+void spool_remove(spool_t *spool);
+void spool_close(spool_t *spool);
+
+#endif /* __SPOOL_H__ */
@@ -4,106 +4,937 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 #include "main.h"
 #include "cmp.h"
+#include "journal.h"
+#include "spool.h"
+#include "telemetry.h"
 
 #define CMP_BUFFER_SIZE     4096
-static uint8_t buffer[CMP_BUFFER_SIZE];
 
-static uint32_t cmp_buf_ptr = 0;
+/* Encode buffer, one per datapoint of a batch */
+typedef struct {
+    uint8_t data[CMP_BUFFER_SIZE];
+    uint32_t ptr;
+} cmp_buffer_t;
 
-static void udp_send(char *host, uint16_t port, uint8_t *buffer, size_t buffer_size)
+typedef struct {
+    uint8_t *data;
+    uint32_t length;
+    uint32_t ptr;
+} cmp_reader_buffer_t;
+
+typedef struct {
+    const char *spec; /* As given, for messages */
+    char host[256]; /* Without the port or brackets */
+    uint16_t port;
+    bool numeric;
+    bool reported; /* Lookup failure, until one succeeds */
+
+    struct sockaddr_storage address; /* Guarded by mutex while the resolver runs */
+    socklen_t address_length;
+    bool resolved;
+
+    /* Statistics, written by the sender */
+    uint64_t sent;
+    uint64_t unresolved; /* Dropped before the first lookup succeeded */
+    uint64_t errors;
+    int last_error; /* errno */
+    bool up; /* The last datagram went, for store-and-forward */
+    uint64_t send_us_total; /* From the start of the batch until the datagram was accepted */
+    uint64_t send_us_max;
+} telemetry_destination_t;
+
+struct telemetry_s {
+    telemetry_destination_t destinations[TELEMETRY_DESTINATIONS_MAX];
+    uint32_t destinations_count;
+    uint32_t refresh_s;
+    int fd;
+    int family; /* Of the socket, AF_INET6 (dual-stack) unless IPv6 is unavailable */
+
+    /* Resolver */
+    pthread_t thread;
+    bool thread_running;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool stop;
+    uint64_t lookups;
+    uint64_t lookup_failures;
+    uint64_t lookup_us_max;
+
+    /* Sender */
+    cmp_buffer_t encoded[TELEMETRY_BATCH_MAX]; /* Datagrams ready to send */
+    uint32_t encoded_count;
+    struct mmsghdr messages[TELEMETRY_BATCH_MAX * TELEMETRY_DESTINATIONS_MAX];
+    struct iovec iovecs[TELEMETRY_BATCH_MAX * TELEMETRY_DESTINATIONS_MAX];
+    struct sockaddr_storage addresses[TELEMETRY_DESTINATIONS_MAX]; /* Snapshot for the batch */
+    socklen_t address_lengths[TELEMETRY_DESTINATIONS_MAX];
+    uint32_t message_destinations[TELEMETRY_BATCH_MAX * TELEMETRY_DESTINATIONS_MAX];
+    uint32_t message_datagrams[TELEMETRY_BATCH_MAX * TELEMETRY_DESTINATIONS_MAX];
+    uint8_t failed[TELEMETRY_BATCH_MAX]; /* Destinations, per datagram */
+    uint64_t batches;
+    uint64_t syscalls;
+
+    /* Batching, several datapoints per datagram */
+    uint32_t batch_datapoints; /* 0 when off */
+    uint32_t mtu;
+    cmp_buffer_t datapoint;
+    cmp_buffer_t *pending; /* encoded[encoded_count] while being filled, NULL if empty */
+    uint32_t pending_count;
+    uint8_t jam_bb;
+    uint8_t jam_bb2;
+    uint64_t datapoints;
+    uint64_t datagrams;
+    uint64_t immediate; /* Sent early on a jamming state change */
+    uint64_t bytes; /* Of encoded datapoints */
+
+    /* Spectrum deltas, against the last keyframe */
+    uint32_t keyframe_interval; /* 0 when off */
+    uint8_t threshold;
+    uint32_t sequence;
+    bool keyframe_valid;
+    uint32_t keyframe_sequence;
+    bool keyframe_multiband;
+    uint8_t keyframe_spectrum[2][256];
+    uint32_t keyframe_center[2];
+    uint32_t keyframe_res[2];
+    uint8_t keyframe_pga[2];
+    uint8_t delta_pairs[2][256]; /* Of index and value */
+    uint32_t delta_length[2];
+    uint64_t keyframes;
+    uint64_t deltas;
+    uint64_t delta_bins;
+
+    /* Store-and-forward, datagrams that failed to go are spooled and later sent again marked as backfill */
+    spool_t *spool; /* NULL when off */
+    uint32_t backfill_rate; /* Datagrams per second */
+    double backfill_tokens;
+    uint64_t backfill_monotonic_ms;
+    cmp_buffer_t backfill;
+    uint64_t spooled;
+    uint64_t backfilled;
+    uint64_t requeued; /* For destinations still down, after going to the others */
+    uint64_t stale; /* Dropped, for destinations no longer given */
+};
+
+/* "host", "host:port", "[v6 address]:port" or a bare v6 address */
+static int telemetry_destination_parse(telemetry_destination_t *destination, const char *spec, uint16_t default_port)
+{
+    const char *host = spec;
+    const char *port = NULL;
+    const char *end;
+    size_t length;
+
+    if(spec[0] == '[')
+    {
+        host = spec + 1;
+        end = strchr(host, ']');
+        if(end == NULL || (end[1] != '\0' && end[1] != ':'))
+        {
+            return -1;
+        }
+        length = end - host;
+        port = (end[1] == ':') ? &end[2] : NULL;
+    }
+    else if((end = strchr(spec, ':')) != NULL && strchr(end + 1, ':') == NULL)
+    {
+        length = end - spec;
+        port = end + 1;
+    }
+    else
+    {
+        length = strlen(spec);
+    }
+
+    if(length == 0 || length >= sizeof(destination->host))
+    {
+        return -1;
+    }
+    memcpy(destination->host, host, length);
+    destination->host[length] = '\0';
+    destination->spec = spec;
+    destination->port = default_port;
+
+    if(port != NULL)
+    {
+        char *port_end;
+        unsigned long value = strtoul(port, &port_end, 10);
+        if(*port == '\0' || *port_end != '\0' || value == 0 || value > 65535)
+        {
+            return -1;
+        }
+        destination->port = value;
+    }
+
+    return 0;
+}
+
+/* IPv4 results become v4-mapped addresses on a dual-stack socket */
+static int telemetry_lookup(const telemetry_t *telemetry, const telemetry_destination_t *destination, int flags,
+    struct sockaddr_storage *address, socklen_t *address_length)
 {
-    int sockfd, n;
-    int serverlen;
-    struct sockaddr_in serveraddr;
+    struct addrinfo hints;
+    struct addrinfo *list = NULL;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)address;
+    int result;
 
-    bzero((char *)&serveraddr, sizeof(serveraddr));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = (telemetry->family == AF_INET6) ? AF_UNSPEC : AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = flags;
 
-    /* socket: create the socket */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
+    result = getaddrinfo(destination->host, NULL, &hints, &list);
+    if(result != 0)
+    {
+        return result;
+    }
+
+    memset(address, 0, sizeof(struct sockaddr_storage));
+    if(list->ai_family == AF_INET && telemetry->family == AF_INET6)
+    {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr.s6_addr[10] = 0xff;
+        in6->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&in6->sin6_addr.s6_addr[12], &((struct sockaddr_in *)list->ai_addr)->sin_addr, 4);
+        in6->sin6_port = htons(destination->port);
+        *address_length = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        memcpy(address, list->ai_addr, list->ai_addrlen);
+        *address_length = list->ai_addrlen;
+        if(list->ai_family == AF_INET6)
+        {
+            in6->sin6_port = htons(destination->port);
+        }
+        else
+        {
+            ((struct sockaddr_in *)address)->sin_port = htons(destination->port);
+        }
+    }
+    freeaddrinfo(list);
+
+    return 0;
+}
+
+/* Looks the host names up every refresh_s seconds, every TELEMETRY_RETRY_S while any are failing. getaddrinfo() can
+ *  block for seconds without a network, the mutex is only held to swap an address */
+static void *telemetry_resolver(void *arg)
+{
+    telemetry_t *telemetry = (telemetry_t *)arg;
+    telemetry_destination_t *destination;
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    struct timespec deadline;
+    uint64_t start_us, lookup_us;
+    uint32_t wait_s;
+    int result;
+
+    pthread_mutex_lock(&telemetry->mutex);
+    while(!telemetry->stop)
+    {
+        wait_s = telemetry->refresh_s;
+
+        for(uint32_t i = 0; i < telemetry->destinations_count && !telemetry->stop; i++)
+        {
+            destination = &telemetry->destinations[i];
+            if(destination->numeric)
+            {
+                continue;
+            }
+
+            pthread_mutex_unlock(&telemetry->mutex);
+            start_us = monotonic_us();
+            result = telemetry_lookup(telemetry, destination, 0, &address, &address_length);
+            lookup_us = monotonic_us() - start_us;
+            pthread_mutex_lock(&telemetry->mutex);
+
+            telemetry->lookups++;
+            if(lookup_us > telemetry->lookup_us_max)
+            {
+                telemetry->lookup_us_max = lookup_us;
+            }
+
+            if(result == 0)
+            {
+                destination->address = address;
+                destination->address_length = address_length;
+                destination->resolved = true;
+                destination->reported = false;
+            }
+            else
+            {
+                telemetry->lookup_failures++;
+                if(!destination->reported)
+                {
+                    fprintf(stderr, "Warning: Hostname lookup failed for %s: %s%s\n", destination->host, gai_strerror(result),
+                        destination->resolved ? ", still sending to the last address" : "");
+                    destination->reported = true;
+                }
+                wait_s = TELEMETRY_RETRY_S;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wait_s;
+        while(!telemetry->stop)
+        {
+            if(pthread_cond_timedwait(&telemetry->cond, &telemetry->mutex, &deadline) != 0)
+            {
+                break; /* Timed out */
+            }
+        }
+    }
+    pthread_mutex_unlock(&telemetry->mutex);
+
+    return NULL;
+}
+
+telemetry_t *telemetry_create(const char *const *hosts, uint32_t hosts_count, uint16_t default_port, uint32_t refresh_s)
+{
+    telemetry_t *telemetry;
+    telemetry_destination_t *destination;
+    pthread_condattr_t attr;
+    bool lookups = false;
+    int off = 0;
+
+    if(hosts_count == 0 || hosts_count > TELEMETRY_DESTINATIONS_MAX)
+    {
+        fprintf(stderr, "Error: Between 1 and %d telemetry destinations are supported\n", TELEMETRY_DESTINATIONS_MAX);
+        return NULL;
+    }
+
+    telemetry = calloc(1, sizeof(telemetry_t));
+    if(telemetry == NULL)
+    {
+        return NULL;
+    }
+    telemetry->refresh_s = (refresh_s > 0) ? refresh_s : TELEMETRY_REFRESH_DEFAULT_S;
+
+    /* One dual-stack socket reaches both IPv4 and IPv6 destinations, so a batch is a single sendmmsg() */
+    telemetry->family = AF_INET6;
+    telemetry->fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(telemetry->fd >= 0 && setsockopt(telemetry->fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) != 0)
+    {
+        close(telemetry->fd);
+        telemetry->fd = -1;
+    }
+    if(telemetry->fd < 0)
+    {
+        telemetry->family = AF_INET;
+        telemetry->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    }
+    if(telemetry->fd < 0)
     {
         fprintf(stderr, "Error: opening socket\n");
-        return;
+        telemetry_destroy(telemetry);
+        return NULL;
+    }
+
+    for(uint32_t i = 0; i < hosts_count; i++)
+    {
+        destination = &telemetry->destinations[telemetry->destinations_count];
+        if(telemetry_destination_parse(destination, hosts[i], default_port) != 0)
+        {
+            fprintf(stderr, "Error: Invalid telemetry destination '%s'\n", hosts[i]);
+            telemetry_destroy(telemetry);
+            return NULL;
+        }
+        telemetry->destinations_count++;
+
+        /* An address needs no lookups */
+        if(telemetry_lookup(telemetry, destination, AI_NUMERICHOST, &destination->address, &destination->address_length) == 0)
+        {
+            destination->numeric = true;
+            destination->resolved = true;
+        }
+        else
+        {
+            lookups = true;
+        }
     }
 
+    if(!lookups)
+    {
+        return telemetry;
+    }
+
+    pthread_mutex_init(&telemetry->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&telemetry->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&telemetry->thread, NULL, telemetry_resolver, telemetry) != 0)
+    {
+        fprintf(stderr, "Error: Unable to start resolver thread\n");
+        pthread_cond_destroy(&telemetry->cond);
+        pthread_mutex_destroy(&telemetry->mutex);
+        telemetry_destroy(telemetry);
+        return NULL;
+    }
+    telemetry->thread_running = true;
+
+    return telemetry;
+}
+
+/* Up to datapoints per datagram, as a msgpack array of the usual maps, kept within mtu bytes */
+int telemetry_set_batching(telemetry_t *telemetry, uint32_t datapoints, uint32_t mtu)
+{
+    if(datapoints > 0xffff || mtu < TELEMETRY_MTU_MIN || mtu > CMP_BUFFER_SIZE)
+    {
+        fprintf(stderr, "Error: Telemetry batches are limited to 65535 datapoints and an MTU of %d to %d bytes\n", TELEMETRY_MTU_MIN, CMP_BUFFER_SIZE);
+        return -1;
+    }
+
+    telemetry->batch_datapoints = datapoints;
+    telemetry->mtu = mtu;
+
+    return 0;
+}
+
+/* Spectra as a keyframe every keyframe_interval datapoints, in between only the bins that differ from the keyframe's by
+ *  more than threshold */
+void telemetry_set_spectrum_delta(telemetry_t *telemetry, uint32_t keyframe_interval, uint8_t threshold)
+{
+    telemetry->keyframe_interval = keyframe_interval;
+    telemetry->threshold = threshold;
+}
+
+/* Datagrams that any destination failed to take are kept in a file of up to capacity bytes, and sent again at up to
+ *  backfill_rate per second once it's back. The queue outlives restarts */
+int telemetry_set_spool(telemetry_t *telemetry, const char *filename, uint64_t capacity, uint32_t backfill_rate)
+{
+    telemetry->spool = calloc(1, sizeof(spool_t));
+    if(telemetry->spool == NULL)
+    {
+        return -1;
+    }
+
+    if(spool_open(telemetry->spool, filename, capacity) != 0)
+    {
+        free(telemetry->spool);
+        telemetry->spool = NULL;
+        return -1;
+    }
+
+    telemetry->backfill_rate = (backfill_rate > 0) ? backfill_rate : TELEMETRY_BACKFILL_DEFAULT;
+    telemetry->backfill_monotonic_ms = monotonic_ms();
+
+    return 0;
+}
+
+/* Sends each datagram to the destinations in its failed[] bitmask, leaving the bits of those it failed to reach, in as
+ *  few sendmmsg() calls as errors allow. A destination changing between up and down forces a spectrum keyframe for the
+ *  next batch, the batch of the change itself was already encoded against a keyframe sent the other way (see
+ *  telemetry_send()) */
+static void telemetry_transmit(telemetry_t *telemetry, cmp_buffer_t *datagrams, uint32_t count)
+{
+    telemetry_destination_t *destination;
+    bool resolved[TELEMETRY_DESTINATIONS_MAX];
+    uint8_t sent = 0;
+    uint32_t messages_count = 0;
+    uint32_t offset = 0;
+    uint64_t start_us, send_us;
     int result;
-    struct addrinfo hints;
-    struct addrinfo* pResultList = NULL;
 
-    bzero((char *)&hints, sizeof(struct addrinfo));
+    if(telemetry->thread_running)
+    {
+        pthread_mutex_lock(&telemetry->mutex);
+    }
+    for(uint32_t i = 0; i < telemetry->destinations_count; i++)
+    {
+        destination = &telemetry->destinations[i];
+        resolved[i] = destination->resolved;
+        telemetry->addresses[i] = destination->address;
+        telemetry->address_lengths[i] = destination->address_length;
+    }
+    if(telemetry->thread_running)
+    {
+        pthread_mutex_unlock(&telemetry->mutex);
+    }
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        for(uint32_t j = 0; j < telemetry->destinations_count; j++)
+        {
+            if(!(telemetry->failed[i] & (1 << j)))
+            {
+                continue;
+            }
+            if(!resolved[j])
+            {
+                telemetry->destinations[j].unresolved++;
+                continue;
+            }
+
+            telemetry->iovecs[messages_count].iov_base = datagrams[i].data;
+            telemetry->iovecs[messages_count].iov_len = datagrams[i].ptr;
+            memset(&telemetry->messages[messages_count], 0, sizeof(struct mmsghdr));
+            telemetry->messages[messages_count].msg_hdr.msg_name = &telemetry->addresses[j];
+            telemetry->messages[messages_count].msg_hdr.msg_namelen = telemetry->address_lengths[j];
+            telemetry->messages[messages_count].msg_hdr.msg_iov = &telemetry->iovecs[messages_count];
+            telemetry->messages[messages_count].msg_hdr.msg_iovlen = 1;
+            telemetry->message_destinations[messages_count] = j;
+            telemetry->message_datagrams[messages_count] = i;
+            messages_count++;
+        }
+    }
+
+    if(messages_count > 0)
+    {
+        telemetry->batches++;
+    }
 
-    //hints.ai_family = AF_INET; // Use IPv4
-    //hints.ai_socktype = SOCK_DGRAM;
-    //hints.ai_socktype = SOCK_STREAM;
+    /* sendmmsg() stops at the first failing datagram, which is then skipped */
+    start_us = monotonic_us();
+    while(offset < messages_count)
+    {
+        result = sendmmsg(telemetry->fd, &telemetry->messages[offset], messages_count - offset, MSG_DONTWAIT);
+        send_us = monotonic_us() - start_us;
+        telemetry->syscalls++;
 
-    result = getaddrinfo(host , NULL, &hints, &pResultList);
+        if(result <= 0)
+        {
+            /* Unreachable or full, UDP telemetry is best effort */
+            destination = &telemetry->destinations[telemetry->message_destinations[offset]];
+            destination->errors++;
+            destination->last_error = (result < 0) ? errno : EIO;
+            offset++;
+            continue;
+        }
 
-    if(result != 0)
+        for(int i = 0; i < result; i++, offset++)
+        {
+            destination = &telemetry->destinations[telemetry->message_destinations[offset]];
+            destination->sent++;
+            destination->send_us_total += send_us;
+            if(send_us > destination->send_us_max)
+            {
+                destination->send_us_max = send_us;
+            }
+            telemetry->failed[telemetry->message_datagrams[offset]] &= ~(1 << telemetry->message_destinations[offset]);
+            sent |= (1 << telemetry->message_destinations[offset]);
+        }
+    }
+
+    for(uint32_t j = 0; j < telemetry->destinations_count; j++)
+    {
+        bool up = (sent & (1 << j)) != 0;
+        bool attempted = false;
+
+        for(uint32_t i = 0; i < count && !attempted; i++)
+        {
+            attempted = (telemetry->failed[i] & (1 << j)) != 0;
+        }
+        if(!up && !attempted)
+        {
+            continue;
+        }
+        if(telemetry->destinations[j].up != up)
+        {
+            telemetry->destinations[j].up = up;
+            telemetry->keyframe_valid = false;
+        }
+    }
+}
+
+static bool buffer_reader(cmp_ctx_t *ctx, void *data, size_t limit)
+{
+    cmp_reader_buffer_t *reader = (cmp_reader_buffer_t *)ctx->buf;
+
+    if(reader->ptr + limit > reader->length)
+    {
+        return false;
+    }
+
+    memcpy(data, &reader->data[reader->ptr], limit);
+    reader->ptr += limit;
+
+    return true;
+}
+
+/* Adds the backfill flag to each datapoint of a spooled datagram, a lone map or an array of them. Spooling puts key 14
+ *  first in every map, so it's a change of one byte per datapoint */
+static int telemetry_backfill_mark(cmp_buffer_t *datagram)
+{
+    cmp_ctx_t cmp;
+    cmp_reader_buffer_t reader = { datagram->data, datagram->ptr, 0 };
+    uint32_t count = 1;
+    uint32_t size;
+    uint8_t *flag;
+
+    cmp_init(&cmp, (void *)&reader, buffer_reader, NULL, NULL);
+
+    if(datagram->ptr > 0 && (datagram->data[0] == 0xdc || (datagram->data[0] & 0xf0) == 0x90))
+    {
+        if(!cmp_read_array(&cmp, &count))
+        {
+            return -1;
+        }
+    }
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(!cmp_read_map(&cmp, &size) || size == 0 || reader.ptr + 2 > reader.length)
+        {
+            return -1;
+        }
+
+        flag = &datagram->data[reader.ptr];
+        if(flag[0] != 14 || (flag[1] != 0xc2 && flag[1] != 0xc3))
+        {
+            return -1;
+        }
+        flag[1] = 0xc3; /* true */
+
+        for(uint32_t j = 0; j < 2 * size; j++)
+        {
+            if(!cmp_skip_object_no_limit(&cmp))
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Drains the spool, oldest first, to the destinations that are up, at up to backfill_rate datagrams per second.
+ *  A record still owed to a destination that is down goes back on the end, so it doesn't hold up the others */
+static void telemetry_backfill(telemetry_t *telemetry)
+{
+    spool_t *spool = telemetry->spool;
+    uint64_t now_ms = monotonic_ms();
+    uint8_t all = (1 << telemetry->destinations_count) - 1;
+    uint8_t up = 0;
+    uint8_t destinations, remaining;
+    uint8_t *data;
+    uint32_t length;
+
+    if(spool == NULL || spool->records == 0)
+    {
+        telemetry->backfill_monotonic_ms = now_ms;
+        return;
+    }
+
+    telemetry->backfill_tokens += (double)(now_ms - telemetry->backfill_monotonic_ms) * telemetry->backfill_rate / 1000;
+    if(telemetry->backfill_tokens > telemetry->backfill_rate)
+    {
+        telemetry->backfill_tokens = telemetry->backfill_rate;
+    }
+    telemetry->backfill_monotonic_ms = now_ms;
+
+    for(uint32_t i = 0; i < telemetry->destinations_count; i++)
+    {
+        if(telemetry->destinations[i].up)
+        {
+            up |= (1 << i);
+        }
+    }
+
+    while(telemetry->backfill_tokens >= 1 && spool_peek(spool, &destinations, &data, &length))
+    {
+        if((destinations & all) == 0)
+        {
+            /* For a destination no longer given, since a restart */
+            telemetry->stale++;
+            spool_remove(spool);
+            continue;
+        }
+        destinations &= all;
+
+        if((destinations & up) == 0)
+        {
+            break;
+        }
+
+        memcpy(telemetry->backfill.data, data, length);
+        telemetry->backfill.ptr = length;
+        if(telemetry_backfill_mark(&telemetry->backfill) != 0)
+        {
+            /* Not a datagram of ours */
+            spool->stats.errors++;
+            spool_remove(spool);
+            continue;
+        }
+
+        telemetry->failed[0] = destinations & up;
+        telemetry_transmit(telemetry, &telemetry->backfill, 1);
+        telemetry->backfill_tokens -= 1;
+        remaining = (destinations & ~up) | telemetry->failed[0];
+
+        if(remaining == 0)
+        {
+            telemetry->backfilled++;
+            spool_remove(spool);
+        }
+        else if(remaining == destinations)
+        {
+            /* Down again */
+            spool_update(spool, remaining);
+            break;
+        }
+        else
+        {
+            telemetry->backfilled++;
+            telemetry->requeued++;
+            spool_remove(spool);
+            spool_append(spool, remaining, telemetry->backfill.data, telemetry->backfill.ptr);
+        }
+
+        for(uint32_t i = 0; i < telemetry->destinations_count; i++)
+        {
+            if(!telemetry->destinations[i].up)
+            {
+                up &= ~(1 << i);
+            }
+        }
+    }
+}
+
+/* The encoded datagrams to every destination, spooling those that any failed to reach, then some of the backlog.
+ *  With spectrum deltas, the batch on which a destination comes back refers to a keyframe that went to the spool, so
+ *  it's spooled for that destination too, to be rebuilt once backfill has delivered the keyframe. The datapoints of
+ *  that batch then arrive twice, live without their spectra. The batch on which a destination goes down refers to a
+ *  keyframe that went live, which the receiver keeps for the backfill */
+static void telemetry_send(telemetry_t *telemetry)
+{
+    telemetry_destination_t *destination;
+    uint8_t all = (1 << telemetry->destinations_count) - 1;
+    uint8_t down = 0;
+
+    for(uint32_t j = 0; j < telemetry->destinations_count; j++)
+    {
+        destination = &telemetry->destinations[j];
+        if(!destination->up && (destination->errors > 0 || destination->unresolved > 0))
+        {
+            down |= (1 << j);
+        }
+    }
+
+    memset(telemetry->failed, all, telemetry->encoded_count);
+    telemetry_transmit(telemetry, telemetry->encoded, telemetry->encoded_count);
+
+    if(telemetry->spool != NULL)
+    {
+        for(uint32_t j = 0; j < telemetry->destinations_count && telemetry->keyframe_interval > 0; j++)
+        {
+            if((down & (1 << j)) && telemetry->destinations[j].up)
+            {
+                for(uint32_t i = 0; i < telemetry->encoded_count; i++)
+                {
+                    telemetry->failed[i] |= (1 << j);
+                }
+            }
+        }
+
+        for(uint32_t i = 0; i < telemetry->encoded_count; i++)
+        {
+            if(telemetry->failed[i] != 0 && spool_append(telemetry->spool, telemetry->failed[i], telemetry->encoded[i].data, telemetry->encoded[i].ptr) == 0)
+            {
+                telemetry->spooled++;
+            }
+        }
+    }
+
+    telemetry->datagrams += telemetry->encoded_count;
+    telemetry->encoded_count = 0;
+
+    if(telemetry->pending != NULL && telemetry->pending != &telemetry->encoded[0])
+    {
+        /* The datagram being filled moves to the front */
+        memcpy(telemetry->encoded[0].data, telemetry->pending->data, telemetry->pending->ptr);
+        telemetry->encoded[0].ptr = telemetry->pending->ptr;
+        telemetry->pending = &telemetry->encoded[0];
+    }
+
+    telemetry_backfill(telemetry);
+}
+
+void telemetry_print_stats(const telemetry_t *telemetry, const char *label)
+{
+    const telemetry_destination_t *destination;
+
+    printf("[%s] Telemetry: %"PRIu64" datapoints in %"PRIu64" datagrams (%"PRIu64" sent early on a jamming change), %"PRIu64" batches in %"PRIu64" sendmmsg() calls, "
+        "%"PRIu64" lookups (%"PRIu64" failed, max %"PRIu64" ms)\n",
+        label, telemetry->datapoints, telemetry->datagrams, telemetry->immediate, telemetry->batches, telemetry->syscalls,
+        telemetry->lookups, telemetry->lookup_failures, telemetry->lookup_us_max / 1000);
+    printf("[%s] Telemetry encoding: mean %"PRIu64" bytes per datapoint", label, telemetry->datapoints > 0 ? telemetry->bytes / telemetry->datapoints : 0);
+    if(telemetry->keyframe_interval > 0)
+    {
+        printf(", spectra as %"PRIu64" keyframes and %"PRIu64" deltas (mean %.1f bins changed)", telemetry->keyframes, telemetry->deltas,
+            telemetry->deltas > 0 ? (double)telemetry->delta_bins / telemetry->deltas : 0.0);
+    }
+    printf("\n");
+    if(telemetry->spool != NULL)
+    {
+        printf("[%s] Telemetry spool: %"PRIu64" datagrams queued (%"PRIu64" bytes), %"PRIu64" spooled, %"PRIu64" backfilled (%"PRIu64" requeued, %"PRIu64" stale), "
+            "%"PRIu64" evicted (%"PRIu64" bytes), %"PRIu64" recovered on open, %"PRIu64" errors\n",
+            label, telemetry->spool->records, telemetry->spool->bytes, telemetry->spooled, telemetry->backfilled, telemetry->requeued, telemetry->stale,
+            telemetry->spool->stats.evicted, telemetry->spool->stats.evicted_bytes, telemetry->spool->stats.recovered, telemetry->spool->stats.errors);
+    }
+
+    for(uint32_t i = 0; i < telemetry->destinations_count; i++)
+    {
+        destination = &telemetry->destinations[i];
+        printf(" - %s port %u: %"PRIu64" sent, %"PRIu64" errors%s%s, %"PRIu64" dropped unresolved, send mean %"PRIu64" us max %"PRIu64" us\n",
+            destination->host, destination->port, destination->sent, destination->errors,
+            destination->errors > 0 ? ", last: " : "", destination->errors > 0 ? strerror(destination->last_error) : "",
+            destination->unresolved, destination->sent > 0 ? destination->send_us_total / destination->sent : 0, destination->send_us_max);
+    }
+}
+
+void telemetry_destroy(telemetry_t *telemetry)
+{
+    if(telemetry == NULL)
     {
-        //fprintf(stderr, "Error: Hostname lookup failed for %s, message: %s\n", host, gai_strerror(result));
-        close(sockfd);
         return;
     }
-    memcpy(&serveraddr, pResultList->ai_addr, sizeof(serveraddr));
-    freeaddrinfo(pResultList);
 
-    serveraddr.sin_port = htons(port);
+    if(telemetry->thread_running)
+    {
+        /* An in-progress lookup is waited out */
+        pthread_mutex_lock(&telemetry->mutex);
+        telemetry->stop = true;
+        pthread_cond_signal(&telemetry->cond);
+        pthread_mutex_unlock(&telemetry->mutex);
+        pthread_join(telemetry->thread, NULL);
+
+        pthread_cond_destroy(&telemetry->cond);
+        pthread_mutex_destroy(&telemetry->mutex);
+    }
 
-    /* send the message to the server */
-    serverlen = sizeof(serveraddr);
-    n = sendto(sockfd, buffer, buffer_size, 0, &serveraddr, serverlen);
-    if (n < 0)
+    if(telemetry->spool != NULL)
     {
-        fprintf(stderr, "Error: in sendto\n");
+        spool_close(telemetry->spool);
+        free(telemetry->spool);
     }
 
-    close(sockfd);
+    if(telemetry->fd >= 0)
+    {
+        close(telemetry->fd);
+    }
+    free(telemetry);
 }
 
 static bool file_skipper(cmp_ctx_t *ctx, size_t count)
 {
     //return fseek((FILE *)ctx->buf, count, SEEK_CUR);
-    (void)ctx;
-    cmp_buf_ptr += count;
+    ((cmp_buffer_t *)ctx->buf)->ptr += count;
     return true;
 }
 
 static size_t file_writer(cmp_ctx_t *ctx, const void *buffer, size_t count) {
 
-    uint16_t i;
-    uint8_t *buffer_ptr = (uint8_t *)buffer;
+    cmp_buffer_t *cmp_buffer = (cmp_buffer_t *)ctx->buf;
 
-    if (cmp_buf_ptr+count > CMP_BUFFER_SIZE)
+    if (cmp_buffer->ptr+count > CMP_BUFFER_SIZE)
     {
-        return -1;
+        return 0;
     }
 
-    for (i = 0; i < count; i++)
-    {
-        ((char*)ctx->buf)[cmp_buf_ptr] = *((uint8_t*)buffer_ptr);
-        buffer_ptr++;
-        cmp_buf_ptr++;
-    }
+    memcpy(&cmp_buffer->data[cmp_buffer->ptr], buffer, count);
+    cmp_buffer->ptr += count;
+
     return count;
     //return fwrite(data, sizeof(uint8_t), count, (FILE *)ctx->buf);
 }
 
-void udp_send_msgpack(char *host, uint16_t port, jammon_datapoint_t *jammon_datapoint_ptr)
+/* Chooses between a keyframe and deltas against the last one, filling the delta pairs. A keyframe is also sent when the
+ *  tuning changes, or when the pairs would be no smaller than the spectrum itself */
+static bool telemetry_delta(telemetry_t *telemetry, const jammon_datapoint_t *jammon_datapoint_ptr)
+{
+    const uint8_t *spectra[2] = { jammon_datapoint_ptr->spectrum, jammon_datapoint_ptr->spectrum2 };
+    const uint32_t centers[2] = { jammon_datapoint_ptr->center, jammon_datapoint_ptr->center2 };
+    const uint32_t resolutions[2] = { jammon_datapoint_ptr->res, jammon_datapoint_ptr->res2 };
+    const uint8_t pgas[2] = { jammon_datapoint_ptr->pga, jammon_datapoint_ptr->pga2 };
+    uint32_t bands = jammon_datapoint_ptr->multiband ? 2 : 1;
+    bool keyframe;
+    uint32_t length;
+
+    keyframe = (!telemetry->keyframe_valid || telemetry->sequence - telemetry->keyframe_sequence >= telemetry->keyframe_interval
+        || jammon_datapoint_ptr->multiband != telemetry->keyframe_multiband);
+
+    for(uint32_t band = 0; band < bands && !keyframe; band++)
+    {
+        if(centers[band] != telemetry->keyframe_center[band] || resolutions[band] != telemetry->keyframe_res[band]
+            || pgas[band] != telemetry->keyframe_pga[band])
+        {
+            keyframe = true;
+            break;
+        }
+
+        length = 0;
+        for(uint32_t i = 0; i < 256 && length < 256; i++)
+        {
+            if(abs((int)spectra[band][i] - (int)telemetry->keyframe_spectrum[band][i]) > telemetry->threshold)
+            {
+                telemetry->delta_pairs[band][length++] = i;
+                telemetry->delta_pairs[band][length++] = spectra[band][i];
+            }
+        }
+        telemetry->delta_length[band] = length;
+        keyframe = (length >= 256);
+    }
+
+    if(!keyframe)
+    {
+        telemetry->deltas++;
+        for(uint32_t band = 0; band < bands; band++)
+        {
+            telemetry->delta_bins += telemetry->delta_length[band] / 2;
+        }
+        return true;
+    }
+
+    for(uint32_t band = 0; band < bands; band++)
+    {
+        memcpy(telemetry->keyframe_spectrum[band], spectra[band], 256);
+        telemetry->keyframe_center[band] = centers[band];
+        telemetry->keyframe_res[band] = resolutions[band];
+        telemetry->keyframe_pga[band] = pgas[band];
+    }
+    telemetry->keyframe_multiband = jammon_datapoint_ptr->multiband;
+    telemetry->keyframe_sequence = telemetry->sequence;
+    telemetry->keyframe_valid = true;
+    telemetry->keyframes++;
+
+    return false;
+}
+
+static void telemetry_encode(telemetry_t *telemetry, cmp_buffer_t *cmp_buffer, const jammon_datapoint_t *jammon_datapoint_ptr)
 {
     cmp_ctx_t cmp;
+    bool tagged = (jammon_datapoint_ptr->receiver_id[0] != '\0');
+    bool sequenced = (telemetry->keyframe_interval > 0);
+    bool delta = sequenced && telemetry_delta(telemetry, jammon_datapoint_ptr);
+    bool spooled = (telemetry->spool != NULL);
 
-    cmp_buf_ptr = 0;
-    cmp_init(&cmp, (void*)buffer, 0, file_skipper, file_writer);
+    cmp_buffer->ptr = 0;
+    cmp_init(&cmp, (void*)cmp_buffer, 0, file_skipper, file_writer);
 
-    /* Start map, 7 items, 8 items if multiband (spectrum2) */
-    cmp_write_map(&cmp, (jammon_datapoint_ptr->multiband ? 10 : 7));
+    /* Start map, 7 items, 10 items if multiband (agc2, jam2, spectrum2), +1 if tagged with receiver id, +1 if sequenced,
+     *  +1 if spooled */
+    cmp_write_map(&cmp, (jammon_datapoint_ptr->multiband ? 10 : 7) + (tagged ? 1 : 0) + (sequenced ? 1 : 0) + (spooled ? 1 : 0));
+
+    if(spooled)
+    {
+        /* Backfill flag, first so that telemetry_backfill_mark() finds it */
+        cmp_write_uint(&cmp, 14);
+        cmp_write_false(&cmp);
+    }
 
     /* GNSS timestamp */
     cmp_write_uint(&cmp, 0);
@@ -158,24 +989,159 @@ void udp_send_msgpack(char *host, uint16_t port, jammon_datapoint_t *jammon_data
         cmp_write_uint(&cmp, jammon_datapoint_ptr->jam_bb2);
     }
 
-    /* Array of [center, res, spectrum[256], pga] */
-    cmp_write_uint(&cmp, 10);
-    cmp_write_array(&cmp, 4);
-    cmp_write_uint(&cmp, jammon_datapoint_ptr->center);
-    cmp_write_uint(&cmp, jammon_datapoint_ptr->res);
-    cmp_write_bin(&cmp, jammon_datapoint_ptr->spectrum, 256);
-    cmp_write_uint(&cmp, jammon_datapoint_ptr->pga);
+    if(delta)
+    {
+        /* Array of [keyframe sequence, [index, value]..], the other bins, center, res and pga are the keyframe's */
+        cmp_write_uint(&cmp, 20);
+        cmp_write_array(&cmp, 2);
+        cmp_write_uint(&cmp, telemetry->keyframe_sequence);
+        cmp_write_bin(&cmp, telemetry->delta_pairs[0], telemetry->delta_length[0]);
 
-    if(jammon_datapoint_ptr->multiband)
+        if(jammon_datapoint_ptr->multiband)
+        {
+            cmp_write_uint(&cmp, 21);
+            cmp_write_array(&cmp, 2);
+            cmp_write_uint(&cmp, telemetry->keyframe_sequence);
+            cmp_write_bin(&cmp, telemetry->delta_pairs[1], telemetry->delta_length[1]);
+        }
+    }
+    else
     {
         /* Array of [center, res, spectrum[256], pga] */
-        cmp_write_uint(&cmp, 11);
+        cmp_write_uint(&cmp, 10);
         cmp_write_array(&cmp, 4);
-        cmp_write_uint(&cmp, jammon_datapoint_ptr->center2);
-        cmp_write_uint(&cmp, jammon_datapoint_ptr->res2);
-        cmp_write_bin(&cmp, jammon_datapoint_ptr->spectrum2, 256);
-        cmp_write_uint(&cmp, jammon_datapoint_ptr->pga2);
+        cmp_write_uint(&cmp, jammon_datapoint_ptr->center);
+        cmp_write_uint(&cmp, jammon_datapoint_ptr->res);
+        cmp_write_bin(&cmp, jammon_datapoint_ptr->spectrum, 256);
+        cmp_write_uint(&cmp, jammon_datapoint_ptr->pga);
+
+        if(jammon_datapoint_ptr->multiband)
+        {
+            /* Array of [center, res, spectrum[256], pga] */
+            cmp_write_uint(&cmp, 11);
+            cmp_write_array(&cmp, 4);
+            cmp_write_uint(&cmp, jammon_datapoint_ptr->center2);
+            cmp_write_uint(&cmp, jammon_datapoint_ptr->res2);
+            cmp_write_bin(&cmp, jammon_datapoint_ptr->spectrum2, 256);
+            cmp_write_uint(&cmp, jammon_datapoint_ptr->pga2);
+        }
+    }
+
+    if(tagged)
+    {
+        /* Receiver id */
+        cmp_write_uint(&cmp, 12);
+        cmp_write_str(&cmp, jammon_datapoint_ptr->receiver_id, strlen(jammon_datapoint_ptr->receiver_id));
+    }
+
+    if(sequenced)
+    {
+        /* Sequence number, for the receiver to notice a lost keyframe */
+        cmp_write_uint(&cmp, 13);
+        cmp_write_uint(&cmp, telemetry->sequence);
+        telemetry->sequence++;
+    }
+
+    telemetry->bytes += cmp_buffer->ptr;
+}
+
+static void telemetry_pending_close(telemetry_t *telemetry)
+{
+    uint8_t *header;
+
+    if(telemetry->pending == NULL)
+    {
+        return;
+    }
+
+    /* array16 header, reserved when the first datapoint went in */
+    header = telemetry->pending->data;
+    header[0] = 0xdc;
+    header[1] = (uint8_t)(telemetry->pending_count >> 8);
+    header[2] = (uint8_t)telemetry->pending_count;
+
+    telemetry->pending = NULL;
+    telemetry->pending_count = 0;
+    telemetry->encoded_count++;
+    if(telemetry->encoded_count == TELEMETRY_BATCH_MAX)
+    {
+        telemetry_send(telemetry);
+    }
+}
+
+/* Packs datapoints into an array datagram until it holds batch_datapoints or the next would go over the MTU.
+ *  A change of jamming state is sent straight away, along with whatever was waiting */
+static void telemetry_pack(telemetry_t *telemetry, const jammon_datapoint_t *jammon_datapoint_ptr)
+{
+    bool changed = (telemetry->datapoints > 0
+        && (jammon_datapoint_ptr->jam_bb != telemetry->jam_bb || jammon_datapoint_ptr->jam_bb2 != telemetry->jam_bb2));
+
+    telemetry->jam_bb = jammon_datapoint_ptr->jam_bb;
+    telemetry->jam_bb2 = jammon_datapoint_ptr->jam_bb2;
+    telemetry->datapoints++;
+
+    telemetry_encode(telemetry, &telemetry->datapoint, jammon_datapoint_ptr);
+
+    if(telemetry->pending != NULL && telemetry->pending->ptr + telemetry->datapoint.ptr > telemetry->mtu)
+    {
+        telemetry_pending_close(telemetry);
+    }
+
+    if(telemetry->pending == NULL)
+    {
+        /* A lone datapoint over the MTU still goes, as a batch of one */
+        telemetry->pending = &telemetry->encoded[telemetry->encoded_count];
+        telemetry->pending->ptr = 3;
     }
+    memcpy(&telemetry->pending->data[telemetry->pending->ptr], telemetry->datapoint.data, telemetry->datapoint.ptr);
+    telemetry->pending->ptr += telemetry->datapoint.ptr;
+    telemetry->pending_count++;
 
-    udp_send(host, port, buffer, cmp_buf_ptr);
-}
\ No newline at end of file
+    if(changed)
+    {
+        telemetry->immediate++;
+    }
+    if(changed || telemetry->pending_count >= telemetry->batch_datapoints)
+    {
+        telemetry_pending_close(telemetry);
+    }
+}
+
+/* Each datapoint is encoded once, whatever the number of destinations. When batching, the last datagram may be held
+ *  back for more, until telemetry_flush() */
+void telemetry_send_batch(telemetry_t *telemetry, const jammon_datapoint_t *const *datapoints, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(telemetry->batch_datapoints > 0)
+        {
+            telemetry_pack(telemetry, datapoints[i]);
+            continue;
+        }
+
+        telemetry_encode(telemetry, &telemetry->encoded[telemetry->encoded_count++], datapoints[i]);
+        telemetry->datapoints++;
+        if(telemetry->encoded_count == TELEMETRY_BATCH_MAX)
+        {
+            telemetry_send(telemetry);
+        }
+    }
+
+    if(telemetry->encoded_count > 0)
+    {
+        telemetry_send(telemetry);
+    }
+}
+
+void telemetry_flush(telemetry_t *telemetry)
+{
+    telemetry_pending_close(telemetry);
+    if(telemetry->encoded_count > 0)
+    {
+        telemetry_send(telemetry);
+    }
+    else
+    {
+        telemetry_backfill(telemetry);
+    }
+}
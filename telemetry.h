@@ -1,6 +1,43 @@
 #ifndef __TELEMETRY_H__
 #define __TELEMETRY_H__
 
-void udp_send_msgpack(char *host, uint16_t port, jammon_datapoint_t *jammon_datapoint_ptr);
+/* Msgpack telemetry over UDP, to one or more IPv4 or IPv6 destinations.
+ *  The socket is opened once, and host names are resolved by a background thread, refreshed every refresh_s seconds
+ *  (or sooner, while lookups are failing), so sending never waits on DNS. Until a destination's first lookup succeeds
+ *  its datapoints are dropped, after that a failed refresh keeps the last good address. Each datapoint is encoded once
+ *  and a batch goes to every destination in a single sendmmsg().
+ *  Optionally several datapoints share a datagram, as a msgpack array16 of the usual maps, sent once it's full (by
+ *  count, or the next datapoint would go over the MTU), on telemetry_flush(), or immediately on a change of either
+ *  broadband jamming state.
+ *  Optionally spectra are sent in full only as a keyframe every so often, the datapoints in between carry just the
+ *  bins that differ from the keyframe's by more than a threshold, as [keyframe sequence, bin of index and value pairs]
+ *  under key 20 (21 for L2) instead of 10 (11), and every datapoint carries a sequence number under key 13. A receiver
+ *  that has lost the keyframe a delta refers to waits for the next one.
+ *  Optionally datagrams that a destination failed to take, on a send error or while its host is unresolved, are spooled
+ *  to disk and sent again once it's back, at a limited rate and with key 14 (false in every datapoint while spooling)
+ *  set to true, so the receiver can tell backfill from live. A destination going down or coming back forces a
+ *  keyframe. */
 
-#endif /* __TELEMETRY_H__ */
\ No newline at end of file
+#define TELEMETRY_REFRESH_DEFAULT_S     300
+#define TELEMETRY_RETRY_S               10 /* After a failed lookup */
+#define TELEMETRY_DESTINATIONS_MAX      8
+#define TELEMETRY_BATCH_MAX             16 /* Datagrams per sendmmsg() */
+#define TELEMETRY_MTU_DEFAULT           1472 /* Ethernet, less the IPv4 and UDP headers */
+#define TELEMETRY_MTU_MIN               576
+#define TELEMETRY_KEYFRAME_DEFAULT      30 /* Datapoints */
+#define TELEMETRY_THRESHOLD_DEFAULT     2 /* 0.5 dB */
+#define TELEMETRY_BACKFILL_DEFAULT      20 /* Datagrams per second */
+
+typedef struct telemetry_s telemetry_t;
+
+/* hosts are "host", "host:port" or "[v6 address]:port", and must outlive the context */
+telemetry_t *telemetry_create(const char *const *hosts, uint32_t hosts_count, uint16_t default_port, uint32_t refresh_s);
+int telemetry_set_batching(telemetry_t *telemetry, uint32_t datapoints, uint32_t mtu);
+void telemetry_set_spectrum_delta(telemetry_t *telemetry, uint32_t keyframe_interval, uint8_t threshold);
+int telemetry_set_spool(telemetry_t *telemetry, const char *filename, uint64_t capacity, uint32_t backfill_rate);
+void telemetry_send_batch(telemetry_t *telemetry, const jammon_datapoint_t *const *datapoints, uint32_t count);
+void telemetry_flush(telemetry_t *telemetry);
+void telemetry_print_stats(const telemetry_t *telemetry, const char *label);
+void telemetry_destroy(telemetry_t *telemetry);
+
+#endif /* __TELEMETRY_H__ */
@@ -0,0 +1,1202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spectrum.h"
+#include "archive.h"
+#include "journal.h"
+
+/* jammon-tool, offline utilities for jammon's log files */
+
+#define CSV_LINE_MAX    1024
+#define QUERY_PATH_MAX  512
+
+static void usage(void)
+{
+    printf("Usage: jammon-tool csv2bin <output.bin> <spectruml1.csv> [<spectruml2.csv>]\n");
+    printf("       jammon-tool bin2csv [-s <start>] [-e <end>] <input.bin> <spectruml1.csv> [<spectruml2.csv>]\n");
+    printf("       jammon-tool bin2arc [-k <keyframe interval>] <input.bin> <output.jma>\n");
+    printf("       jammon-tool arc2bin [-s <start>] [-e <end>] <input.jma> <output.bin>\n");
+    printf("       jammon-tool jnl2csv <input.jnl> [<output.csv>]\n");
+    printf("       jammon-tool query [-s <start>] [-e <end>] [-t log|spectrum] <directory> [<directory> ..]\n");
+    printf("       jammon-tool info <input.bin|input.jma>\n");
+    printf("  Times are GNSS timestamps as in the CSV files, eg. 1617580800 or 1617580800.200,\n");
+    printf("  or local dates and times as the files are named by, eg. 2021-04-05 or \"2021-04-05 14:02:30\"\n");
+}
+
+/* "<seconds>[.<milliseconds>]", returns the end of the timestamp, or NULL if there isn't one */
+static const char *timestamp_parse(const char *text, uint64_t *timestamp_ms)
+{
+    char *end;
+    uint64_t seconds, ms = 0;
+    int digits = 0;
+
+    seconds = strtoull(text, &end, 10);
+    if(end == text)
+    {
+        return NULL;
+    }
+
+    if(*end == '.')
+    {
+        for(end++; *end >= '0' && *end <= '9'; end++)
+        {
+            if(digits < 3)
+            {
+                ms = (ms * 10) + (*end - '0');
+                digits++;
+            }
+        }
+        for(; digits < 3; digits++)
+        {
+            ms *= 10;
+        }
+    }
+
+    *timestamp_ms = (seconds * 1000) + ms;
+    return end;
+}
+
+/* An option's time, either a timestamp or a local date and time as the log files are named by, eg. "2021-04-05 14:02" */
+static bool time_parse(const char *text, uint64_t *timestamp_ms)
+{
+    struct tm tm;
+    const char *end;
+    time_t timestamp;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(text, "%Y-%m-%d", &tm);
+    if(end != NULL)
+    {
+        if(*end == ' ' || *end == 'T')
+        {
+            end = strptime(end + 1, "%H:%M", &tm);
+            if(end != NULL && *end == ':')
+            {
+                end = strptime(end + 1, "%S", &tm);
+            }
+        }
+        if(end == NULL || *end != '\0')
+        {
+            return false;
+        }
+
+        tm.tm_isdst = -1;
+        timestamp = mktime(&tm);
+        if(timestamp < 0)
+        {
+            return false;
+        }
+        *timestamp_ms = (uint64_t)timestamp * 1000;
+        return true;
+    }
+
+    end = timestamp_parse(text, timestamp_ms);
+    return end != NULL && *end == '\0';
+}
+
+static int hex_value(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* <timestamp>,<span>,<res>,<center>,<pga>,"<512 hex>" */
+static bool csv_spectrum_parse(const char *line, uint64_t *timestamp_ms, spectrum_block_t *block, bool *subsecond)
+{
+    const char *p;
+    char *end;
+    unsigned long values[4];
+    int high, low;
+
+    p = timestamp_parse(line, timestamp_ms);
+    if(p == NULL || *p != ',')
+    {
+        return false;
+    }
+    *subsecond = (memchr(line, '.', p - line) != NULL);
+    p++;
+
+    for(int i = 0; i < 4; i++)
+    {
+        values[i] = strtoul(p, &end, 10);
+        if(end == p || *end != ',')
+        {
+            return false;
+        }
+        p = end + 1;
+    }
+
+    if(*p++ != '"')
+    {
+        return false;
+    }
+
+    memset(block, 0, sizeof(spectrum_block_t));
+    block->span = values[0];
+    block->res = values[1];
+    block->center = values[2];
+    block->pga = values[3];
+
+    for(int i = 0; i < SPECTRUM_BINS; i++)
+    {
+        high = hex_value(p[0]);
+        low = hex_value(p[1]);
+        if(high < 0 || low < 0)
+        {
+            /* Files written before the final bin was encoded have 255 */
+            if(i == SPECTRUM_BINS - 1 && p[0] == '"')
+            {
+                break;
+            }
+            return false;
+        }
+        block->spectrum[i] = (high << 4) | low;
+        p += 2;
+    }
+
+    return true;
+}
+
+static int csv2bin(int argc, char *argv[])
+{
+    FILE *csv[SPECTRUM_BLOCKS_MAX] = { NULL, NULL };
+    char line[SPECTRUM_BLOCKS_MAX][CSV_LINE_MAX];
+    bool have_line[SPECTRUM_BLOCKS_MAX];
+    uint64_t timestamp_ms[SPECTRUM_BLOCKS_MAX];
+    spectrum_record_t record;
+    spectrum_writer_t writer;
+    uint8_t blocks;
+    bool subsecond = false;
+    uint64_t invalid = 0, unmatched = 0, out_of_order = 0, last_timestamp_ms = 0;
+    int result = 1;
+
+    if(argc < 3 || argc > 4)
+    {
+        usage();
+        return 1;
+    }
+    blocks = argc - 2;
+
+    for(int b = 0; b < blocks; b++)
+    {
+        csv[b] = fopen(argv[2 + b], "r");
+        if(csv[b] == NULL)
+        {
+            fprintf(stderr, "Error: Unable to open '%s'\n", argv[2 + b]);
+            goto done;
+        }
+    }
+
+    /* Millisecond timestamps are only written above 1 Hz, so the first line sets the flag */
+    if(fgets(line[0], sizeof(line[0]), csv[0]) == NULL)
+    {
+        fprintf(stderr, "Error: '%s' is empty\n", argv[2]);
+        goto done;
+    }
+    if(!csv_spectrum_parse(line[0], &timestamp_ms[0], &record.block[0], &subsecond))
+    {
+        fprintf(stderr, "Error: '%s' is not a jammon spectrum CSV\n", argv[2]);
+        goto done;
+    }
+    rewind(csv[0]);
+
+    if(spectrum_writer_open(&writer, argv[1], blocks, subsecond ? SPECTRUM_FLAG_SUBSECOND : 0) != 0)
+    {
+        goto done;
+    }
+
+    /* Lines of both bands come from the same datapoint, so are matched on timestamp */
+    have_line[0] = have_line[1] = false;
+    while(true)
+    {
+        for(int b = 0; b < blocks; b++)
+        {
+            while(!have_line[b] && fgets(line[b], sizeof(line[b]), csv[b]) != NULL)
+            {
+                if(csv_spectrum_parse(line[b], &timestamp_ms[b], &record.block[b], &subsecond))
+                {
+                    have_line[b] = true;
+                }
+                else
+                {
+                    invalid++;
+                }
+            }
+        }
+
+        if(!have_line[0] || (blocks > 1 && !have_line[1]))
+        {
+            unmatched += (have_line[0] ? 1 : 0) + (blocks > 1 && have_line[1] ? 1 : 0);
+            break;
+        }
+
+        if(blocks > 1 && timestamp_ms[0] != timestamp_ms[1])
+        {
+            unmatched++;
+            have_line[timestamp_ms[0] < timestamp_ms[1] ? 0 : 1] = false;
+            continue;
+        }
+
+        record.timestamp_ms = timestamp_ms[0];
+        if(record.timestamp_ms < last_timestamp_ms)
+        {
+            out_of_order++;
+        }
+        last_timestamp_ms = record.timestamp_ms;
+
+        spectrum_writer_append(&writer, &record);
+        have_line[0] = have_line[1] = false;
+    }
+
+    spectrum_writer_close(&writer);
+
+    printf("%"PRIu64" records (%"PRIu8" block%s) written to %s, %"PRIu64" invalid lines, %"PRIu64" unmatched, %"PRIu64" write errors\n",
+        writer.records, blocks, blocks > 1 ? "s" : "", argv[1], invalid, unmatched, writer.errors);
+    if(out_of_order > 0)
+    {
+        fprintf(stderr, "Warning: %"PRIu64" records out of time order, time search will be unreliable\n", out_of_order);
+    }
+
+    result = (writer.errors > 0) ? 1 : 0;
+
+done:
+    for(int b = 0; b < blocks; b++)
+    {
+        if(csv[b] != NULL)
+        {
+            fclose(csv[b]);
+        }
+    }
+    return result;
+}
+
+/* As written by the CSV sink, with an optional leading prefix */
+static void spectrum_row_print(FILE *fptr, const char *prefix, uint64_t timestamp_ms, bool subsecond, const spectrum_block_t *block)
+{
+    static const char hex_digits[] = "0123456789abcdef";
+    char hex[(2 * SPECTRUM_BINS) + 1];
+    char timestamp[32];
+
+    if(subsecond)
+    {
+        snprintf(timestamp, sizeof(timestamp), "%"PRIu64".%03"PRIu64, timestamp_ms / 1000, timestamp_ms % 1000);
+    }
+    else
+    {
+        snprintf(timestamp, sizeof(timestamp), "%"PRIu64, timestamp_ms / 1000);
+    }
+
+    for(int i = 0; i < SPECTRUM_BINS; i++)
+    {
+        hex[2 * i] = hex_digits[block->spectrum[i] >> 4];
+        hex[(2 * i) + 1] = hex_digits[block->spectrum[i] & 0x0f];
+    }
+    hex[2 * SPECTRUM_BINS] = '\0';
+
+    fprintf(fptr, "%s%s,%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu8",\"%s\"\n", prefix, timestamp, block->span, block->res, block->center, block->pga, hex);
+}
+
+static int bin2csv(int argc, char *argv[])
+{
+    spectrum_reader_t reader;
+    const spectrum_record_t *record;
+    FILE *csv[SPECTRUM_BLOCKS_MAX] = { NULL, NULL };
+    uint64_t start_ms = 0, end_ms = UINT64_MAX;
+    uint64_t index, written = 0;
+    int outputs, option;
+    int result = 1;
+
+    optind = 1;
+    while((option = getopt(argc, argv, "s:e:")) != -1)
+    {
+        switch(option)
+        {
+            case 's':
+                if(!time_parse(optarg, &start_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'e':
+                if(!time_parse(optarg, &end_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    outputs = argc - optind - 1;
+    if(outputs < 1 || outputs > SPECTRUM_BLOCKS_MAX)
+    {
+        usage();
+        return 1;
+    }
+
+    if(spectrum_reader_open(&reader, argv[optind]) != 0)
+    {
+        return 1;
+    }
+
+    if(outputs > reader.header->blocks)
+    {
+        fprintf(stderr, "Error: '%s' only has %"PRIu8" block(s)\n", argv[optind], reader.header->blocks);
+        goto done;
+    }
+
+    for(int b = 0; b < outputs; b++)
+    {
+        csv[b] = fopen(argv[optind + 1 + b], "w");
+        if(csv[b] == NULL)
+        {
+            fprintf(stderr, "Error: Unable to open '%s'\n", argv[optind + 1 + b]);
+            goto done;
+        }
+    }
+
+    for(index = spectrum_reader_find(&reader, start_ms); (record = spectrum_reader_record(&reader, index)) != NULL; index++)
+    {
+        if(record->timestamp_ms > end_ms)
+        {
+            break;
+        }
+
+        for(int b = 0; b < outputs; b++)
+        {
+            spectrum_row_print(csv[b], "", record->timestamp_ms, reader.header->flags & SPECTRUM_FLAG_SUBSECOND, &record->block[b]);
+        }
+        written++;
+    }
+
+    printf("%"PRIu64" of %"PRIu64" records written\n", written, reader.count);
+    result = 0;
+
+done:
+    for(int b = 0; b < outputs; b++)
+    {
+        if(csv[b] != NULL && fclose(csv[b]) != 0)
+        {
+            result = 1;
+        }
+    }
+    spectrum_reader_close(&reader);
+    return result;
+}
+
+static int bin2arc(int argc, char *argv[])
+{
+    spectrum_reader_t reader;
+    archive_writer_t writer;
+    const spectrum_record_t *record;
+    unsigned long keyframe_interval = ARCHIVE_KEYFRAME_DEFAULT;
+    int option;
+
+    optind = 1;
+    while((option = getopt(argc, argv, "k:")) != -1)
+    {
+        switch(option)
+        {
+            case 'k':
+                keyframe_interval = strtoul(optarg, NULL, 10);
+                if(keyframe_interval == 0 || keyframe_interval > UINT16_MAX)
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if(argc - optind != 2)
+    {
+        usage();
+        return 1;
+    }
+
+    if(spectrum_reader_open(&reader, argv[optind]) != 0)
+    {
+        return 1;
+    }
+
+    if(archive_writer_open(&writer, argv[optind + 1], reader.header->blocks, reader.header->flags, keyframe_interval) != 0)
+    {
+        spectrum_reader_close(&reader);
+        return 1;
+    }
+
+    for(uint64_t index = 0; (record = spectrum_reader_record(&reader, index)) != NULL; index++)
+    {
+        archive_writer_append(&writer, record);
+    }
+
+    archive_writer_close(&writer);
+    spectrum_reader_close(&reader);
+
+    printf("%"PRIu64" records, %"PRIu64" keyframes, %"PRIu64" -> %"PRIu64" bytes (%.1f%%), %"PRIu64" write errors\n",
+        writer.records, writer.keyframes, writer.bytes_in, writer.bytes_out,
+        writer.bytes_in > 0 ? 100.0 * writer.bytes_out / writer.bytes_in : 0.0, writer.errors);
+
+    return (writer.errors > 0) ? 1 : 0;
+}
+
+static int arc2bin(int argc, char *argv[])
+{
+    archive_reader_t reader;
+    spectrum_writer_t writer;
+    spectrum_record_t record;
+    uint64_t start_ms = 0, end_ms = UINT64_MAX;
+    bool past_end = false;
+    int option;
+
+    optind = 1;
+    while((option = getopt(argc, argv, "s:e:")) != -1)
+    {
+        switch(option)
+        {
+            case 's':
+                if(!time_parse(optarg, &start_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'e':
+                if(!time_parse(optarg, &end_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if(argc - optind != 2)
+    {
+        usage();
+        return 1;
+    }
+
+    if(archive_reader_open(&reader, argv[optind]) != 0)
+    {
+        return 1;
+    }
+
+    if(spectrum_writer_open(&writer, argv[optind + 1], reader.header->blocks, reader.header->flags) != 0)
+    {
+        archive_reader_close(&reader);
+        return 1;
+    }
+
+    archive_reader_seek(&reader, start_ms);
+    while(archive_reader_next(&reader, &record))
+    {
+        if(record.timestamp_ms < start_ms)
+        {
+            continue;
+        }
+        if(record.timestamp_ms > end_ms)
+        {
+            past_end = true;
+            break;
+        }
+        spectrum_writer_append(&writer, &record);
+    }
+
+    if(!past_end && reader.offset != reader.map_size)
+    {
+        fprintf(stderr, "Warning: '%s' is corrupt after byte %zu\n", argv[optind], reader.offset);
+    }
+
+    spectrum_writer_close(&writer);
+    archive_reader_close(&reader);
+
+    printf("%"PRIu64" records written, %"PRIu64" write errors\n", writer.records, writer.errors);
+
+    return (writer.errors > 0) ? 1 : 0;
+}
+
+typedef enum {
+    QUERY_FILE_LOG,
+    QUERY_FILE_SPECTRUM_L1,
+    QUERY_FILE_SPECTRUM_L2,
+    QUERY_FILE_SPECTRUM_BIN,
+    QUERY_FILE_SPECTRUM_ARCHIVE
+} query_file_kind_t;
+
+typedef struct {
+    int directory; /* Argument index */
+    char station[QUERY_PATH_MAX];
+    int day; /* YYYYMMDD */
+    query_file_kind_t kind;
+    bool journal; /* CSV lines as journal records, from the csv sink's journal mode */
+    char path[QUERY_PATH_MAX];
+} query_file_t;
+
+static const struct {
+    const char *prefix;
+    const char *extension;
+    query_file_kind_t kind;
+} query_file_types[] = {
+    { "log", "csv", QUERY_FILE_LOG },
+    { "spectruml1", "csv", QUERY_FILE_SPECTRUM_L1 },
+    { "spectruml2", "csv", QUERY_FILE_SPECTRUM_L2 },
+    { "log", "jnl", QUERY_FILE_LOG },
+    { "spectruml1", "jnl", QUERY_FILE_SPECTRUM_L1 },
+    { "spectruml2", "jnl", QUERY_FILE_SPECTRUM_L2 },
+    { "spectrum", "bin", QUERY_FILE_SPECTRUM_BIN },
+    { "spectrum", "jma", QUERY_FILE_SPECTRUM_ARCHIVE }
+};
+
+/* "<prefix>-jammon[-<id>]-YYYY-MM-DD.<extension>", as sink_filename_format() */
+static bool query_filename_parse(const char *directory, const char *name, query_file_t *file)
+{
+    const char *jammon, *extension, *date;
+    int year, month, mday, consumed = 0;
+    size_t prefix_length;
+    uint32_t i;
+
+    jammon = strstr(name, "-jammon");
+    extension = strrchr(name, '.');
+    if(jammon == NULL || extension == NULL || extension - jammon < 7 + 11)
+    {
+        return false;
+    }
+
+    date = extension - 10;
+    if(date[-1] != '-' || sscanf(date, "%4d-%2d-%2d%n", &year, &month, &mday, &consumed) != 3 || consumed != 10)
+    {
+        return false;
+    }
+
+    prefix_length = jammon - name;
+    for(i = 0; i < sizeof(query_file_types) / sizeof(query_file_types[0]); i++)
+    {
+        if(strlen(query_file_types[i].prefix) == prefix_length && strncmp(name, query_file_types[i].prefix, prefix_length) == 0
+            && strcmp(&extension[1], query_file_types[i].extension) == 0)
+        {
+            break;
+        }
+    }
+    if(i == sizeof(query_file_types) / sizeof(query_file_types[0]))
+    {
+        return false;
+    }
+    file->kind = query_file_types[i].kind;
+    file->journal = (strcmp(query_file_types[i].extension, "jnl") == 0);
+    file->day = (year * 10000) + (month * 100) + mday;
+
+    /* Named receivers are told apart by their id */
+    if(date - 1 == jammon + 7)
+    {
+        snprintf(file->station, sizeof(file->station), "%s", directory);
+    }
+    else
+    {
+        snprintf(file->station, sizeof(file->station), "%s:%.*s", directory, (int)((date - 1) - (jammon + 8)), jammon + 8);
+    }
+
+    return snprintf(file->path, sizeof(file->path), "%s/%s", directory, name) < (int)sizeof(file->path);
+}
+
+static int query_file_compare(const void *a, const void *b)
+{
+    const query_file_t *file_a = a, *file_b = b;
+    int result;
+
+    if(file_a->directory != file_b->directory)
+    {
+        return file_a->directory - file_b->directory;
+    }
+    result = strcmp(file_a->station, file_b->station);
+    if(result != 0)
+    {
+        return result;
+    }
+    if(file_a->day != file_b->day)
+    {
+        return file_a->day - file_b->day;
+    }
+    return (int)file_a->kind - (int)file_b->kind;
+}
+
+/* Files are named by the local date of their records, a day either side allows for a different TZ to the station */
+static bool query_day_overlaps(int day, uint64_t start_ms, uint64_t end_ms)
+{
+    struct tm tm;
+    time_t day_start;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = (day / 10000) - 1900;
+    tm.tm_mon = ((day / 100) % 100) - 1;
+    tm.tm_mday = day % 100;
+    tm.tm_isdst = -1;
+    day_start = mktime(&tm);
+    if(day_start < 0)
+    {
+        return true;
+    }
+
+    return (uint64_t)(day_start - 86400) * 1000 <= end_ms && (uint64_t)(day_start + (2 * 86400)) * 1000 > start_ms;
+}
+
+static bool csv_line_timestamp(const char *line, size_t length, uint64_t *timestamp_ms)
+{
+    char text[32];
+    const char *end;
+
+    /* The mapping isn't NUL terminated */
+    if(length >= sizeof(text))
+    {
+        length = sizeof(text) - 1;
+    }
+    memcpy(text, line, length);
+    text[length] = '\0';
+
+    end = timestamp_parse(text, timestamp_ms);
+    return end != NULL && *end == ',';
+}
+
+/* Offset of the first line at or after timestamp_ms, lines being in time order. Unparsable lines count as earlier */
+static size_t csv_find(const char *map, size_t size, uint64_t timestamp_ms)
+{
+    size_t low = 0, high = size, mid, line, next;
+    const char *end;
+    uint64_t line_ms;
+
+    while(low < high)
+    {
+        mid = low + ((high - low) / 2);
+        for(line = mid; line > low && map[line - 1] != '\n'; line--);
+        end = memchr(&map[line], '\n', size - line);
+        next = (end != NULL) ? (size_t)(end - map) + 1 : size;
+
+        if(csv_line_timestamp(&map[line], next - line, &line_ms) && line_ms >= timestamp_ms)
+        {
+            high = line;
+        }
+        else
+        {
+            low = next;
+        }
+    }
+
+    return low;
+}
+
+static uint64_t query_csv(const query_file_t *file, const char *stream, uint64_t start_ms, uint64_t end_ms)
+{
+    struct stat st;
+    const char *map, *end;
+    size_t offset, next;
+    uint64_t line_ms, rows = 0;
+    int fd;
+
+    fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open '%s'\n", file->path);
+        return 0;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        fprintf(stderr, "Error: Unable to map '%s'\n", file->path);
+        return 0;
+    }
+
+    for(offset = csv_find(map, st.st_size, start_ms); offset < (size_t)st.st_size; offset = next)
+    {
+        end = memchr(&map[offset], '\n', st.st_size - offset);
+        next = (end != NULL) ? (size_t)(end - map) + 1 : (size_t)st.st_size;
+
+        if(!csv_line_timestamp(&map[offset], next - offset, &line_ms))
+        {
+            continue;
+        }
+        if(line_ms > end_ms)
+        {
+            break;
+        }
+
+        printf("%s,%s,%.*s", file->station, stream, (int)(next - offset - (end != NULL ? 1 : 0)), &map[offset]);
+        putchar('\n');
+        rows++;
+    }
+
+    munmap((void *)map, st.st_size);
+    return rows;
+}
+
+/* As query_csv(), read through the journal's records. They're in time order too, but only a linear scan finds them */
+static uint64_t query_journal(const query_file_t *file, const char *stream, uint64_t start_ms, uint64_t end_ms)
+{
+    journal_reader_t reader;
+    const uint8_t *data;
+    uint32_t length;
+    uint64_t line_ms, rows = 0;
+
+    if(journal_reader_open(&reader, file->path) != 0)
+    {
+        return 0;
+    }
+
+    while(journal_reader_next(&reader, &data, &length))
+    {
+        if(!csv_line_timestamp((const char *)data, length, &line_ms) || line_ms < start_ms)
+        {
+            continue;
+        }
+        if(line_ms > end_ms)
+        {
+            break;
+        }
+
+        if(length > 0 && data[length - 1] == '\n')
+        {
+            length--;
+        }
+        printf("%s,%s,%.*s\n", file->station, stream, (int)length, (const char *)data);
+        rows++;
+    }
+
+    journal_reader_close(&reader);
+    return rows;
+}
+
+static uint64_t query_lines(const query_file_t *file, const char *stream, uint64_t start_ms, uint64_t end_ms)
+{
+    return file->journal ? query_journal(file, stream, start_ms, end_ms) : query_csv(file, stream, start_ms, end_ms);
+}
+
+static uint64_t query_bin(const query_file_t *file, uint64_t start_ms, uint64_t end_ms)
+{
+    spectrum_reader_t reader;
+    const spectrum_record_t *record;
+    char prefix[QUERY_PATH_MAX + 8];
+    uint64_t rows = 0;
+
+    if(spectrum_reader_open(&reader, file->path) != 0)
+    {
+        return 0;
+    }
+
+    for(uint64_t index = spectrum_reader_find(&reader, start_ms); (record = spectrum_reader_record(&reader, index)) != NULL; index++)
+    {
+        if(record->timestamp_ms > end_ms)
+        {
+            break;
+        }
+        for(int b = 0; b < reader.header->blocks; b++)
+        {
+            snprintf(prefix, sizeof(prefix), "%s,l%d,", file->station, b + 1);
+            spectrum_row_print(stdout, prefix, record->timestamp_ms, reader.header->flags & SPECTRUM_FLAG_SUBSECOND, &record->block[b]);
+            rows++;
+        }
+    }
+
+    spectrum_reader_close(&reader);
+    return rows;
+}
+
+static uint64_t query_archive(const query_file_t *file, uint64_t start_ms, uint64_t end_ms)
+{
+    archive_reader_t reader;
+    spectrum_record_t record;
+    char prefix[QUERY_PATH_MAX + 8];
+    uint64_t rows = 0;
+
+    if(archive_reader_open(&reader, file->path) != 0)
+    {
+        return 0;
+    }
+
+    archive_reader_seek(&reader, start_ms);
+    while(archive_reader_next(&reader, &record))
+    {
+        if(record.timestamp_ms < start_ms)
+        {
+            continue;
+        }
+        if(record.timestamp_ms > end_ms)
+        {
+            break;
+        }
+        for(int b = 0; b < reader.header->blocks; b++)
+        {
+            snprintf(prefix, sizeof(prefix), "%s,l%d,", file->station, b + 1);
+            spectrum_row_print(stdout, prefix, record.timestamp_ms, reader.header->flags & SPECTRUM_FLAG_SUBSECOND, &record.block[b]);
+            rows++;
+        }
+    }
+
+    archive_reader_close(&reader);
+    return rows;
+}
+
+/* Streams "<station>,<log|l1|l2>,<row as in the CSV files>", by station, then in time order.
+ *  Where a day's spectra are in several forms, the binary log is read, then the archive, then the CSVs */
+static int query(int argc, char *argv[])
+{
+    query_file_t *files = NULL, *file, *resized;
+    size_t files_count = 0, files_size = 0, group, next;
+    uint64_t start_ms = 0, end_ms = UINT64_MAX, rows = 0;
+    bool logs = true, spectra = true, have_bin, have_archive;
+    struct dirent *entry;
+    DIR *dir;
+    int option;
+
+    optind = 1;
+    while((option = getopt(argc, argv, "s:e:t:")) != -1)
+    {
+        switch(option)
+        {
+            case 's':
+                if(!time_parse(optarg, &start_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'e':
+                if(!time_parse(optarg, &end_ms))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 't':
+                logs = (strcmp(optarg, "log") == 0);
+                spectra = (strcmp(optarg, "spectrum") == 0);
+                if(!logs && !spectra)
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        usage();
+        return 1;
+    }
+
+    /* Only the names are read until the days in range are known */
+    for(int d = optind; d < argc; d++)
+    {
+        dir = opendir(argv[d]);
+        if(dir == NULL)
+        {
+            fprintf(stderr, "Error: Unable to open directory '%s'\n", argv[d]);
+            free(files);
+            return 1;
+        }
+
+        while((entry = readdir(dir)) != NULL)
+        {
+            if(files_count == files_size)
+            {
+                files_size = (files_size > 0) ? files_size * 2 : 64;
+                resized = realloc(files, files_size * sizeof(query_file_t));
+                if(resized == NULL)
+                {
+                    fprintf(stderr, "Error: Out of memory\n");
+                    free(files);
+                    closedir(dir);
+                    return 1;
+                }
+                files = resized;
+            }
+
+            file = &files[files_count];
+            file->directory = d;
+            if(query_filename_parse(argv[d], entry->d_name, file) && query_day_overlaps(file->day, start_ms, end_ms))
+            {
+                files_count++;
+            }
+        }
+        closedir(dir);
+    }
+
+    if(files_count == 0)
+    {
+        fprintf(stderr, "Warning: No log files in the time range\n");
+        free(files);
+        return 0;
+    }
+
+    qsort(files, files_count, sizeof(query_file_t), query_file_compare);
+    setvbuf(stdout, NULL, _IOFBF, 64 * 1024);
+
+    for(group = 0; group < files_count; group = next)
+    {
+        /* A station's files for one day */
+        have_bin = have_archive = false;
+        for(next = group; next < files_count && files[next].directory == files[group].directory
+            && strcmp(files[next].station, files[group].station) == 0 && files[next].day == files[group].day; next++)
+        {
+            have_bin |= (files[next].kind == QUERY_FILE_SPECTRUM_BIN);
+            have_archive |= (files[next].kind == QUERY_FILE_SPECTRUM_ARCHIVE);
+        }
+
+        for(file = &files[group]; file < &files[next]; file++)
+        {
+            switch(file->kind)
+            {
+                case QUERY_FILE_LOG:
+                    if(logs)
+                    {
+                        rows += query_lines(file, "log", start_ms, end_ms);
+                    }
+                    break;
+                case QUERY_FILE_SPECTRUM_L1:
+                case QUERY_FILE_SPECTRUM_L2:
+                    if(spectra && !have_bin && !have_archive)
+                    {
+                        rows += query_lines(file, file->kind == QUERY_FILE_SPECTRUM_L1 ? "l1" : "l2", start_ms, end_ms);
+                    }
+                    break;
+                case QUERY_FILE_SPECTRUM_BIN:
+                    if(spectra)
+                    {
+                        rows += query_bin(file, start_ms, end_ms);
+                    }
+                    break;
+                case QUERY_FILE_SPECTRUM_ARCHIVE:
+                    if(spectra && !have_bin)
+                    {
+                        rows += query_archive(file, start_ms, end_ms);
+                    }
+                    break;
+            }
+        }
+    }
+
+    if(fflush(stdout) != 0)
+    {
+        free(files);
+        return 1;
+    }
+
+    fprintf(stderr, "%"PRIu64" rows from %zu files\n", rows, files_count);
+    free(files);
+    return 0;
+}
+
+/* Unwraps a CSV sink journal, to stdout by default */
+static int jnl2csv(int argc, char *argv[])
+{
+    journal_reader_t reader;
+    const uint8_t *data;
+    uint32_t length;
+    uint64_t records = 0;
+    FILE *csv = stdout;
+    int result = 0;
+
+    if(argc < 2 || argc > 3)
+    {
+        usage();
+        return 1;
+    }
+
+    if(journal_reader_open(&reader, argv[1]) != 0)
+    {
+        return 1;
+    }
+
+    if(argc == 3)
+    {
+        csv = fopen(argv[2], "w");
+        if(csv == NULL)
+        {
+            fprintf(stderr, "Error: Unable to open '%s'\n", argv[2]);
+            journal_reader_close(&reader);
+            return 1;
+        }
+    }
+
+    while(journal_reader_next(&reader, &data, &length))
+    {
+        if(fwrite(data, 1, length, csv) != length)
+        {
+            result = 1;
+            break;
+        }
+        records++;
+    }
+
+    if(reader.offset != reader.map_size)
+    {
+        fprintf(stderr, "Warning: %zu bytes of torn or corrupt records at the end of '%s'\n", reader.map_size - reader.offset, argv[1]);
+    }
+
+    if((csv != stdout && fclose(csv) != 0) || (csv == stdout && fflush(stdout) != 0))
+    {
+        result = 1;
+    }
+    journal_reader_close(&reader);
+
+    fprintf(stderr, "%"PRIu64" records\n", records);
+    return result;
+}
+
+static int archive_info(const char *filename)
+{
+    archive_reader_t reader;
+    spectrum_record_t record;
+    uint64_t records = 0, first_ms = 0, last_ms = 0;
+
+    if(archive_reader_open(&reader, filename) != 0)
+    {
+        return 1;
+    }
+
+    while(archive_reader_next(&reader, &record))
+    {
+        if(records++ == 0)
+        {
+            first_ms = record.timestamp_ms;
+        }
+        last_ms = record.timestamp_ms;
+    }
+
+    printf("Archive: %"PRIu8" block(s), flags 0x%02"PRIx8", keyframe interval %"PRIu16"\n",
+        reader.header->blocks, reader.header->flags, reader.header->keyframe_interval);
+    printf("Records: %"PRIu64", %zu keyframes indexed\n", records, reader.index_count);
+    if(records > 0)
+    {
+        printf("Time: %"PRIu64".%03"PRIu64" - %"PRIu64".%03"PRIu64"\n", first_ms / 1000, first_ms % 1000, last_ms / 1000, last_ms % 1000);
+        printf("Size: %zu bytes, %.1f bytes per record (%.1f%% of the spectrum log)\n", reader.map_size, (double)reader.map_size / records,
+            100.0 * reader.map_size / (records * spectrum_record_size(reader.header->blocks)));
+    }
+    if(reader.offset != reader.map_size)
+    {
+        fprintf(stderr, "Warning: '%s' is corrupt after byte %zu\n", filename, reader.offset);
+    }
+
+    archive_reader_close(&reader);
+    return 0;
+}
+
+static int info(int argc, char *argv[])
+{
+    spectrum_reader_t reader;
+    const spectrum_record_t *first, *last;
+    char magic[ARCHIVE_MAGIC_SIZE];
+    FILE *fptr;
+
+    if(argc != 2)
+    {
+        usage();
+        return 1;
+    }
+
+    /* Either kind of file, by its magic */
+    fptr = fopen(argv[1], "r");
+    if(fptr == NULL)
+    {
+        fprintf(stderr, "Error: Unable to open '%s'\n", argv[1]);
+        return 1;
+    }
+    if(fread(magic, sizeof(magic), 1, fptr) == 1 && memcmp(magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) == 0)
+    {
+        fclose(fptr);
+        return archive_info(argv[1]);
+    }
+    fclose(fptr);
+
+    if(spectrum_reader_open(&reader, argv[1]) != 0)
+    {
+        return 1;
+    }
+
+    printf("Schema: %.*s\n", (int)reader.header->schema_length, reader.schema);
+    printf("Blocks: %"PRIu8", record size %"PRIu16" bytes, flags 0x%02"PRIx8"\n", reader.header->blocks, reader.header->record_size, reader.header->flags);
+    printf("Records: %"PRIu64"\n", reader.count);
+
+    first = spectrum_reader_record(&reader, 0);
+    last = spectrum_reader_record(&reader, reader.count - 1);
+    if(first != NULL && last != NULL)
+    {
+        printf("Time: %"PRIu64".%03"PRIu64" - %"PRIu64".%03"PRIu64"\n",
+            first->timestamp_ms / 1000, first->timestamp_ms % 1000, last->timestamp_ms / 1000, last->timestamp_ms % 1000);
+    }
+
+    spectrum_reader_close(&reader);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    if(strcmp(argv[1], "csv2bin") == 0)
+    {
+        return csv2bin(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "bin2csv") == 0)
+    {
+        return bin2csv(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "bin2arc") == 0)
+    {
+        return bin2arc(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "arc2bin") == 0)
+    {
+        return arc2bin(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "jnl2csv") == 0)
+    {
+        return jnl2csv(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "query") == 0)
+    {
+        return query(argc - 1, &argv[1]);
+    }
+    else if(strcmp(argv[1], "info") == 0)
+    {
+        return info(argc - 1, &argv[1]);
+    }
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "ubx.h"
+
+/* Fletcher checksum over class, id, length and payload */
+static void ubx_checksum(const uint8_t *buffer, int32_t buffer_size, uint8_t *ck_a_ptr, uint8_t *ck_b_ptr)
+{
+    uint32_t ck_a = 0, ck_b = 0;
+
+    for(int i = 2; i<(buffer_size-2); i++)
+    {
+        ck_a += buffer[i];
+        ck_b += ck_a;
+    }
+
+    *ck_a_ptr = ck_a & 0xFF;
+    *ck_b_ptr = ck_b & 0xFF;
+}
+
+bool ubx_verify_checksum(const uint8_t *buffer, int32_t buffer_size)
+{
+    uint8_t ck_a, ck_b;
+
+    ubx_checksum(buffer, buffer_size, &ck_a, &ck_b);
+
+    return (ck_a == buffer[buffer_size-2]) && (ck_b == buffer[buffer_size-1]);
+}
+
+/* Assemble a complete frame around the payload (which may be NULL if payload_length is 0).
+ *  Returns the frame length, or 0 if it does not fit in frame_size. */
+uint32_t ubx_frame_build(uint8_t *frame, uint32_t frame_size, uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t payload_length)
+{
+    uint32_t frame_length = 6+2+payload_length;
+
+    if(frame_length > frame_size)
+    {
+        return 0;
+    }
+
+    frame[0] = 0xb5;
+    frame[1] = 0x62;
+    frame[2] = msg_class;
+    frame[3] = msg_id;
+    frame[4] = payload_length & 0xFF;
+    frame[5] = payload_length >> 8;
+    if(payload_length > 0)
+    {
+        memcpy(&frame[6], payload, payload_length);
+    }
+    ubx_checksum(frame, frame_length, &frame[frame_length-2], &frame[frame_length-1]);
+
+    return frame_length;
+}
+
+void ubx_framer_init(ubx_framer_t *framer)
+{
+    memset(framer, 0, sizeof(ubx_framer_t));
+}
+
+/* Discard any buffered bytes, statistics are kept */
+void ubx_framer_reset(ubx_framer_t *framer)
+{
+    framer->head = 0;
+    framer->tail = 0;
+}
+
+/* Read as many bytes as are available (up to the free space) in a single call.
+ *  Returns the result of read(): 0 on EOF, <0 on error (see errno).
+ *  Any frame pointers previously returned are invalidated. */
+int32_t ubx_framer_fill(ubx_framer_t *framer, int fd)
+{
+    int32_t device_response;
+
+    if(framer->head == framer->tail)
+    {
+        /* Empty, rewind for free */
+        framer->head = 0;
+        framer->tail = 0;
+    }
+    else if((UBX_FRAMER_BUFFER_LENGTH - framer->tail) < UBX_FRAME_MAX_LENGTH)
+    {
+        /* Move partial frame down to make room for at least one whole frame */
+        memmove(framer->buffer, &framer->buffer[framer->head], framer->tail - framer->head);
+        framer->tail -= framer->head;
+        framer->head = 0;
+    }
+
+    device_response = read(fd, &framer->buffer[framer->tail], UBX_FRAMER_BUFFER_LENGTH - framer->tail);
+    framer->read_calls++;
+
+    if(device_response > 0)
+    {
+        framer->tail += device_response;
+        framer->read_bytes += device_response;
+    }
+
+    return device_response;
+}
+
+static const uint8_t msg_header[2] = { 0xb5, 0x62 };
+
+/* Find the next complete, checksum-verified frame in the buffer.
+ *  Returns the frame length and sets *frame_ptr to the frame in-place in the buffer,
+ *   the pointer is valid until the next call to ubx_framer_fill().
+ *  Returns 0 when more data is needed, leftover bytes are kept for the next fill. */
+uint32_t ubx_framer_next(ubx_framer_t *framer, uint8_t **frame_ptr)
+{
+    uint8_t *sync_ptr;
+    uint8_t *frame;
+    uint32_t available;
+    uint32_t response_length;
+
+    while(framer->head < framer->tail)
+    {
+        /* Skip to next candidate sync byte */
+        sync_ptr = memchr(&framer->buffer[framer->head], msg_header[0], framer->tail - framer->head);
+        if(sync_ptr == NULL)
+        {
+            framer->head = framer->tail;
+            return 0;
+        }
+        framer->head = sync_ptr - framer->buffer;
+
+        available = framer->tail - framer->head;
+        if(available < 6)
+        {
+            /* Need Header, Class, ID and Length */
+            return 0;
+        }
+
+        frame = &framer->buffer[framer->head];
+        if(frame[1] != msg_header[1])
+        {
+            framer->head++;
+            continue;
+        }
+
+        response_length = frame[5] << 8 | frame[4];
+        if((6+2+response_length) > UBX_FRAME_MAX_LENGTH)
+        {
+            framer->oversize_errors++;
+            fprintf(stderr, "Error: UBX Response too long for buffer (%"PRIu32"/%d)\n", response_length, UBX_FRAME_MAX_LENGTH);
+            framer->head++;
+            continue;
+        }
+
+        if(available < (6+2+response_length))
+        {
+            /* Incomplete, wait for remainder */
+            return 0;
+        }
+
+        if(!ubx_verify_checksum(frame, (6+2+response_length)))
+        {
+            framer->checksum_errors++;
+
+            if(framer->verbose)
+            {
+                fprintf(stderr, " - CRC fail (message: %02x, %02x)\n", frame[2], frame[3]);
+            }
+
+            /* Resync from the byte after this false header */
+            framer->head++;
+            continue;
+        }
+
+        framer->head += (6+2+response_length);
+        framer->frames++;
+
+        *frame_ptr = frame;
+        return (6+2+response_length);
+    }
+
+    return 0;
+}
+
+void ubx_framer_print_stats(ubx_framer_t *framer, FILE *stream)
+{
+    fprintf(stream, "UBX Framer: %"PRIu64" frames, %"PRIu64" reads (%.2f reads/frame), %"PRIu64" bytes, %"PRIu64" CRC errors, %"PRIu64" oversize\n",
+        framer->frames,
+        framer->read_calls,
+        framer->frames > 0 ? (double)framer->read_calls / framer->frames : 0.0,
+        framer->read_bytes,
+        framer->checksum_errors,
+        framer->oversize_errors
+    );
+}
+
+void ubx_dispatch_init(ubx_dispatcher_t *dispatcher, const char *label)
+{
+    memset(dispatcher, 0, sizeof(ubx_dispatcher_t));
+    dispatcher->label = label;
+}
+
+static ubx_dispatch_entry_t *ubx_dispatch_class(ubx_dispatcher_t *dispatcher, uint8_t msg_class)
+{
+    if(dispatcher->classes[msg_class] == NULL)
+    {
+        /* At most once per class */
+        dispatcher->classes[msg_class] = calloc(256, sizeof(ubx_dispatch_entry_t));
+    }
+
+    return dispatcher->classes[msg_class];
+}
+
+int ubx_dispatch_register(ubx_dispatcher_t *dispatcher, uint8_t msg_class, uint8_t msg_id, const char *name,
+    uint16_t min_length, int16_t version_offset, uint8_t version, ubx_handler_t handler, void *arg)
+{
+    ubx_dispatch_entry_t *entry;
+
+    if(version_offset != UBX_NO_VERSION && version_offset >= min_length)
+    {
+        fprintf(stderr, "Error: %s version byte is outside its minimum length\n", name);
+        return -1;
+    }
+
+    if(ubx_dispatch_class(dispatcher, msg_class) == NULL)
+    {
+        fprintf(stderr, "Error: Unable to allocate dispatch table\n");
+        return -1;
+    }
+
+    entry = &dispatcher->classes[msg_class][msg_id];
+    entry->handler = handler;
+    entry->arg = arg;
+    entry->name = name;
+    entry->min_length = min_length;
+    entry->version_offset = version_offset;
+    entry->version = version;
+
+    return 0;
+}
+
+/* Returns true if a handler accepted the frame */
+bool ubx_dispatch(ubx_dispatcher_t *dispatcher, const uint8_t *frame, uint32_t length, uint64_t received_monotonic_ms)
+{
+    ubx_dispatch_entry_t *entry;
+    const uint8_t *payload = &frame[6];
+    uint16_t payload_length = length - (6+2);
+
+    /* Classes without any registered handler have no table, and are only counted */
+    entry = dispatcher->classes[frame[2]];
+    if(entry == NULL)
+    {
+        dispatcher->dropped++;
+        return false;
+    }
+    entry = &entry[frame[3]];
+
+    if(entry->handler == NULL)
+    {
+        entry->count++;
+        dispatcher->dropped++;
+        return false;
+    }
+
+    if(payload_length < entry->min_length)
+    {
+        entry->rejected_length++;
+        fprintf(stderr, "[%s] Error: %s too short, expected at least %"PRIu16", received: %"PRIu16"\n",
+            dispatcher->label, entry->name, entry->min_length, payload_length);
+        return false;
+    }
+
+    if(entry->version_offset != UBX_NO_VERSION && payload[entry->version_offset] != entry->version)
+    {
+        entry->rejected_version++;
+        fprintf(stderr, "[%s] Error: Version mismatch of %s, expected 0x%02"PRIx8", received: 0x%02"PRIx8"\n",
+            dispatcher->label, entry->name, entry->version, payload[entry->version_offset]);
+        return false;
+    }
+
+    entry->count++;
+    entry->handler(entry->arg, payload, payload_length, received_monotonic_ms);
+
+    return true;
+}
+
+void ubx_dispatch_print_stats(ubx_dispatcher_t *dispatcher, FILE *stream)
+{
+    ubx_dispatch_entry_t *entry;
+
+    fprintf(stream, "UBX Dispatch: %"PRIu64" unhandled\n", dispatcher->dropped);
+
+    for(int c = 0; c < 256; c++)
+    {
+        if(dispatcher->classes[c] == NULL)
+        {
+            continue;
+        }
+
+        for(int i = 0; i < 256; i++)
+        {
+            entry = &dispatcher->classes[c][i];
+            if(entry->count == 0 && entry->rejected_length == 0 && entry->rejected_version == 0)
+            {
+                continue;
+            }
+
+            fprintf(stream, " - %02x-%02x %-10s %"PRIu64" (rejected: %"PRIu64" length, %"PRIu64" version)\n",
+                c, i, entry->handler != NULL ? entry->name : "unhandled",
+                entry->count, entry->rejected_length, entry->rejected_version);
+        }
+    }
+}
+
+void ubx_dispatch_free(ubx_dispatcher_t *dispatcher)
+{
+    for(int c = 0; c < 256; c++)
+    {
+        free(dispatcher->classes[c]);
+        dispatcher->classes[c] = NULL;
+    }
+}
@@ -0,0 +1,194 @@
+#ifndef __UBX_H__
+#define __UBX_H__
+
+/* Largest UBX frame accepted, including sync, header and checksum */
+#define UBX_FRAME_MAX_LENGTH        2048
+
+/* Framer buffer, holds several frames so that reads can be made in large blocks */
+#define UBX_FRAMER_BUFFER_LENGTH    (4 * UBX_FRAME_MAX_LENGTH)
+
+typedef struct {
+    uint8_t buffer[UBX_FRAMER_BUFFER_LENGTH];
+    uint32_t head; /* Start of unconsumed bytes */
+    uint32_t tail; /* End of received bytes */
+    bool verbose; /* Report checksum failures */
+
+    /* Statistics */
+    uint64_t read_calls;
+    uint64_t read_bytes;
+    uint64_t frames;
+    uint64_t checksum_errors;
+    uint64_t oversize_errors;
+} ubx_framer_t;
+
+/* Message dispatch, handlers are registered per class/id and receive the payload (offset 6 in frame) */
+
+typedef void (*ubx_handler_t)(void *arg, const uint8_t *payload, uint16_t payload_length, uint64_t received_monotonic_ms);
+
+#define UBX_NO_VERSION  -1
+
+typedef struct {
+    ubx_handler_t handler; /* NULL for unhandled types, which are only counted */
+    void *arg;
+    const char *name;
+    uint16_t min_length; /* Minimum payload length */
+    int16_t version_offset; /* Payload offset of version byte, or UBX_NO_VERSION */
+    uint8_t version;
+
+    /* Statistics */
+    uint64_t count;
+    uint64_t rejected_length;
+    uint64_t rejected_version;
+} ubx_dispatch_entry_t;
+
+typedef struct {
+    const char *label; /* Prefix for error messages */
+    ubx_dispatch_entry_t *classes[256]; /* Table of 256 ids, allocated when a class is first registered */
+    uint64_t dropped; /* Unhandled messages */
+} ubx_dispatcher_t;
+
+/* Message payload layouts (offset 6 in frame) */
+
+typedef struct
+{
+    char sw_version[30];
+    char hw_version[10];
+    /* Followed by any number of 30 character extensions, eg. "FWVER=HPG 1.32" */
+} __attribute__((packed)) mon_ver_t;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t num_rfblocks;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+} __attribute__((packed)) mon_rf_header_t;
+
+typedef struct
+{
+    uint8_t rfblock_id;
+    uint8_t flags;
+    uint8_t antStatus;
+    uint8_t antPower;
+    uint32_t postStatus;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+    uint8_t _reserved3;
+    uint8_t _reserved4;
+    uint16_t noisePerMS;
+    uint16_t agcCnt;
+    uint8_t jamInd; /* CW jamming measure */
+    int8_t ofsI;
+    uint8_t magI;
+    int8_t ofsQ;
+    uint8_t magQ;
+    uint8_t _reserved5;
+    uint8_t _reserved6;
+    uint8_t _reserved7;
+} __attribute__((packed)) mon_rf_rfblock_t;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t num_rfblocks;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+} __attribute__((packed)) mon_span_header_t;
+
+typedef struct
+{
+    uint8_t spectrum[256];
+    uint32_t span;
+    uint32_t res;
+    uint32_t center;
+    uint8_t pga;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+    uint8_t _reserved3;
+} __attribute__((packed)) mon_span_rfblock_t;
+
+typedef struct
+{
+    uint32_t itow;
+    uint16_t year;
+    uint8_t month; // jan = 1
+    uint8_t day;
+    uint8_t hour; // 24
+    uint8_t min;
+    uint8_t sec;
+    uint8_t valid;
+    uint32_t tAcc;
+    int32_t nano;
+    uint8_t fixtype;
+    uint8_t flags;
+    uint8_t flags2;
+    uint8_t numsv;
+    //      1e-7       mm       mm
+    int32_t lon, lat, height, hMSL;
+    //        mm     mm
+    uint32_t hAcc, vAcc;
+    //      mm/s   mm/s  mm/s  mm/s
+    int32_t velN, velE, velD, gSpeed; // millimeters
+} __attribute__((packed)) nav_pvt_t;
+
+typedef struct
+{
+    uint32_t itow;
+    uint8_t version;
+    uint8_t num_svs;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+} __attribute__((packed)) nav_sat_header_t;
+
+typedef struct
+{
+    uint8_t gnss_id;
+    uint8_t sv_id;
+    uint8_t cn0;
+    int8_t elevation;
+    int16_t azimuth;
+    int16_t psr_res;
+    uint32_t flags;
+} __attribute__((packed)) nav_sat_sv_t;
+
+typedef struct
+{
+    uint32_t itow;
+    uint8_t version;
+    uint8_t num_svs;
+    uint8_t _reserved1;
+    uint8_t _reserved2;
+} __attribute__((packed)) nav_sig_header_t;
+
+typedef struct
+{
+    uint8_t gnss_id;
+    uint8_t sv_id;
+    uint8_t sig_id;
+    uint8_t freq_id;
+    int16_t pr_res;
+    uint8_t cn0;
+    uint8_t qualInd;
+    uint8_t corrSource;
+    uint8_t ionoModel;
+    uint16_t flags;
+    uint8_t _reserved0;
+} __attribute__((packed)) nav_sig_sv_t;
+
+bool ubx_verify_checksum(const uint8_t *buffer, int32_t buffer_size);
+uint32_t ubx_frame_build(uint8_t *frame, uint32_t frame_size, uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t payload_length);
+
+void ubx_framer_init(ubx_framer_t *framer);
+void ubx_framer_reset(ubx_framer_t *framer);
+int32_t ubx_framer_fill(ubx_framer_t *framer, int fd);
+uint32_t ubx_framer_next(ubx_framer_t *framer, uint8_t **frame_ptr);
+void ubx_framer_print_stats(ubx_framer_t *framer, FILE *stream);
+
+void ubx_dispatch_init(ubx_dispatcher_t *dispatcher, const char *label);
+int ubx_dispatch_register(ubx_dispatcher_t *dispatcher, uint8_t msg_class, uint8_t msg_id, const char *name,
+    uint16_t min_length, int16_t version_offset, uint8_t version, ubx_handler_t handler, void *arg);
+bool ubx_dispatch(ubx_dispatcher_t *dispatcher, const uint8_t *frame, uint32_t length, uint64_t received_monotonic_ms);
+void ubx_dispatch_print_stats(ubx_dispatcher_t *dispatcher, FILE *stream);
+void ubx_dispatch_free(ubx_dispatcher_t *dispatcher);
+
+#endif /* __UBX_H__ */
@@ -16,12 +16,34 @@ var spectrum_graph_data = [];
 var spectrum_graph2 = null;
 var spectrum_graph2_data = [];
 
+// Receiver to display when jammon monitors several, eg. index.html?receiver=roof, defaults to the first heard
+var display_receiver = new URLSearchParams(window.location.search).get('receiver');
+
+// Backfill from the telemetry spool (key 14), oldest first
+var backfill_count = 0;
+var backfill_previous = null;
+const backfill_track_gap_s = 60; // Longer between datapoints is a separate outage, not joined up
+
 socket.on('connect', function ()
 {
     socket.on('update', function (data)
     {
         //console.log(data);
 
+        // 12: Receiver id (optional)
+        if('12' in data)
+        {
+            if(display_receiver == null)
+            {
+                display_receiver = data['12'];
+            }
+            if(data['12'] != display_receiver)
+            {
+                return;
+            }
+            $("#gnss-receiver").text(data['12']);
+        }
+
         var multiband = false;
         if('11' in data)
         {
@@ -275,6 +297,39 @@ socket.on('connect', function ()
         }
 
     });
+
+    // Backfill is history the live view missed while the telemetry was down. It fills in the track on the map and is
+    // counted, the current values, marker and spectra stay with the live datapoints.
+    socket.on('backfill', function (data)
+    {
+        if('12' in data)
+        {
+            if(display_receiver == null)
+            {
+                display_receiver = data['12'];
+            }
+            if(data['12'] != display_receiver)
+            {
+                return;
+            }
+        }
+
+        backfill_count++;
+        $("#gnss-backfill").text(`Backfilled: ${backfill_count}, up to ${(new Date(data['0'] * 1000)).toLocaleString()}`);
+
+        const latlng = new L.LatLng((data['1'][0] / 1.0e7), (data['1'][1] / 1.0e7));
+        if(location_map != null && backfill_previous != null && Math.abs(data['0'] - backfill_previous.timestamp) <= backfill_track_gap_s)
+        {
+            new L.Polyline([backfill_previous.latlng, latlng], {
+                color: 'blue',
+                weight: 3,
+                opacity: 0.5,
+                dashArray: '4 6',
+                smoothFactor: 0
+            }).addTo(location_map);
+        }
+        backfill_previous = { timestamp: data['0'], latlng: latlng };
+    });
 });
 
 var roundTo = function(n, d)
@@ -14,6 +14,76 @@ const io = require('socket.io')(http);
 
 /*** UDP ***/
 
+/* Spectrum deltas (udp sink delta=<n>), per sender: the recent keyframes of each band by sequence number, and the
+ * sequence numbers seen live. Backfill from the spool (udp sink spool=<path>, key 14 true) shares the keyframes, as
+ * deltas spooled when a destination went down refer to a keyframe that went live, and those sent live when it came
+ * back are spooled again to be rebuilt from a keyframe that only arrives as backfill */
+const senders = new Map();
+const keyframes_kept = 64; /* Per band, enough for the backfill to catch up with the oldest it refers to */
+
+function spectrum_rebuild(sender, datapoint, delta_key, key) {
+  const delta = datapoint[delta_key];
+  if (delta === undefined) {
+    return;
+  }
+  delete datapoint[delta_key];
+
+  const keyframe = sender.keyframes[key].get(delta[0]);
+  if (keyframe === undefined) {
+    /* Keyframe lost, the spectrum is left out until the next one */
+    sender.waiting++;
+    return;
+  }
+
+  const spectrum = Uint8Array.from(keyframe[2]);
+  const pairs = delta[1];
+  for (let i = 0; i + 1 < pairs.length; i += 2) {
+    spectrum[pairs[i]] = pairs[i + 1];
+  }
+  datapoint[key] = [keyframe[0], keyframe[1], spectrum, keyframe[3]];
+}
+
+function datapoint_decode(datapoint, rinfo) {
+  if (datapoint[13] === undefined) {
+    return datapoint;
+  }
+
+  const backfill = (datapoint[14] === true);
+  const sender_key = `${rinfo.address}/${datapoint[12] || ''}`;
+  let sender = senders.get(sender_key);
+  if (sender === undefined) {
+    sender = { sequence: undefined, keyframes: { 10: new Map(), 11: new Map() }, lost: 0, waiting: 0 };
+    senders.set(sender_key, sender);
+  }
+
+  /* Backfill only carries what the live stream missed, its gaps are expected */
+  if (!backfill) {
+    if (sender.sequence !== undefined && datapoint[13] !== ((sender.sequence + 1) >>> 0)) {
+      const gap = (datapoint[13] - sender.sequence - 1) >>> 0;
+      if (gap < 0x80000000) {
+        sender.lost += gap;
+        console.log(`${sender_key}: ${gap} datapoints lost (${sender.lost} in total)`);
+      }
+    }
+    sender.sequence = datapoint[13];
+  }
+
+  [10, 11].forEach((key) => {
+    const keyframes = sender.keyframes[key];
+    if (datapoint[key] !== undefined) {
+      keyframes.delete(datapoint[13]);
+      keyframes.set(datapoint[13], datapoint[key]);
+      if (keyframes.size > keyframes_kept) {
+        keyframes.delete(keyframes.keys().next().value);
+      }
+    }
+  });
+  spectrum_rebuild(sender, datapoint, 20, 10);
+  spectrum_rebuild(sender, datapoint, 21, 11);
+
+  return datapoint;
+}
+
 server.on('error', (err) => {
   console.log(`server error:\n${err.stack}`);
   server.close();
@@ -28,7 +98,12 @@ server.on('message', (msg, rinfo) => {
 
   //console.log(`decoded: ${JSON.stringify(msg_decoded, null, 4)}`);
 
-  io.emit('update', msg_decoded);
+  /* Batched telemetry (udp sink batch=<n>) is an array of datapoints, oldest first. Backfill is history, it goes on its
+   * own event so that the live view doesn't jump back in time while the spool drains */
+  const datapoints = Array.isArray(msg_decoded) ? msg_decoded : [msg_decoded];
+  datapoints.forEach((datapoint) => {
+    io.emit((datapoint[14] === true) ? 'backfill' : 'update', datapoint_decode(datapoint, rinfo));
+  });
 });
 
 server.on('listening', () => {